@@ -0,0 +1,183 @@
+#include "_direct_io.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static size_t alignUp(size_t size) {
+    return (size + directAlignment - 1) & ~(directAlignment - 1);
+}
+
+_AlignedBuffer::_AlignedBuffer(size_t size) {
+    reserve(size);
+}
+
+_AlignedBuffer::~_AlignedBuffer() {
+    std::free(ptr);
+}
+
+void _AlignedBuffer::reserve(size_t size) {
+    if (size <= capacity)
+        return;
+
+    std::free(ptr);
+    ptr = nullptr;
+    capacity = 0;
+
+    void *mem = nullptr;
+    size = alignUp(size);
+    if (posix_memalign(&mem, directAlignment, size) == 0) {
+        ptr = (char *) mem;
+        capacity = size;
+    }
+}
+
+int directOpen(const char *filename, bool writable) {
+    #if defined(O_DIRECT)
+    int flags = writable ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+    return ::open(filename, flags | O_DIRECT | O_CLOEXEC, 0644);
+    #else
+    (void) filename;
+    (void) writable;
+    return -1;
+    #endif
+}
+
+// a single transfer, O_DIRECT may not be repeated at the unaligned offset a short read ends on
+static ssize_t directPread(int fd, char *dest, size_t size, unsigned long long offset) {
+    ssize_t got;
+    do {
+        got = ::pread(fd, dest, size, (off_t) offset);
+    } while (got < 0 && errno == EINTR);
+    return got;
+}
+
+long long directReadAt(int fd, char *dest, size_t size, unsigned long long offset, _AlignedBuffer &bounce) {
+    unsigned long long start = offset & ~(unsigned long long) (directAlignment - 1);
+    auto head = (size_t) (offset - start);
+    size_t span = alignUp(head + size);
+    bounce.reserve(span);
+    if (bounce.data() == nullptr)
+        return -1;
+
+    size_t done = 0;
+    while (done < span) {
+        ssize_t got = directPread(fd, bounce.data() + done, span - done, start + done);
+        if (got < 0)
+            return -1;
+
+        done += (size_t) got;
+        if (got == 0 || done % directAlignment != 0) break;
+    }
+
+    if (done <= head)
+        return 0;
+
+    size_t copied = done - head < size ? done - head : size;
+    std::memcpy(dest, bounce.data() + head, copied);
+    return (long long) copied;
+}
+
+_DirectReadBuf::_DirectReadBuf(size_t bufferSize) : buffer(alignUp(bufferSize)) {}
+
+_DirectReadBuf::~_DirectReadBuf() {
+    if (fd >= 0) ::close(fd);
+}
+
+bool _DirectReadBuf::open(const char *filename) {
+    fd = directOpen(filename, false);
+    return fd >= 0 && buffer.data() != nullptr;
+}
+
+_DirectReadBuf::int_type _DirectReadBuf::underflow() {
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+
+    // offsets stay aligned until the short read at the end of file
+    if (fd < 0 || fileOffset % directAlignment != 0)
+        return traits_type::eof();
+
+    ssize_t got = directPread(fd, buffer.data(), buffer.size(), fileOffset);
+    if (got <= 0)
+        return traits_type::eof();
+
+    fileOffset += (unsigned long long) got;
+    setg(buffer.data(), buffer.data(), buffer.data() + got);
+    return traits_type::to_int_type(*gptr());
+}
+
+_DirectWriteBuf::_DirectWriteBuf(size_t bufferSize) : buffer(alignUp(bufferSize)) {}
+
+_DirectWriteBuf::~_DirectWriteBuf() {
+    close();
+}
+
+bool _DirectWriteBuf::open(const char *filename) {
+    fd = directOpen(filename, true);
+    return fd >= 0 && buffer.data() != nullptr;
+}
+
+void _DirectWriteBuf::writeFull() {
+    size_t done = 0;
+    while (!failed && done < used) {
+        ssize_t written = ::pwrite(fd, buffer.data() + done, used - done, (off_t) (fileOffset + done));
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) {
+            failed = true;
+            break;
+        }
+        done += (size_t) written;
+    }
+
+    fileOffset += used;
+    used = 0;
+}
+
+std::streamsize _DirectWriteBuf::xsputn(const char *s, std::streamsize n) {
+    auto left = (size_t) n;
+    while (left > 0) {
+        size_t chunk = buffer.size() - used < left ? buffer.size() - used : left;
+        std::memcpy(buffer.data() + used, s, chunk);
+        used += chunk;
+        s += chunk;
+        left -= chunk;
+
+        if (used == buffer.size()) writeFull();
+    }
+
+    return failed ? 0 : n;
+}
+
+_DirectWriteBuf::int_type _DirectWriteBuf::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+
+    char ch = traits_type::to_char_type(c);
+    return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
+
+bool _DirectWriteBuf::close() {
+    if (fd < 0)
+        return !failed;
+
+    size_t aligned = used & ~(directAlignment - 1);
+    size_t tail = used - aligned;
+    used = aligned;
+    writeFull();
+
+    if (tail > 0 && !failed) {
+        #if defined(O_DIRECT)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        #endif
+        ssize_t written;
+        do {
+            written = ::pwrite(fd, buffer.data() + aligned, tail, (off_t) fileOffset);
+        } while (written < 0 && errno == EINTR);
+        failed = written != (ssize_t) tail;
+    }
+
+    ::close(fd);
+    fd = -1;
+    return !failed;
+}
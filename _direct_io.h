@@ -0,0 +1,94 @@
+#ifndef ZPACK_DIRECT_IO_H
+#define ZPACK_DIRECT_IO_H
+
+#include <cstddef>
+#include <streambuf>
+
+/*
+ * Direct I/O bypassing the page cache. Offsets, sizes and buffers of O_DIRECT transfers have to be
+ * aligned, unaligned heads and tails are read through a covering aligned range and written after
+ * O_DIRECT is dropped from the descriptor. Opening fails on systems and filesystems without O_DIRECT,
+ * callers fall back to buffered I/O then.
+ */
+static const size_t directAlignment = 4096;
+
+class _AlignedBuffer {
+    char *ptr = nullptr;
+    size_t capacity = 0;
+
+public:
+    _AlignedBuffer() = default;
+
+    explicit _AlignedBuffer(size_t size);
+
+    ~_AlignedBuffer();
+
+    _AlignedBuffer(_AlignedBuffer const &) = delete;
+
+    _AlignedBuffer &operator=(_AlignedBuffer const &) = delete;
+
+    // keeps the content only when the capacity is already enough
+    void reserve(size_t size);
+
+    char *data() {
+        return ptr;
+    }
+
+    size_t size() const {
+        return capacity;
+    }
+};
+
+int directOpen(const char *filename, bool writable);
+
+// bytes copied to dest, less than size only at the end of file, -1 on error
+long long directReadAt(int fd, char *dest, size_t size, unsigned long long offset, _AlignedBuffer &bounce);
+
+/*
+ * Sequential source read with O_DIRECT, for files packed by a bulk job.
+ */
+class _DirectReadBuf : public std::streambuf {
+    int fd = -1;
+    _AlignedBuffer buffer;
+    unsigned long long fileOffset = 0;
+
+protected:
+    int_type underflow() override;
+
+public:
+    explicit _DirectReadBuf(size_t bufferSize);
+
+    ~_DirectReadBuf() override;
+
+    bool open(const char *filename);
+};
+
+/*
+ * Sequential output written with O_DIRECT in whole aligned blocks, the unaligned tail goes out
+ * through the page cache on close.
+ */
+class _DirectWriteBuf : public std::streambuf {
+    int fd = -1;
+    _AlignedBuffer buffer;
+    size_t used = 0;
+    unsigned long long fileOffset = 0;
+    bool failed = false;
+
+    void writeFull();
+
+protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+    int_type overflow(int_type c) override;
+
+public:
+    explicit _DirectWriteBuf(size_t bufferSize);
+
+    ~_DirectWriteBuf() override;
+
+    bool open(const char *filename);
+
+    bool close();
+};
+
+#endif //ZPACK_DIRECT_IO_H
@@ -0,0 +1,175 @@
+#include "_directory_codec.h"
+#include <algorithm>
+#include <cstring>
+#include "_varint.h"
+#include "zpack_zstd.h"
+
+// the directory is written on every commit, a fast level keeps that cheap
+static const short int directoryLevel = 3;
+// sanity limit for the size claimed by a damaged header
+static const ullint directoryEncodedMax = 1ULL << 34;
+
+// zstd blocks decode to at most 128 KiB and the smallest one, a run, takes 4 bytes
+static ullint encodedSizeMax(size_t frameSize) {
+    return ((ullint) frameSize / 4 + 1) * (128 << 10);
+}
+
+std::string packDirectory(std::vector<DirectoryFileQueue const *> entries) {
+    std::sort(entries.begin(), entries.end(), [](DirectoryFileQueue const *a, DirectoryFileQueue const *b) {
+        return a->filename < b->filename;
+    });
+
+    std::string encoded;
+    encoded.reserve(entries.size() * 32);
+    putVarint(encoded, entries.size());
+
+    std::string const *previousName = nullptr;
+    llint previousMtime = 0;
+    ullint previousOffset = 0;
+    for (auto entry : entries) {
+        DirectoryFileHeaderRecord const &record = entry->record;
+        std::string const &name = entry->filename;
+
+        size_t shared = 0;
+        if (previousName) {
+            size_t limit = std::min(name.size(), previousName->size());
+            while (shared < limit && name[shared] == (*previousName)[shared]) shared++;
+        }
+        putVarint(encoded, shared);
+        putVarint(encoded, name.size() - shared);
+        encoded.append(name, shared, std::string::npos);
+
+        putVarint(encoded, record.getVersionBy());
+        putVarint(encoded, record.getVersionMin());
+        putVarint(encoded, record.getGeneral());
+        putVarint(encoded, record.getCompressMethod());
+        // checksums do not get shorter as varints
+        encoded.append((const char *) record.crc32, sizeof(record.crc32));
+        putVarint(encoded, zigzag(record.getMtime() - previousMtime));
+        putVarint(encoded, record.getCompressedSize());
+        putVarint(encoded, record.getUncompressedSize());
+        putVarint(encoded, zigzag((llint) (record.getOffsetRecord() - previousOffset)));
+        putVarint(encoded, zigzag((llint) (record.getOffsetFile() - record.getOffsetRecord())));
+        putVarint(encoded, record.getAttrsInternal());
+        putVarint(encoded, record.getAttrsExternal());
+
+        size_t extraLen = entry->extra.size() * sizeof(LocalFileExtraField);
+        putVarint(encoded, extraLen);
+        if (extraLen > 0) encoded.append((const char *) entry->extra.data(), extraLen);
+        putVarint(encoded, entry->comment.size());
+        encoded.append(entry->comment);
+
+        previousName = &name;
+        previousMtime = record.getMtime();
+        previousOffset = record.getOffsetRecord();
+    }
+
+    zpack_zstd codec;
+    codec.setCompressionLevel(directoryLevel);
+    auto bound = (size_t) codec.getCompressedSize(encoded.size());
+
+    std::string res(sizeof(uint) + sizeof(ullint) + bound, '\0');
+    assignInt<uint>(ZPack::CompressedDirectory, (uchar *) &res[0]);
+    assignInt<ullint>(encoded.size(), (uchar *) &res[sizeof(uint)]);
+    auto compressed = (size_t) codec.compressBlock(encoded.data(), encoded.size(),
+                                                   &res[sizeof(uint) + sizeof(ullint)], bound);
+    res.resize(sizeof(uint) + sizeof(ullint) + compressed);
+
+    return res;
+}
+
+bool unpackDirectory(const uchar *data, size_t size, std::vector<uchar> &blob) {
+    const size_t head = sizeof(uint) + sizeof(ullint);
+    if (size < head || readInt<uint>(data) != ZPack::CompressedDirectory)
+        return false;
+
+    // size is what the end record gives the directory, nothing bigger can come out of it
+    auto encodedSize = readInt<ullint>(data + sizeof(uint));
+    if (encodedSize > directoryEncodedMax || encodedSize > encodedSizeMax(size - head))
+        return false;
+
+    std::vector<uchar> encoded((size_t) encodedSize);
+    try {
+        zpack_zstd codec;
+        if (codec.decompressBlock((const char *) data + head, size - head, (char *) encoded.data(),
+                                  encoded.size()) != encodedSize)
+            return false;
+    } catch (std::runtime_error &) {
+        return false;
+    }
+
+    const uchar *src = encoded.data();
+    size_t pos = 0;
+    ullint count = 0;
+    if (!getVarint(src, encoded.size(), pos, count))
+        return false;
+
+    blob.clear();
+    blob.reserve((size_t) std::min<ullint>(count, encodedSize) * (sizeof(DirectoryFileHeaderRecord) + 48));
+
+    std::string name;
+    llint mtime = 0;
+    ullint offsetRecord = 0;
+    for (ullint i = 0; i < count; i++) {
+        ullint shared, suffix, versionBy, versionMin, general, method, mtimeDelta, compressedSize,
+            uncompressedSize, offsetDelta, fileShift, attrsInternal, attrsExternal, extraLen, commentLen;
+
+        if (!getVarint(src, encoded.size(), pos, shared) || !getVarint(src, encoded.size(), pos, suffix) ||
+            shared > name.size() || suffix > encoded.size() - pos || shared + suffix > 0xFFFF)
+            return false;
+        name.resize((size_t) shared);
+        name.append((const char *) src + pos, (size_t) suffix);
+        pos += (size_t) suffix;
+
+        DirectoryFileHeaderRecord record{};
+        if (!getVarint(src, encoded.size(), pos, versionBy) || !getVarint(src, encoded.size(), pos, versionMin) ||
+            !getVarint(src, encoded.size(), pos, general) || !getVarint(src, encoded.size(), pos, method) ||
+            encoded.size() - pos < sizeof(record.crc32))
+            return false;
+        std::memcpy(record.crc32, src + pos, sizeof(record.crc32));
+        pos += sizeof(record.crc32);
+
+        if (!getVarint(src, encoded.size(), pos, mtimeDelta) ||
+            !getVarint(src, encoded.size(), pos, compressedSize) ||
+            !getVarint(src, encoded.size(), pos, uncompressedSize) ||
+            !getVarint(src, encoded.size(), pos, offsetDelta) || !getVarint(src, encoded.size(), pos, fileShift) ||
+            !getVarint(src, encoded.size(), pos, attrsInternal) ||
+            !getVarint(src, encoded.size(), pos, attrsExternal) || !getVarint(src, encoded.size(), pos, extraLen) ||
+            extraLen > 0xFFFF || extraLen > encoded.size() - pos)
+            return false;
+        size_t extraPos = pos;
+        pos += (size_t) extraLen;
+
+        if (!getVarint(src, encoded.size(), pos, commentLen) || commentLen > 0xFFFF ||
+            commentLen > encoded.size() - pos)
+            return false;
+        size_t commentPos = pos;
+        pos += (size_t) commentLen;
+
+        mtime += unzigzag(mtimeDelta);
+        offsetRecord += (ullint) unzigzag(offsetDelta);
+
+        assignInt<uint>(ZPack::DirectoryEntry, record.signature);
+        assignInt<usint>((usint) versionBy, record.versionBy);
+        assignInt<usint>((usint) versionMin, record.versionMin);
+        assignInt<usint>((usint) general, record.general);
+        assignInt<usint>((usint) method, record.compressMethod);
+        assignInt<llint>(mtime, record.mtime);
+        assignInt<ullint>(compressedSize, record.compressedSize);
+        assignInt<ullint>(uncompressedSize, record.uncompressedSize);
+        assignInt<ullint>(offsetRecord + (ullint) unzigzag(fileShift), record.offsetFile);
+        assignInt<ullint>(offsetRecord, record.offsetRecord);
+        assignInt<usint>((usint) name.size(), record.filenameLen);
+        assignInt<usint>((usint) extraLen, record.extraLen);
+        assignInt<usint>((usint) commentLen, record.commentLen);
+        assignInt<usint>((usint) attrsInternal, record.attrsInternal);
+        assignInt<uint>((uint) attrsExternal, record.attrsExternal);
+
+        blob.insert(blob.end(), (const uchar *) &record, (const uchar *) &record + sizeof(record));
+        blob.insert(blob.end(), name.begin(), name.end());
+        blob.insert(blob.end(), src + extraPos, src + extraPos + extraLen);
+        blob.insert(blob.end(), src + commentPos, src + commentPos + commentLen);
+    }
+
+    return pos == encoded.size();
+}
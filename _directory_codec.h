@@ -0,0 +1,20 @@
+#ifndef ZPACK_DIRECTORY_CODEC_H
+#define ZPACK_DIRECTORY_CODEC_H
+
+#include <string>
+#include <vector>
+#include "zpack.h"
+
+/*
+ * Compressed directory. Entries are stored in name order, every name front coded against the one
+ * before it, record fields as varints with record offsets and mtimes delta coded, extras and comments
+ * as they are. The encoding is compressed as one zstd frame behind a CompressedDirectory signature
+ * and the size of the encoding. Readers expand it back into the plain directory blob, so
+ * the directory decoder stays the only parser of entries.
+ */
+std::string packDirectory(std::vector<DirectoryFileQueue const *> entries);
+
+// plain directory blob of a compressed one, false when it is damaged
+bool unpackDirectory(const uchar *data, size_t size, std::vector<uchar> &blob);
+
+#endif //ZPACK_DIRECTORY_CODEC_H
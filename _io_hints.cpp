@@ -0,0 +1,52 @@
+#include "_io_hints.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+int ioHintOpen(const char *filename) {
+    #if defined(POSIX_FADV_WILLNEED)
+    return ::open(filename, O_RDONLY | O_CLOEXEC);
+    #else
+    (void) filename;
+    return -1;
+    #endif
+}
+
+void ioHintClose(int &fd) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool ioHint(int fd, unsigned long long offset, unsigned long long length, IoHint hint) {
+    #if defined(POSIX_FADV_WILLNEED)
+    if (fd < 0 || length == 0)
+        return false;
+
+    int advice = POSIX_FADV_NORMAL;
+    switch (hint) {
+        case IoHint::SEQUENTIAL:
+            advice = POSIX_FADV_SEQUENTIAL;
+            break;
+        case IoHint::RANDOM:
+            advice = POSIX_FADV_RANDOM;
+            break;
+        case IoHint::WILLNEED:
+            advice = POSIX_FADV_WILLNEED;
+            break;
+        case IoHint::DONTNEED:
+            advice = POSIX_FADV_DONTNEED;
+            break;
+        case IoHint::NORMAL:
+            break;
+    }
+
+    return posix_fadvise(fd, (off_t) offset, (off_t) length, advice) == 0;
+    #else
+    (void) fd;
+    (void) offset;
+    (void) length;
+    (void) hint;
+    return false;
+    #endif
+}
@@ -0,0 +1,18 @@
+#ifndef ZPACK_IO_HINTS_H
+#define ZPACK_IO_HINTS_H
+
+enum class IoHint {
+    NORMAL,
+    SEQUENTIAL,
+    RANDOM,
+    WILLNEED,
+    DONTNEED
+};
+
+int ioHintOpen(const char *filename);
+
+void ioHintClose(int &fd);
+
+bool ioHint(int fd, unsigned long long offset, unsigned long long length, IoHint hint);
+
+#endif //ZPACK_IO_HINTS_H
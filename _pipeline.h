@@ -0,0 +1,133 @@
+#ifndef ZPACK_PIPELINE_H
+#define ZPACK_PIPELINE_H
+
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <streambuf>
+#include "zpack_buffer_pool.h"
+#include "zpack_trace.h"
+
+/*
+ * Blocking queue between two pipeline stages. push waits while the queue is full, pop waits while it
+ * is empty. After close() push fails and pop drains what is left.
+ */
+template<typename T>
+class _BoundedQueue {
+    std::mutex lock;
+    std::condition_variable changed;
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+public:
+    explicit _BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+
+        items.push_back(std::move(item));
+        changed.notify_all();
+        return true;
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return closed || !items.empty(); });
+        if (items.empty())
+            return false;
+
+        item = std::move(items.front());
+        items.pop_front();
+        changed.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+        changed.notify_all();
+    }
+};
+
+struct _PipelineBlock {
+    zpack_buffer buffer;
+    size_t size;
+};
+
+/*
+ * Output stream target collecting codec output into a pooled buffer, so the codec stage does not
+ * touch the archive and the block can be handed over to the writer stage.
+ */
+class _BlockSink : public std::streambuf {
+    zpack_buffer_pool &pool;
+    size_t reserve;
+    _PipelineBlock block{};
+
+    void ensure(size_t size) {
+        if (block.buffer.size() >= size)
+            return;
+
+        size_t capacity = block.buffer.size() * 2;
+        if (capacity < size) capacity = size;
+        if (capacity < reserve) capacity = reserve;
+
+        zpack_buffer grown = pool.acquire(capacity);
+        if (block.size > 0) {
+            std::memcpy(grown.data(), block.buffer.data(), block.size);
+        }
+        block.buffer = std::move(grown);
+    }
+
+protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        ensure(block.size + (size_t) n);
+        std::memcpy(block.buffer.data() + block.size, s, (size_t) n);
+        block.size += (size_t) n;
+        return n;
+    }
+
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+            return traits_type::not_eof(c);
+
+        char ch = traits_type::to_char_type(c);
+        xsputn(&ch, 1);
+        return c;
+    }
+
+public:
+    _BlockSink(zpack_buffer_pool &pool, size_t reserve) : pool(pool), reserve(reserve) {}
+
+    _PipelineBlock take() {
+        _PipelineBlock res = std::move(block);
+        block = _PipelineBlock{};
+        return res;
+    }
+};
+
+/*
+ * Forwards trace events under a lock, pipeline stages report from their own threads.
+ */
+class _SerialTraceListener : public zpack_trace_listener {
+    zpack_trace_listener *target;
+    std::mutex lock;
+
+public:
+    explicit _SerialTraceListener(zpack_trace_listener *target) : target(target) {}
+
+    zpack_trace_listener *get() {
+        return target ? this : nullptr;
+    }
+
+    void onEvent(ZPackTraceEvent const &event) override {
+        std::lock_guard<std::mutex> guard(lock);
+        target->onEvent(event);
+    }
+};
+
+#endif //ZPACK_PIPELINE_H
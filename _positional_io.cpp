@@ -0,0 +1,47 @@
+#include "_positional_io.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+int pioOpen(const char *filename, bool writable) {
+    return ::open(filename, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+}
+
+void pioClose(int &fd) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool pioWriteAt(int fd, const char *data, size_t size, unsigned long long offset) {
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, data, size, (off_t) offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        data += written;
+        size -= (size_t) written;
+        offset += (unsigned long long) written;
+    }
+
+    return true;
+}
+
+long long pioReadAt(int fd, char *data, size_t size, unsigned long long offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t got = ::pread(fd, data + done, size - done, (off_t) (offset + done));
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (got == 0) break;
+
+        done += (size_t) got;
+    }
+
+    return (long long) done;
+}
@@ -0,0 +1,19 @@
+#ifndef ZPACK_POSITIONAL_IO_H
+#define ZPACK_POSITIONAL_IO_H
+
+#include <cstddef>
+
+/*
+ * Reads and writes at explicit offsets of a raw descriptor. They do not move any shared file
+ * position, so several threads may use one descriptor at once.
+ */
+int pioOpen(const char *filename, bool writable);
+
+void pioClose(int &fd);
+
+bool pioWriteAt(int fd, const char *data, size_t size, unsigned long long offset);
+
+// bytes read, less than size only at the end of file, -1 on error
+long long pioReadAt(int fd, char *data, size_t size, unsigned long long offset);
+
+#endif //ZPACK_POSITIONAL_IO_H
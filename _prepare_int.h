@@ -2,145 +2,127 @@
 #define PACKER_PREPARE_INT_H
 
 #include <type_traits>
-#include <typeinfo>
+#include <cstring>
+#include <cstdint>
 #include "_endianness.h"
 
-extern Endianness endianess;
-
-template<typename T, size_t b>
+/*
+ * Archive integers are little-endian. The host byte order is resolved at compile time, so on
+ * little-endian hosts readInt/assignInt are plain unaligned loads and stores.
+ */
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define ZPACK_HOST_BIG_ENDIAN 1
+#else
+#define ZPACK_HOST_BIG_ENDIAN 0
+#endif
+
+template<size_t b>
 struct _EndiannessSwap;
 
-template<typename T>
-struct _EndiannessSwap<T, 2> {
-    T operator()(T &num) {
-        std::cout << "NORM spec for type " << typeid(T).hash_code() << std::endl;
-        T value = 0;
-
-        value |= (num & 0xFF00) >> 8;
-        value |= (num & 0x00FF) << 8;
-
+template<>
+struct _EndiannessSwap<1> {
+    static uint8_t swap(uint8_t value) {
         return value;
     }
 };
 
-template<typename T>
-struct _EndiannessSwap<T, 4> {
-    T operator()(T &num) {
-        T value = 0;
-
-        value |= (num & 0xFF000000) >> 24;
-        value |= (num & 0x00FF0000) >> 8;
-        value |= (num & 0x0000FF00) << 8;
-        value |= (num & 0x000000FF) << 24;
-
-        return value;
+template<>
+struct _EndiannessSwap<2> {
+    static uint16_t swap(uint16_t value) {
+        #if defined(__GNUC__)
+        return __builtin_bswap16(value);
+        #else
+        return (uint16_t) ((value >> 8) | (value << 8));
+        #endif
     }
 };
 
-template<typename T>
-struct _EndiannessSwap<T, 8> {
-    T operator()(T &num) {
-        T value = 0;
-
-        value |= (num & 0xFF00000000000000) >> 56;
-        value |= (num & 0x00FF000000000000) >> 40;
-        value |= (num & 0x0000FF0000000000) >> 24;
-        value |= (num & 0x000000FF00000000) >> 8;
-        value |= (num & 0x00000000FF000000) << 8;
-        value |= (num & 0x0000000000FF0000) << 24;
-        value |= (num & 0x000000000000FF00) << 40;
-        value |= (num & 0x00000000000000FF) << 56;
-
-        return value;
+template<>
+struct _EndiannessSwap<4> {
+    static uint32_t swap(uint32_t value) {
+        #if defined(__GNUC__)
+        return __builtin_bswap32(value);
+        #else
+        return ((value & 0xFF000000) >> 24) | ((value & 0x00FF0000) >> 8) |
+               ((value & 0x0000FF00) << 8) | ((value & 0x000000FF) << 24);
+        #endif
     }
 };
 
-template<typename T>
-T prepareInt(T num) {
-    if (endianess == Endianness::BIG && std::is_arithmetic<T>::value) {
-        return _EndiannessSwap<T, sizeof(T)>()(num);
-    } else {
-        return num;
+template<>
+struct _EndiannessSwap<8> {
+    static uint64_t swap(uint64_t value) {
+        #if defined(__GNUC__)
+        return __builtin_bswap64(value);
+        #else
+        return ((uint64_t) _EndiannessSwap<4>::swap((uint32_t) value) << 32) |
+               _EndiannessSwap<4>::swap((uint32_t) (value >> 32));
+        #endif
     }
-}
-
-template<typename T, size_t b>
-struct _IntCharExchange;
+};
 
-template<typename T>
-struct _IntCharExchange<T, 2> {
-    void operator()(T &num, unsigned char *chr) {
-        T e_num = prepareInt(num);
+template<size_t b>
+struct _UintOfSize;
 
-        chr[0] = (e_num & 0x00FF);
-        chr[1] = ((e_num >> 8) & 0x00FF);
-    }
+template<>
+struct _UintOfSize<1> {
+    typedef uint8_t type;
 };
 
-template<typename T>
-struct _IntCharExchange<T, 4> {
-    void operator()(T &num, unsigned char *chr) {
-        T e_num = prepareInt(num);
-
-        chr[0] = (e_num & 0x000000FF);
-        chr[1] = ((e_num >> 8) & 0x000000FF);
-        chr[2] = ((e_num >> 16) & 0x000000FF);
-        chr[3] = ((e_num >> 24) & 0x000000FF);
-    }
+template<>
+struct _UintOfSize<2> {
+    typedef uint16_t type;
 };
 
-template<typename T>
-struct _IntCharExchange<T, 8> {
-    void operator()(T &num, unsigned char *chr) {
-        T e_num = prepareInt(num);
-
-        chr[0] = (e_num & 0x00000000000000FF);
-        chr[1] = ((e_num >> 8) & 0x00000000000000FF);
-        chr[2] = ((e_num >> 16) & 0x00000000000000FF);
-        chr[3] = ((e_num >> 24) & 0x00000000000000FF);
-        chr[4] = ((e_num >> 32) & 0x00000000000000FF);
-        chr[5] = ((e_num >> 40) & 0x00000000000000FF);
-        chr[6] = ((e_num >> 48) & 0x00000000000000FF);
-        chr[7] = ((e_num >> 56) & 0x00000000000000FF);
-    }
+template<>
+struct _UintOfSize<4> {
+    typedef uint32_t type;
 };
 
-template<typename T>
-void assignInt(T num, unsigned char *chr) {
-    _IntCharExchange<T, sizeof(T)>()(num, chr);
-}
-
-template<typename T, size_t b>
-struct _CharIntExchange;
+template<>
+struct _UintOfSize<8> {
+    typedef uint64_t type;
+};
 
-template<typename T>
-struct _CharIntExchange<T, 2> {
-    T operator()(const unsigned char *chr) {
-        T e_num = (T) chr[0] + ((T) chr[1] << 8);
-        return prepareInt(e_num);
+template<bool swap>
+struct _ByteOrder {
+    template<typename U>
+    static U apply(U value) {
+        return value;
     }
 };
 
-template<typename T>
-struct _CharIntExchange<T, 4> {
-    T operator()(const unsigned char *chr) {
-        T e_num = (T) chr[0] + ((T) chr[1] << 8) + ((T) chr[2] << 16) + ((T) chr[3] << 24);
-        return prepareInt(e_num);
+template<>
+struct _ByteOrder<true> {
+    template<typename U>
+    static U apply(U value) {
+        return _EndiannessSwap<sizeof(U)>::swap(value);
     }
 };
 
 template<typename T>
-struct _CharIntExchange<T, 8> {
-    T operator()(const unsigned char *chr) {
-        T e_num = (T) chr[0] + ((T) chr[1] << 8) + ((T) chr[2] << 16) + ((T) chr[3] << 24) +
-            ((T) chr[4] << 32) + ((T) chr[5] << 40) + ((T) chr[6] << 48) + ((T) chr[7] << 56);
-        return prepareInt(e_num);
-    }
-};
+inline void assignInt(T num, unsigned char *chr) {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "assignInt expects an integer");
+    typedef typename _UintOfSize<sizeof(T)>::type U;
+
+    U value;
+    std::memcpy(&value, &num, sizeof(T));
+    value = _ByteOrder<ZPACK_HOST_BIG_ENDIAN>::apply(value);
+    std::memcpy(chr, &value, sizeof(T));
+}
 
 template<typename T>
 inline T readInt(const unsigned char *chr) {
-    return _CharIntExchange<T, sizeof(T)>()(chr);
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "readInt expects an integer");
+    typedef typename _UintOfSize<sizeof(T)>::type U;
+
+    U value;
+    std::memcpy(&value, chr, sizeof(T));
+    value = _ByteOrder<ZPACK_HOST_BIG_ENDIAN>::apply(value);
+
+    T num;
+    std::memcpy(&num, &value, sizeof(T));
+    return num;
 }
 
 #endif //PACKER_PREPARE_INT_H
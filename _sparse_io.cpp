@@ -0,0 +1,227 @@
+#include "_sparse_io.h"
+#include "_positional_io.h"
+#include "_varint.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+std::vector<_SparseHole> sparseHoles(const char *filename, unsigned long long size) {
+    std::vector<_SparseHole> holes;
+    #if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    int fd = pioOpen(filename, false);
+    if (fd < 0)
+        return holes;
+
+    auto position = (off_t) 0;
+    while ((unsigned long long) position < size) {
+        off_t data = ::lseek(fd, position, SEEK_DATA);
+        if (data < 0) {
+            // no data past the position, the rest of the file is a hole
+            if (errno == ENXIO) {
+                holes.push_back(_SparseHole{(unsigned long long) position, size - (unsigned long long) position});
+            }
+            break;
+        }
+        if ((unsigned long long) data >= size) {
+            holes.push_back(_SparseHole{(unsigned long long) position, size - (unsigned long long) position});
+            break;
+        }
+        if (data > position) {
+            holes.push_back(_SparseHole{(unsigned long long) position, (unsigned long long) (data - position)});
+        }
+
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) break;
+        position = hole;
+    }
+
+    pioClose(fd);
+    #else
+    (void) filename;
+    (void) size;
+    #endif
+    return holes;
+}
+
+static std::string encodeHoles(std::vector<_SparseHole> const &holes) {
+    std::string res;
+    unsigned long long end = 0;
+    for (auto const &hole : holes) {
+        putVarint(res, hole.offset - end);
+        putVarint(res, hole.length);
+        end = hole.offset + hole.length;
+    }
+    return res;
+}
+
+std::string encodeSparseHoles(std::vector<_SparseHole> holes, size_t maxBytes) {
+    std::string res = encodeHoles(holes);
+    while (res.size() > maxBytes && !holes.empty()) {
+        std::stable_sort(holes.begin(), holes.end(), [](_SparseHole const &a, _SparseHole const &b) {
+            return a.length > b.length;
+        });
+        holes.resize(holes.size() / 2);
+        std::sort(holes.begin(), holes.end(), [](_SparseHole const &a, _SparseHole const &b) {
+            return a.offset < b.offset;
+        });
+        res = encodeHoles(holes);
+    }
+
+    return res;
+}
+
+std::vector<_SparseHole> decodeSparseHoles(std::string const &encoded) {
+    std::vector<_SparseHole> holes;
+    size_t pos = 0;
+    unsigned long long end = 0;
+    unsigned long long gap, length;
+    // a padding byte after the last pair never completes one
+    auto data = (const unsigned char *) encoded.data();
+    while (getVarint(data, encoded.size(), pos, gap) && getVarint(data, encoded.size(), pos, length)) {
+        if (length == 0) continue;
+        holes.push_back(_SparseHole{end + gap, length});
+        end += gap + length;
+    }
+
+    return holes;
+}
+
+_SparseReadBuf::_SparseReadBuf(size_t bufferSize, std::vector<_SparseHole> holes, unsigned long long size)
+    : holes(std::move(holes)), size(size), buffer(bufferSize > 0 ? bufferSize : directAlignment) {}
+
+_SparseReadBuf::~_SparseReadBuf() {
+    pioClose(fd);
+}
+
+bool _SparseReadBuf::open(const char *filename, bool useDirect) {
+    direct = false;
+    if (useDirect) {
+        fd = directOpen(filename, false);
+        direct = fd >= 0;
+    }
+    if (fd < 0) {
+        fd = pioOpen(filename, false);
+    }
+
+    return fd >= 0;
+}
+
+_SparseReadBuf::int_type _SparseReadBuf::underflow() {
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+
+    if (fd < 0 || position >= size)
+        return traits_type::eof();
+
+    while (nextHole < holes.size() && holes[nextHole].offset + holes[nextHole].length <= position) {
+        nextHole++;
+    }
+
+    unsigned long long limit = size;
+    bool inHole = false;
+    if (nextHole < holes.size()) {
+        inHole = holes[nextHole].offset <= position;
+        limit = inHole ? holes[nextHole].offset + holes[nextHole].length : holes[nextHole].offset;
+    }
+    if (limit > size) limit = size;
+
+    auto chunk = (size_t) std::min<unsigned long long>(buffer.size(), limit - position);
+    if (inHole) {
+        std::memset(buffer.data(), 0, chunk);
+    } else {
+        long long got = direct ? directReadAt(fd, buffer.data(), chunk, position, bounce)
+                               : pioReadAt(fd, buffer.data(), chunk, position);
+        if (got <= 0)
+            return traits_type::eof();
+        chunk = (size_t) got;
+    }
+
+    position += chunk;
+    setg(buffer.data(), buffer.data(), buffer.data() + chunk);
+    return traits_type::to_int_type(*gptr());
+}
+
+_SparseWriteBuf::_SparseWriteBuf(size_t bufferSize, std::vector<_SparseHole> holes)
+    : holes(std::move(holes)), buffer(bufferSize > 0 ? bufferSize : directAlignment) {}
+
+_SparseWriteBuf::~_SparseWriteBuf() {
+    close();
+}
+
+bool _SparseWriteBuf::open(const char *filename) {
+    fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    return fd >= 0;
+}
+
+void _SparseWriteBuf::writePending() {
+    if (used == 0)
+        return;
+
+    if (!failed && !pioWriteAt(fd, buffer.data(), used, position - used)) {
+        failed = true;
+    }
+    used = 0;
+}
+
+// zero when the first byte is and every byte equals the one before it
+static bool allZero(const char *s, size_t n) {
+    return n == 0 || (s[0] == 0 && std::memcmp(s, s + 1, n - 1) == 0);
+}
+
+std::streamsize _SparseWriteBuf::xsputn(const char *s, std::streamsize n) {
+    auto left = (unsigned long long) n;
+    while (left > 0) {
+        while (nextHole < holes.size() && holes[nextHole].offset + holes[nextHole].length <= position) {
+            nextHole++;
+        }
+
+        if (nextHole < holes.size() && holes[nextHole].offset <= position) {
+            // the pending data ends where the hole starts, it has to go out before the position jumps
+            writePending();
+            unsigned long long skip = std::min(left, holes[nextHole].offset + holes[nextHole].length - position);
+            // a stale map must not cost data, whatever is not zero is written where the hole was expected
+            if (!failed && !allZero(s, (size_t) skip) && !pioWriteAt(fd, s, (size_t) skip, position)) {
+                failed = true;
+            }
+            position += skip;
+            s += skip;
+            left -= skip;
+            continue;
+        }
+
+        unsigned long long limit = nextHole < holes.size() ? holes[nextHole].offset - position : left;
+        auto chunk = (size_t) std::min<unsigned long long>({left, limit, buffer.size() - used});
+        std::memcpy(buffer.data() + used, s, chunk);
+        used += chunk;
+        position += chunk;
+        s += chunk;
+        left -= chunk;
+
+        if (used == buffer.size()) writePending();
+    }
+
+    return failed ? 0 : n;
+}
+
+_SparseWriteBuf::int_type _SparseWriteBuf::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+
+    char ch = traits_type::to_char_type(c);
+    return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
+
+bool _SparseWriteBuf::close() {
+    if (fd < 0)
+        return !failed;
+
+    writePending();
+    if (!failed && ::ftruncate(fd, (off_t) position) != 0) {
+        failed = true;
+    }
+
+    pioClose(fd);
+    return !failed;
+}
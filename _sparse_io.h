@@ -0,0 +1,88 @@
+#ifndef ZPACK_SPARSE_IO_H
+#define ZPACK_SPARSE_IO_H
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include "_direct_io.h"
+
+/*
+ * Sparse files. Holes are found with SEEK_DATA/SEEK_HOLE, packing reads only the data extents and
+ * feeds zeros for the holes, extraction skips the holes instead of writing zeros and sets the final
+ * size with ftruncate, so the extracted file keeps them unallocated. The packed payload is the full
+ * content, readers without the hole map get the same bytes.
+ */
+struct _SparseHole {
+    unsigned long long offset;
+    unsigned long long length;
+};
+
+// holes in offset order, empty when there are none or the filesystem can not tell
+std::vector<_SparseHole> sparseHoles(const char *filename, unsigned long long size);
+
+/*
+ * Varint pairs of the gap since the previous hole and the hole length. When the encoding does not fit
+ * maxBytes only the largest holes are kept, the rest is packed and extracted as ordinary zeros.
+ */
+std::string encodeSparseHoles(std::vector<_SparseHole> holes, size_t maxBytes);
+
+std::vector<_SparseHole> decodeSparseHoles(std::string const &encoded);
+
+/*
+ * Source of a sparse file, data extents are read at their offsets and holes come out as zeros.
+ */
+class _SparseReadBuf : public std::streambuf {
+    int fd = -1;
+    bool direct = false;
+    std::vector<_SparseHole> holes;
+    unsigned long long size;
+    unsigned long long position = 0;
+    size_t nextHole = 0;
+    std::vector<char> buffer;
+    _AlignedBuffer bounce;
+
+protected:
+    int_type underflow() override;
+
+public:
+    _SparseReadBuf(size_t bufferSize, std::vector<_SparseHole> holes, unsigned long long size);
+
+    ~_SparseReadBuf() override;
+
+    // direct reads the data extents with O_DIRECT when the file allows it
+    bool open(const char *filename, bool direct);
+};
+
+/*
+ * Extraction target leaving holes unwritten, zeros falling into a hole are dropped. Anything else
+ * there is written, the map is only a hint.
+ */
+class _SparseWriteBuf : public std::streambuf {
+    int fd = -1;
+    std::vector<_SparseHole> holes;
+    unsigned long long position = 0;
+    size_t nextHole = 0;
+    std::vector<char> buffer;
+    size_t used = 0;
+    bool failed = false;
+
+    void writePending();
+
+protected:
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+    int_type overflow(int_type c) override;
+
+public:
+    _SparseWriteBuf(size_t bufferSize, std::vector<_SparseHole> holes);
+
+    ~_SparseWriteBuf() override;
+
+    bool open(const char *filename);
+
+    // extends the file over trailing holes
+    bool close();
+};
+
+#endif //ZPACK_SPARSE_IO_H
@@ -0,0 +1,40 @@
+#ifndef ZPACK_VARINT_H
+#define ZPACK_VARINT_H
+
+#include <string>
+
+/*
+ * LEB128 unsigned varints for the compact encodings of extras and the directory, 7 bits per byte,
+ * the high bit marks a following byte.
+ */
+inline void putVarint(std::string &dest, unsigned long long value) {
+    while (value >= 0x80) {
+        dest.push_back((char) (value | 0x80));
+        value >>= 7;
+    }
+    dest.push_back((char) value);
+}
+
+// false when the input ends inside the varint
+inline bool getVarint(const unsigned char *src, size_t size, size_t &pos, unsigned long long &value) {
+    value = 0;
+    for (unsigned shift = 0; pos < size && shift < 64; shift += 7) {
+        unsigned char byte = src[pos++];
+        value |= (unsigned long long) (byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+// signed deltas, small magnitudes of either sign stay short
+inline unsigned long long zigzag(long long value) {
+    return ((unsigned long long) value << 1) ^ (unsigned long long) (value >> 63);
+}
+
+inline long long unzigzag(unsigned long long value) {
+    return (long long) (value >> 1) ^ -(long long) (value & 1);
+}
+
+#endif //ZPACK_VARINT_H
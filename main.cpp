@@ -1,12 +1,706 @@
 #include <cstdint>
+#include <cstdio>
 #include <chrono>
 #include <sstream>
-#include <bitset>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <fnmatch.h>
 #include "zpack.h"
 
+namespace {
+    typedef std::chrono::steady_clock cli_clock;
+
+    struct CliOptions {
+        std::string command;
+        std::string archive;
+        std::vector<std::string> args;
+        uint jobs = 1;
+        short int level = 0;
+        bool levelSet = false;
+        std::vector<std::string> includes;
+        std::vector<std::string> excludes;
+        std::string directory;
+        std::string format = "text";
+        ullint memory = 0;
+    };
+
+    struct AddJob {
+        std::string filename;
+        std::string directory;
+        std::string itemname;
+        ullint size;
+    };
+
+    struct Field {
+        std::string key;
+        std::string value;
+        bool number;
+    };
+
+    template<typename T>
+    Field numberField(std::string const &key, T value) {
+        std::ostringstream conv;
+        conv << value;
+        return Field{key, conv.str(), true};
+    }
+
+    Field textField(std::string const &key, std::string const &value) {
+        return Field{key, value, false};
+    }
+
+    std::mutex outputLock;
+
+    void usage(const char *self) {
+        std::cerr << "Usage: " << self << " COMMAND [options] ARCHIVE [args]" << std::endl
+                  << "Commands:" << std::endl
+                  << "  create ARCHIVE PATH...  new archive from files and directories" << std::endl
+                  << "  add ARCHIVE PATH...     add files and directories, unchanged files are skipped" << std::endl
+                  << "  extract ARCHIVE [DEST]  extract items into DEST (default current directory)" << std::endl
+                  << "  list ARCHIVE            list items" << std::endl
+                  << "  rm ARCHIVE NAME...      remove items, names may be globs" << std::endl
+                  << "  repack ARCHIVE          drop removed items from the file" << std::endl
+                  << "  verify ARCHIVE          decompress items and check their checksums" << std::endl
+                  << "  stat ARCHIVE            item and size totals" << std::endl
+                  << "  bench PATH...           pack, verify and extract throughput of PATH in a scratch archive"
+                  << std::endl
+                  << "  version                 library version" << std::endl
+                  << "Options:" << std::endl
+                  << "  -j N                    worker threads for add, extract, verify and bench (default 1)"
+                  << std::endl
+                  << "  -l LEVEL                compression level of packed items" << std::endl
+                  << "  --include GLOB          only items matching GLOB, may be repeated" << std::endl
+                  << "  --exclude GLOB          skip items matching GLOB, may be repeated" << std::endl
+                  << "  --dir DIR               archive directory for added files" << std::endl
+                  << "  --memory MB             memory budget, split between the -j workers" << std::endl
+                  << "  --format text|json|csv  output format, json is one object per line" << std::endl;
+    }
+
+    std::string jsonEscape(std::string const &value) {
+        std::string res;
+        for (char c : value) {
+            switch (c) {
+                case '"':
+                    res += "\\\"";
+                    break;
+                case '\\':
+                    res += "\\\\";
+                    break;
+                case '\n':
+                    res += "\\n";
+                    break;
+                case '\t':
+                    res += "\\t";
+                    break;
+                default:
+                    if ((unsigned char) c < 0x20) {
+                        char code[8];
+                        snprintf(code, sizeof(code), "\\u%04x", (unsigned char) c);
+                        res += code;
+                    } else {
+                        res += c;
+                    }
+            }
+        }
+        return res;
+    }
+
+    std::string csvEscape(std::string const &value) {
+        if (value.find_first_of(",\"\n") == std::string::npos) return value;
+
+        std::string res = "\"";
+        for (char c : value) {
+            res += c;
+            if (c == '"') res += '"';
+        }
+        return res + "\"";
+    }
+
+    /*
+     * One output record. Text lists print tabular rows, text summaries one "key: value" line per
+     * field, csv prints the header before the first record.
+     */
+    void emit(CliOptions const &opts, std::vector<Field> const &fields, bool &header, bool row) {
+        std::lock_guard<std::mutex> guard(outputLock);
+        std::ostream &out = std::cout;
+
+        if (opts.format == "json") {
+            out << "{";
+            for (size_t i = 0; i < fields.size(); i++) {
+                out << (i ? "," : "") << "\"" << fields[i].key << "\":";
+                if (fields[i].number) {
+                    out << fields[i].value;
+                } else {
+                    out << "\"" << jsonEscape(fields[i].value) << "\"";
+                }
+            }
+            out << "}" << std::endl;
+        } else if (opts.format == "csv") {
+            if (!header) {
+                for (size_t i = 0; i < fields.size(); i++) {
+                    out << (i ? "," : "") << fields[i].key;
+                }
+                out << std::endl;
+                header = true;
+            }
+            for (size_t i = 0; i < fields.size(); i++) {
+                out << (i ? "," : "") << csvEscape(fields[i].value);
+            }
+            out << std::endl;
+        } else if (row) {
+            for (size_t i = 0; i < fields.size(); i++) {
+                std::string value = fields[i].value;
+                if (fields[i].number && value.size() < 12) value.insert(0, 12 - value.size(), ' ');
+                out << (i ? "  " : "") << value;
+            }
+            out << std::endl;
+        } else {
+            for (auto const &field : fields) {
+                out << field.key << ": " << field.value << std::endl;
+            }
+        }
+    }
+
+    void report(std::string const &what, std::string const &name, ZPack::Errors code) {
+        std::lock_guard<std::mutex> guard(outputLock);
+        std::cerr << what << ": " << name << " (error " << (int) code << ")" << std::endl;
+    }
+
+    void reportText(std::string const &what, std::string const &name, std::string const &detail) {
+        std::lock_guard<std::mutex> guard(outputLock);
+        std::cerr << what << ": " << name << " (" << detail << ")" << std::endl;
+    }
+
+    std::string joinName(std::string const &directory, std::string const &name) {
+        if (directory.empty()) return name;
+        if (name.empty()) return directory;
+        return directory + (directory.back() == '/' ? "" : "/") + name;
+    }
+
+    // fnmatch without FNM_PATHNAME, like ZPack::globNames '*' also matches '/'
+    bool selected(CliOptions const &opts, std::string const &name) {
+        if (!opts.includes.empty()) {
+            bool included = false;
+            for (auto const &pattern : opts.includes) {
+                if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0) {
+                    included = true;
+                    break;
+                }
+            }
+            if (!included) return false;
+        }
+
+        for (auto const &pattern : opts.excludes) {
+            if (fnmatch(pattern.c_str(), name.c_str(), 0) == 0) return false;
+        }
+
+        return true;
+    }
+
+    double secondsSince(cli_clock::time_point start) {
+        return std::chrono::duration<double>(cli_clock::now() - start).count();
+    }
+
+    double mbps(ullint bytes, double seconds) {
+        return seconds > 0 ? (double) bytes / seconds / (1024.0 * 1024.0) : 0;
+    }
+
+    // fn(worker) on jobs threads, with a single job the calling thread does the work
+    template<typename F>
+    void runWorkers(uint jobs, F fn) {
+        if (jobs <= 1) {
+            fn(0u);
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        workers.reserve(jobs);
+        for (uint w = 0; w < jobs; w++) {
+            workers.emplace_back([&fn, w] { fn(w); });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    /*
+     * Files to pack, directories are walked recursively and keep their own name as the top archive
+     * directory.
+     */
+    std::vector<AddJob> collectFiles(CliOptions const &opts, std::vector<std::string> const &paths, size_t &missing) {
+        std::vector<AddJob> jobs;
+        for (auto const &path : paths) {
+            fs::path root(path);
+            boost::system::error_code ec;
+            if (fs::is_directory(root, ec)) {
+                std::string base = root.filename().string();
+                if (base == "." || base == "/") base = root.parent_path().filename().string();
+                if (base == "." || base == "/") base.clear();
+
+                for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+                    if (!fs::is_regular_file(it->status())) continue;
+
+                    fs::path rel = it->path().lexically_relative(root);
+                    std::string directory = joinName(opts.directory,
+                                                     joinName(base, rel.parent_path().generic_string()));
+                    std::string itemname = joinName(directory, rel.filename().string());
+                    if (!selected(opts, itemname)) continue;
+
+                    jobs.push_back(AddJob{it->path().string(), directory, itemname, (ullint) fs::file_size(it->path())});
+                }
+            } else if (fs::is_regular_file(root, ec)) {
+                std::string itemname = joinName(opts.directory, root.filename().string());
+                if (!selected(opts, itemname)) continue;
+
+                jobs.push_back(AddJob{path, opts.directory, itemname, (ullint) fs::file_size(root)});
+            } else {
+                std::cerr << "no such file: " << path << std::endl;
+                missing++;
+            }
+        }
+
+        return jobs;
+    }
+
+    bool openArchive(CliOptions const &opts, ZPack &pack, bool trunicate, bool mustExist = true) {
+        if (mustExist && !fs::exists(opts.archive)) {
+            std::cerr << "no such archive: " << opts.archive << std::endl;
+            return false;
+        }
+
+        if (opts.levelSet) pack.setCompressionLevel(opts.level);
+        if (opts.memory > 0) pack.setMemoryBudget(opts.memory);
+        pack.open(opts.archive.c_str(), trunicate);
+        if (pack.error_code != ZPack::Errors::OK) {
+            std::cerr << "can not open archive: " << opts.archive << " (error " << (int) pack.error_code << ")"
+                      << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    std::vector<std::string> selectedNames(CliOptions const &opts, ZPack &pack) {
+        std::vector<std::string> names;
+        for (auto const &name : pack.listNames()) {
+            if (selected(opts, name)) names.push_back(name);
+        }
+        return names;
+    }
+
+    // packs with concurrent writers when there is more than one job, returns the number of failures
+    size_t packJobs(CliOptions const &opts, ZPack &pack, std::vector<AddJob> const &jobs, ullint &bytes) {
+        if (opts.jobs > 1) {
+            pack.setConcurrentWriters(true);
+            // every writer holds its own codec context and buffers
+            if (opts.memory > 0) pack.setMemoryBudget(opts.memory / opts.jobs);
+        }
+
+        std::atomic<size_t> next(0);
+        std::atomic<size_t> failed(0);
+        std::atomic<ullint> packed(0);
+        runWorkers(opts.jobs, [&](uint) {
+            for (size_t i = next++; i < jobs.size(); i = next++) {
+                try {
+                    if (pack.packFile(jobs[i].filename, jobs[i].directory)) {
+                        packed += jobs[i].size;
+                        continue;
+                    }
+                    failed++;
+                    // error_code is shared by the concurrent writers and may belong to another call
+                    if (opts.jobs > 1) reportText("can not pack", jobs[i].filename, "failed");
+                    else report("can not pack", jobs[i].filename, pack.error_code);
+                } catch (std::exception &e) {
+                    failed++;
+                    reportText("can not pack", jobs[i].filename, e.what());
+                }
+            }
+        });
+
+        if (opts.jobs > 1) {
+            pack.setConcurrentWriters(false);
+            if (opts.memory > 0) pack.setMemoryBudget(opts.memory);
+        }
+        pack.write();
+        bytes = packed;
+        return failed;
+    }
+
+    /*
+     * Runs fn on every name with opts.jobs readers, each of them opens the archive on its own since
+     * a ZPack reads through a single stream. Returns the number of names fn failed on.
+     */
+    template<typename F>
+    size_t eachItem(CliOptions const &opts, ZPack &pack, std::vector<std::string> const &names, F fn) {
+        std::atomic<size_t> next(0);
+        std::atomic<size_t> failed(0);
+        runWorkers(opts.jobs, [&](uint) {
+            ZPack own;
+            ZPack *reader = &pack;
+            if (opts.jobs > 1) {
+                if (opts.memory > 0) own.setMemoryBudget(opts.memory / opts.jobs);
+                own.open(opts.archive.c_str());
+                reader = &own;
+            }
+
+            for (size_t i = next++; i < names.size(); i = next++) {
+                try {
+                    if (!fn(*reader, names[i])) failed++;
+                } catch (std::exception &e) {
+                    failed++;
+                    reportText("can not process", names[i], e.what());
+                }
+            }
+            own.close();
+        });
+
+        return failed;
+    }
+
+    ullint itemsSize(ZPack &pack, std::vector<std::string> const &names) {
+        std::unordered_set<std::string> wanted(names.begin(), names.end());
+        ullint total = 0;
+        pack.forEachEntry("", [&](ZPackEntry const &entry) {
+            if (wanted.count(entry.name) != 0) total += entry.uncompressedSize;
+            return true;
+        });
+        return total;
+    }
+
+    int cmdAdd(CliOptions const &opts, bool create) {
+        if (opts.args.empty()) {
+            usage("ZPack");
+            return 1;
+        }
+
+        ZPack pack;
+        if (!openArchive(opts, pack, create, false)) return 1;
+
+        size_t missing = 0;
+        auto jobs = collectFiles(opts, opts.args, missing);
+        auto start = cli_clock::now();
+        ullint bytes = 0;
+        size_t failed = packJobs(opts, pack, jobs, bytes);
+        double seconds = secondsSince(start);
+        pack.close();
+
+        bool header = false;
+        emit(opts, {textField("command", opts.command), numberField("files", jobs.size() - failed),
+                    numberField("failed", failed + missing), numberField("bytes", bytes),
+                    numberField("seconds", seconds), numberField("mbps", mbps(bytes, seconds)),
+                    numberField("archive_size", fs::file_size(opts.archive))}, header, false);
+
+        return failed + missing > 0 ? 2 : 0;
+    }
+
+    int cmdExtract(CliOptions const &opts) {
+        ZPack pack;
+        if (!openArchive(opts, pack, false)) return 1;
+
+        std::string dest = opts.args.empty() ? "." : opts.args[0];
+        // extractFile takes the destination as a path prefix, the item name replaces its filename
+        if (dest.back() != '/') dest += "/";
+
+        auto names = selectedNames(opts, pack);
+        ullint bytes = itemsSize(pack, names);
+        auto start = cli_clock::now();
+        size_t failed = eachItem(opts, pack, names, [&dest](ZPack &reader, std::string const &name) {
+            if (reader.extractFile(name, dest) && reader.error_code == ZPack::Errors::OK) return true;
+
+            report("can not extract", name, reader.error_code);
+            reader.clear();
+            return false;
+        });
+        double seconds = secondsSince(start);
+        pack.close();
+
+        bool header = false;
+        emit(opts, {textField("command", opts.command), numberField("items", names.size() - failed),
+                    numberField("failed", failed), numberField("bytes", bytes), numberField("seconds", seconds),
+                    numberField("mbps", mbps(bytes, seconds))}, header, false);
+
+        return failed > 0 ? 2 : 0;
+    }
+
+    int cmdList(CliOptions const &opts) {
+        ZPack pack;
+        if (!openArchive(opts, pack, false)) return 1;
+
+        bool header = false;
+        pack.forEachEntry("", [&](ZPackEntry const &entry) {
+            if (selected(opts, entry.name)) {
+                emit(opts, {numberField("size", entry.uncompressedSize),
+                            numberField("compressed", entry.compressedSize), numberField("mtime", entry.mtime),
+                            numberField("crc32", entry.crc32), textField("name", entry.name)}, header, true);
+            }
+            return true;
+        });
+        pack.close();
+
+        return 0;
+    }
+
+    int cmdRemove(CliOptions const &opts) {
+        if (opts.args.empty()) {
+            usage("ZPack");
+            return 1;
+        }
+
+        ZPack pack;
+        if (!openArchive(opts, pack, false)) return 1;
+
+        size_t removed = 0;
+        for (auto const &pattern : opts.args) {
+            std::vector<std::string> names;
+            if (pattern.find_first_of("*?[") != std::string::npos) {
+                names = pack.globNames(pattern);
+            } else {
+                names.push_back(pattern);
+            }
+
+            for (auto const &name : names) {
+                if (selected(opts, name) && pack.remove(name)) removed++;
+            }
+        }
+        pack.write();
+        pack.close();
+
+        bool header = false;
+        emit(opts, {textField("command", opts.command), numberField("removed", removed)}, header, false);
+
+        return 0;
+    }
+
+    int cmdRepack(CliOptions const &opts) {
+        ZPack pack;
+        if (!openArchive(opts, pack, false)) return 1;
+
+        auto sizeBefore = (ullint) fs::file_size(opts.archive);
+        auto start = cli_clock::now();
+        pack.repack();
+        double seconds = secondsSince(start);
+        ZPack::Errors code = pack.error_code;
+        pack.close();
+
+        bool header = false;
+        emit(opts, {textField("command", opts.command), numberField("size_before", sizeBefore),
+                    numberField("size_after", fs::file_size(opts.archive)), numberField("seconds", seconds)},
+             header, false);
+
+        return code == ZPack::Errors::OK ? 0 : 2;
+    }
+
+    int cmdVerify(CliOptions const &opts) {
+        ZPack pack;
+        if (!openArchive(opts, pack, false)) return 1;
+
+        auto names = selectedNames(opts, pack);
+        ullint bytes = itemsSize(pack, names);
+        bool header = false;
+        auto start = cli_clock::now();
+        size_t failed = eachItem(opts, pack, names, [&](ZPack &reader, std::string const &name) {
+            if (reader.verify(name)) return true;
+
+            reader.clear();
+            if (opts.format == "text") {
+                std::lock_guard<std::mutex> guard(outputLock);
+                std::cerr << "checksum mismatch: " << name << std::endl;
+            } else {
+                emit(opts, {textField("name", name), textField("status", "failed")}, header, true);
+            }
+            return false;
+        });
+        double seconds = secondsSince(start);
+        pack.close();
+
+        if (opts.format != "csv") {
+            emit(opts, {textField("command", opts.command), numberField("items", names.size()),
+                        numberField("failed", failed), numberField("bytes", bytes), numberField("seconds", seconds),
+                        numberField("mbps", mbps(bytes, seconds))}, header, false);
+        }
+
+        return failed > 0 ? 2 : 0;
+    }
+
+    int cmdStat(CliOptions const &opts) {
+        ZPack pack;
+        if (!openArchive(opts, pack, false)) return 1;
+
+        ullint items = 0;
+        ullint uncompressed = 0;
+        ullint compressed = 0;
+        if (opts.includes.empty() && opts.excludes.empty()) {
+            ZPackSubtreeStats stats = pack.subtreeStats("");
+            items = stats.items;
+            uncompressed = stats.uncompressedSize;
+            compressed = stats.compressedSize;
+        } else {
+            pack.forEachEntry("", [&](ZPackEntry const &entry) {
+                if (selected(opts, entry.name)) {
+                    items++;
+                    uncompressed += entry.uncompressedSize;
+                    compressed += entry.compressedSize;
+                }
+                return true;
+            });
+        }
+        pack.close();
+
+        bool header = false;
+        emit(opts, {numberField("items", items), numberField("uncompressed", uncompressed),
+                    numberField("compressed", compressed),
+                    numberField("ratio", compressed > 0 ? (double) uncompressed / (double) compressed : 0),
+                    numberField("archive_size", fs::file_size(opts.archive))}, header, false);
+
+        return 0;
+    }
+
+    /*
+     * Throughput of the library on the given files: pack with -j writers, then verify and extract
+     * with -j readers, in a scratch directory removed afterwards.
+     */
+    int cmdBench(CliOptions opts) {
+        if (opts.args.empty()) {
+            usage("ZPack");
+            return 1;
+        }
+
+        fs::path workdir = fs::temp_directory_path() / fs::unique_path("zpack-cli-bench-%%%%%%");
+        fs::create_directories(workdir);
+        opts.archive = (workdir / "bench.zpk").string();
+
+        size_t missing = 0;
+        auto jobs = collectFiles(opts, opts.args, missing);
+        bool header = false;
+        auto result = [&](std::string const &op, size_t items, size_t failed, ullint bytes, double seconds) {
+            emit(opts, {textField("op", op), numberField("jobs", opts.jobs), numberField("level", opts.level),
+                        numberField("items", items), numberField("failed", failed), numberField("bytes", bytes),
+                        numberField("seconds", seconds), numberField("mbps", mbps(bytes, seconds)),
+                        numberField("archive_size", fs::file_size(opts.archive))}, header, false);
+        };
+
+        size_t failures = missing;
+        {
+            ZPack pack;
+            if (!openArchive(opts, pack, true, false)) {
+                fs::remove_all(workdir);
+                return 1;
+            }
+
+            auto start = cli_clock::now();
+            ullint bytes = 0;
+            size_t failed = packJobs(opts, pack, jobs, bytes);
+            result("pack", jobs.size(), failed, bytes, secondsSince(start));
+            failures += failed;
+
+            auto names = pack.listNames();
+            bytes = itemsSize(pack, names);
+
+            start = cli_clock::now();
+            failed = eachItem(opts, pack, names, [](ZPack &reader, std::string const &name) {
+                return reader.verify(name);
+            });
+            result("verify", names.size(), failed, bytes, secondsSince(start));
+            failures += failed;
+
+            std::string dest = (workdir / "extract").string() + "/";
+            start = cli_clock::now();
+            failed = eachItem(opts, pack, names, [&dest](ZPack &reader, std::string const &name) {
+                return reader.extractFile(name, dest);
+            });
+            result("extract", names.size(), failed, bytes, secondsSince(start));
+            failures += failed;
+            pack.close();
+        }
+
+        fs::remove_all(workdir);
+        return failures > 0 ? 2 : 0;
+    }
+
+    bool parseArgs(int argc, char **argv, CliOptions &opts) {
+        if (argc < 2) return false;
+
+        opts.command = argv[1];
+        bool options = true;
+        std::vector<std::string> positional;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (options && arg == "--") {
+                options = false;
+                continue;
+            }
+            if (!options || arg.size() < 2 || arg[0] != '-') {
+                positional.push_back(arg);
+                continue;
+            }
+            if (i + 1 >= argc) return false;
+
+            std::string value = argv[++i];
+            try {
+                if (arg == "-j") {
+                    opts.jobs = (uint) std::stoul(value);
+                    if (opts.jobs == 0) opts.jobs = 1;
+                } else if (arg == "-l") {
+                    opts.level = (short int) std::stoi(value);
+                    opts.levelSet = true;
+                } else if (arg == "--include") {
+                    opts.includes.push_back(value);
+                } else if (arg == "--exclude") {
+                    opts.excludes.push_back(value);
+                } else if (arg == "--memory") {
+                    opts.memory = (ullint) std::stoull(value) * 1024 * 1024;
+                } else if (arg == "--dir") {
+                    opts.directory = value;
+                } else if (arg == "--format") {
+                    if (value != "text" && value != "json" && value != "csv") return false;
+                    opts.format = value;
+                } else {
+                    return false;
+                }
+            } catch (std::logic_error &) {
+                return false;
+            }
+        }
+
+        if (opts.command == "bench" || opts.command == "version") {
+            opts.args = positional;
+            return true;
+        }
+        if (positional.empty()) return false;
+
+        opts.archive = positional[0];
+        opts.args.assign(positional.begin() + 1, positional.end());
+        return true;
+    }
+}
+
 int main(int argc, char **argv) {
-    ZPack zp;
-    std::cout << "ZPack version " << zp.version << std::endl;
+    CliOptions opts;
+    if (!parseArgs(argc, argv, opts)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        if (opts.command == "create") return cmdAdd(opts, true);
+        if (opts.command == "add") return cmdAdd(opts, false);
+        if (opts.command == "extract") return cmdExtract(opts);
+        if (opts.command == "list") return cmdList(opts);
+        if (opts.command == "rm") return cmdRemove(opts);
+        if (opts.command == "repack") return cmdRepack(opts);
+        if (opts.command == "verify") return cmdVerify(opts);
+        if (opts.command == "stat") return cmdStat(opts);
+        if (opts.command == "bench") return cmdBench(opts);
+        if (opts.command == "version") {
+            std::cout << "ZPack version " << ZPack::version << std::endl;
+            return 0;
+        }
+    } catch (fs::filesystem_error &e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
 
-    return 0;
-}
\ No newline at end of file
+    usage(argv[0]);
+    return 1;
+}
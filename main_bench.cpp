@@ -0,0 +1,347 @@
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include "zpack.h"
+
+namespace {
+    typedef std::chrono::steady_clock bench_clock;
+
+    struct BenchOptions {
+        ullint scale = 64 * 1024 * 1024;
+        std::vector<short int> levels{1, 3, 19};
+        std::vector<uint> blocks{256 * 1024, 1024 * 1024, 1024 * 1024 * 6};
+        std::vector<std::string> corpora{"text", "binary", "incompressible", "many-small", "few-huge"};
+        std::string format = "json";
+        std::string output;
+        std::string workdir;
+        uint seed = 0x5a504b;
+    };
+
+    struct BenchItem {
+        std::string name;
+        std::string data;
+    };
+
+    struct BenchResult {
+        std::string corpus;
+        short int level;
+        uint block;
+        std::string op;
+        std::vector<double> latencies;
+        ullint bytes = 0;
+        double seconds = 0;
+        ullint archiveSize = 0;
+    };
+
+    const char *words[] = {
+        "the", "archive", "stores", "items", "with", "zstd", "compression", "and", "a", "central", "directory",
+        "block", "stream", "offset", "header", "record", "level", "of", "data", "is", "read", "from", "disk",
+        "into", "memory", "before", "being", "written", "back", "to", "file", "system", "cache", "page"
+    };
+
+    std::string genText(std::mt19937_64 &rng, size_t size) {
+        std::string out;
+        out.reserve(size + 16);
+        std::uniform_int_distribution<size_t> pick(0, sizeof(words) / sizeof(words[0]) - 1);
+        std::uniform_int_distribution<int> line(0, 15);
+        while (out.size() < size) {
+            out += words[pick(rng)];
+            out += line(rng) == 0 ? '\n' : ' ';
+        }
+        out.resize(size);
+        return out;
+    }
+
+    std::string genBinary(std::mt19937_64 &rng, size_t size) {
+        // table-like records: slowly growing ids, small counters and a few random bytes
+        std::string out;
+        out.reserve(size + 32);
+        std::uniform_int_distribution<int> small(0, 255);
+        ullint id = 0;
+        while (out.size() < size) {
+            id += 1 + small(rng) % 4;
+            unsigned char rec[24]{};
+            assignInt<ullint>(id, rec);
+            assignInt<uint>((uint) small(rng), rec + 8);
+            assignInt<uint>((uint) (id * 31), rec + 12);
+            for (int i = 16; i < 24; i++) {
+                rec[i] = (unsigned char) (i < 20 ? small(rng) : 0);
+            }
+            out.append((const char *) rec, sizeof(rec));
+        }
+        out.resize(size);
+        return out;
+    }
+
+    std::string genRandom(std::mt19937_64 &rng, size_t size) {
+        std::string out(size, '\0');
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8) {
+            assignInt<ullint>(rng(), (unsigned char *) &out[i]);
+        }
+        for (; i < size; i++) {
+            out[i] = (char) rng();
+        }
+        return out;
+    }
+
+    std::vector<BenchItem> genCorpus(std::string const &corpus, ullint scale, uint seed) {
+        std::mt19937_64 rng(seed);
+        std::vector<BenchItem> items;
+
+        if (corpus == "many-small") {
+            std::uniform_int_distribution<size_t> sizes(64, 4096);
+            ullint total = 0;
+            for (uint i = 0; total < scale / 8; i++) {
+                size_t size = sizes(rng);
+                items.push_back({"small/" + std::to_string(i % 97) + "/item_" + std::to_string(i), genText(rng, size)});
+                total += size;
+            }
+        } else if (corpus == "few-huge") {
+            for (uint i = 0; i < 2; i++) {
+                items.push_back({"huge_" + std::to_string(i), i == 0 ? genText(rng, scale / 2) : genBinary(rng, scale / 2)});
+            }
+        } else {
+            std::function<std::string(std::mt19937_64 &, size_t)> gen = genText;
+            if (corpus == "binary") gen = genBinary;
+            if (corpus == "incompressible") gen = genRandom;
+
+            std::uniform_int_distribution<size_t> sizes(scale / 64, scale / 16);
+            ullint total = 0;
+            for (uint i = 0; total < scale; i++) {
+                size_t size = std::min<ullint>(sizes(rng), scale - total);
+                items.push_back({corpus + "_" + std::to_string(i), gen(rng, size)});
+                total += size;
+            }
+        }
+
+        return items;
+    }
+
+    double percentile(std::vector<double> sorted, double p) {
+        if (sorted.empty()) return 0;
+        std::sort(sorted.begin(), sorted.end());
+        size_t idx = (size_t) (p * (sorted.size() - 1) + 0.5);
+        return sorted[idx];
+    }
+
+    template<typename F>
+    double timed(F fn) {
+        auto start = bench_clock::now();
+        fn();
+        return std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+
+    void emit(std::ostream &out, BenchOptions const &opts, BenchResult const &r, bool &header) {
+        double mbps = r.seconds > 0 ? (double) r.bytes / r.seconds / (1024.0 * 1024.0) : 0;
+        double p50 = percentile(r.latencies, 0.50) * 1e6;
+        double p90 = percentile(r.latencies, 0.90) * 1e6;
+        double p99 = percentile(r.latencies, 0.99) * 1e6;
+        double pmax = percentile(r.latencies, 1.0) * 1e6;
+
+        if (opts.format == "csv") {
+            if (!header) {
+                out << "corpus,level,block,op,calls,bytes,seconds,mbps,p50_us,p90_us,p99_us,max_us,archive_size"
+                    << std::endl;
+                header = true;
+            }
+            out << r.corpus << ',' << r.level << ',' << r.block << ',' << r.op << ',' << r.latencies.size() << ','
+                << r.bytes << ',' << r.seconds << ',' << mbps << ',' << p50 << ',' << p90 << ',' << p99 << ','
+                << pmax << ',' << r.archiveSize << std::endl;
+        } else {
+            out << "{\"corpus\":\"" << r.corpus << "\",\"level\":" << r.level << ",\"block\":" << r.block
+                << ",\"op\":\"" << r.op << "\",\"calls\":" << r.latencies.size() << ",\"bytes\":" << r.bytes
+                << ",\"seconds\":" << r.seconds << ",\"mbps\":" << mbps << ",\"p50_us\":" << p50
+                << ",\"p90_us\":" << p90 << ",\"p99_us\":" << p99 << ",\"max_us\":" << pmax
+                << ",\"archive_size\":" << r.archiveSize << "}" << std::endl;
+        }
+    }
+
+    void runCase(std::ostream &out, BenchOptions const &opts, std::string const &corpus,
+                 std::vector<BenchItem> const &items, fs::path const &srcDir, short int level, uint block,
+                 bool &header) {
+        fs::path archive = fs::path(opts.workdir) / ("bench_" + corpus + ".zpk");
+        fs::path extractDir = fs::path(opts.workdir) / "extract";
+        ullint corpusBytes = 0;
+        for (auto const &item : items) corpusBytes += item.data.size();
+
+        auto make = [&](std::string const &op) {
+            BenchResult r;
+            r.corpus = corpus;
+            r.level = level;
+            r.block = block;
+            r.op = op;
+            r.latencies.reserve(items.size());
+            return r;
+        };
+
+        ZPack pack;
+        pack.setCompressionLevel(level);
+        pack.setBlockSize(block);
+        pack.open(archive.c_str(), true);
+
+        BenchResult packItem = make("packItem");
+        for (auto const &item : items) {
+            double t = timed([&] { pack.packItem(item.name, item.data); });
+            packItem.latencies.push_back(t);
+            packItem.seconds += t;
+            packItem.bytes += item.data.size();
+        }
+
+        BenchResult write = make("write");
+        write.seconds = timed([&] { pack.write(); });
+        write.latencies.push_back(write.seconds);
+        write.bytes = corpusBytes;
+        write.archiveSize = fs::file_size(archive);
+        packItem.archiveSize = write.archiveSize;
+
+        BenchResult extractStr = make("extractStr");
+        for (auto const &item : items) {
+            std::string res;
+            double t = timed([&] { res = pack.extractStr(item.name); });
+            extractStr.latencies.push_back(t);
+            extractStr.seconds += t;
+            extractStr.bytes += res.size();
+        }
+
+        BenchResult extractFile = make("extractFile");
+        for (auto const &item : items) {
+            double t = timed([&] { pack.extractFile(item.name, (extractDir / "x").string()); });
+            extractFile.latencies.push_back(t);
+            extractFile.seconds += t;
+            extractFile.bytes += item.data.size();
+        }
+
+        BenchResult repack = make("repack");
+        repack.seconds = timed([&] { pack.repack(); });
+        repack.latencies.push_back(repack.seconds);
+        repack.bytes = corpusBytes;
+        repack.archiveSize = fs::file_size(archive);
+        pack.close();
+
+        ZPack filePack;
+        filePack.setCompressionLevel(level);
+        filePack.setBlockSize(block);
+        filePack.open(archive.c_str(), true);
+
+        BenchResult packFile = make("packFile");
+        for (auto const &item : items) {
+            fs::path src = srcDir / item.name;
+            double t = timed([&] { filePack.packFile(src.string(), fs::path(item.name).parent_path().string()); });
+            packFile.latencies.push_back(t);
+            packFile.seconds += t;
+            packFile.bytes += item.data.size();
+        }
+        filePack.write();
+        packFile.archiveSize = fs::file_size(archive);
+        filePack.close();
+
+        for (auto const *r : {&packItem, &packFile, &write, &extractStr, &extractFile, &repack}) {
+            emit(out, opts, *r, header);
+        }
+
+        fs::remove_all(extractDir);
+        fs::remove(archive);
+    }
+
+    template<typename T>
+    std::vector<T> parseList(std::string const &arg) {
+        std::vector<T> res;
+        std::stringstream ss(arg);
+        std::string part;
+        while (std::getline(ss, part, ',')) {
+            std::stringstream conv(part);
+            T value;
+            conv >> value;
+            res.push_back(value);
+        }
+        return res;
+    }
+
+    void usage(const char *self) {
+        std::cerr << "Usage: " << self << " [options]" << std::endl
+                  << "  --scale MB          corpus size per case (default 64)" << std::endl
+                  << "  --levels 1,3,19     compression levels" << std::endl
+                  << "  --blocks 262144,... block sizes in bytes" << std::endl
+                  << "  --corpora a,b       text,binary,incompressible,many-small,few-huge" << std::endl
+                  << "  --format json|csv   output format (default json lines)" << std::endl
+                  << "  --output FILE       write results to FILE instead of stdout" << std::endl
+                  << "  --workdir DIR       scratch directory (default system temp)" << std::endl
+                  << "  --seed N            corpus generator seed" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--scale") {
+            opts.scale = std::stoull(value) * 1024 * 1024;
+        } else if (arg == "--levels") {
+            opts.levels = parseList<short int>(value);
+        } else if (arg == "--blocks") {
+            opts.blocks = parseList<uint>(value);
+        } else if (arg == "--corpora") {
+            opts.corpora = parseList<std::string>(value);
+        } else if (arg == "--format") {
+            opts.format = value;
+        } else if (arg == "--output") {
+            opts.output = value;
+        } else if (arg == "--workdir") {
+            opts.workdir = value;
+        } else if (arg == "--seed") {
+            opts.seed = (uint) std::stoul(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool ownWorkdir = opts.workdir.empty();
+    if (ownWorkdir) {
+        opts.workdir = (fs::temp_directory_path() / fs::unique_path("zpack-bench-%%%%%%")).string();
+    }
+    fs::create_directories(opts.workdir);
+
+    std::ofstream outFile;
+    if (!opts.output.empty()) {
+        outFile.open(opts.output, std::ios_base::out | std::ios_base::trunc);
+    }
+    std::ostream &out = opts.output.empty() ? std::cout : outFile;
+
+    bool header = false;
+    for (auto const &corpus : opts.corpora) {
+        auto items = genCorpus(corpus, opts.scale, opts.seed);
+
+        // packFile reads real files, so materialise the corpus once per run
+        fs::path srcDir = fs::path(opts.workdir) / ("src_" + corpus);
+        for (auto const &item : items) {
+            fs::path src = srcDir / item.name;
+            fs::create_directories(src.parent_path());
+            std::ofstream(src.string(), std::ios_base::binary | std::ios_base::trunc) << item.data;
+        }
+
+        for (auto level : opts.levels) {
+            for (auto block : opts.blocks) {
+                runCase(out, opts, corpus, items, srcDir, level, block, header);
+            }
+        }
+
+        fs::remove_all(srcDir);
+    }
+
+    if (ownWorkdir) {
+        fs::remove_all(opts.workdir);
+    }
+
+    return 0;
+}
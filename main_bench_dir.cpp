@@ -0,0 +1,249 @@
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <algorithm>
+#include "zpack.h"
+
+namespace {
+    typedef std::chrono::steady_clock bench_clock;
+
+    struct BenchOptions {
+        std::vector<ullint> counts{10000, 100000, 1000000};
+        std::vector<uint> nameLengths{24, 64, 160};
+        uint lookups = 100000;
+        std::string format = "json";
+        std::string output;
+        std::string workdir;
+        uint seed = 0x5a504b;
+    };
+
+    struct MemoryUsage {
+        ullint rss = 0;
+        ullint peak = 0;
+    };
+
+    MemoryUsage memoryUsage() {
+        MemoryUsage usage;
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            std::istringstream ss(line);
+            std::string key;
+            ullint value = 0;
+            ss >> key >> value;
+            if (key == "VmRSS:") usage.rss = value * 1024;
+            if (key == "VmHWM:") usage.peak = value * 1024;
+        }
+        return usage;
+    }
+
+    std::string itemName(ullint i, uint length) {
+        std::string name = "dir_" + std::to_string(i % 251) + "/sub_" + std::to_string(i % 17) + "/item_" +
+                           std::to_string(i);
+        if (name.size() < length) {
+            name.insert(name.size() - std::to_string(i).size(), length - name.size(), 'x');
+        }
+        return name;
+    }
+
+    template<typename F>
+    double timed(F fn) {
+        auto start = bench_clock::now();
+        fn();
+        return std::chrono::duration<double>(bench_clock::now() - start).count();
+    }
+
+    double percentile(std::vector<double> &sorted, double p) {
+        if (sorted.empty()) return 0;
+        size_t idx = (size_t) (p * (sorted.size() - 1) + 0.5);
+        return sorted[idx];
+    }
+
+    class Emitter {
+        std::ostream &out;
+        std::string format;
+        bool header = false;
+
+    public:
+        Emitter(std::ostream &out, std::string format) : out(out), format(std::move(format)) {
+            out.precision(15);
+        }
+
+        void emit(ullint count, uint nameLength, std::string const &metric, double value) {
+            if (format == "csv") {
+                if (!header) {
+                    out << "entries,name_length,metric,value" << std::endl;
+                    header = true;
+                }
+                out << count << ',' << nameLength << ',' << metric << ',' << value << std::endl;
+            } else {
+                out << "{\"entries\":" << count << ",\"name_length\":" << nameLength << ",\"metric\":\"" << metric
+                    << "\",\"value\":" << value << "}" << std::endl;
+            }
+        }
+
+        void emitLatencies(ullint count, uint nameLength, std::string const &op, std::vector<double> &lat) {
+            std::sort(lat.begin(), lat.end());
+            emit(count, nameLength, op + "_p50_us", percentile(lat, 0.50) * 1e6);
+            emit(count, nameLength, op + "_p90_us", percentile(lat, 0.90) * 1e6);
+            emit(count, nameLength, op + "_p99_us", percentile(lat, 0.99) * 1e6);
+            emit(count, nameLength, op + "_max_us", percentile(lat, 1.0) * 1e6);
+        }
+    };
+
+    void runCase(Emitter &em, BenchOptions const &opts, ullint count, uint nameLength) {
+        fs::path archive = fs::path(opts.workdir) / "bench_dir.zpk";
+        std::mt19937_64 rng(opts.seed);
+        const std::string payload = "metadata benchmark payload";
+
+        {
+            // small block keeps the per item buffer cheap, the benchmark is about the directory
+            ZPack pack;
+            pack.setBlockSize(4096);
+            pack.open(archive.c_str(), true);
+
+            double build = timed([&] {
+                for (ullint i = 0; i < count; i++) {
+                    pack.packItem(itemName(i, nameLength), payload);
+                }
+            });
+            em.emit(count, nameLength, "build_s", build);
+
+            em.emit(count, nameLength, "commit_s", timed([&] { pack.write(); }));
+            em.emit(count, nameLength, "archive_bytes", (double) fs::file_size(archive));
+            em.emit(count, nameLength, "directory_bytes", (double) (pack.getStats().lastOffset -
+                                                                      pack.getStats().directoryOffset));
+            pack.close();
+        }
+
+        MemoryUsage before = memoryUsage();
+
+        ZPack pack;
+        double openTime = timed([&] { pack.open(archive.c_str()); });
+        MemoryUsage after = memoryUsage();
+
+        em.emit(count, nameLength, "open_s", openTime);
+        em.emit(count, nameLength, "open_rss_delta_bytes", (double) (after.rss - std::min(after.rss, before.rss)));
+        em.emit(count, nameLength, "rss_bytes", (double) after.rss);
+
+        std::uniform_int_distribution<ullint> pick(0, count - 1);
+        std::vector<double> hits;
+        std::vector<double> misses;
+        hits.reserve(opts.lookups);
+        misses.reserve(opts.lookups);
+        for (uint i = 0; i < opts.lookups; i++) {
+            std::string name = itemName(pick(rng), nameLength);
+            std::string missing = name + "_missing";
+            bool found = false;
+
+            hits.push_back(timed([&] { found = pack.contains(name); }));
+            misses.push_back(timed([&] { found = pack.contains(missing) || found; }));
+        }
+        em.emitLatencies(count, nameLength, "lookup_hit", hits);
+        em.emitLatencies(count, nameLength, "lookup_miss", misses);
+
+        // the first ordered query pays for sorting the name index
+        em.emit(count, nameLength, "name_index_build_s", timed([&] { pack.listNames("dir_0/"); }));
+        std::vector<double> listings;
+        for (uint i = 0; i < 251; i++) {
+            listings.push_back(timed([&] { pack.listNames("dir_" + std::to_string(i) + "/sub_3/"); }));
+        }
+        em.emitLatencies(count, nameLength, "list_prefix", listings);
+
+        std::vector<double> removes;
+        ullint removeCount = std::max<ullint>(1, count / 100);
+        removes.reserve(removeCount);
+        for (ullint i = 0; i < removeCount; i++) {
+            std::string name = itemName(pick(rng), nameLength);
+            removes.push_back(timed([&] { pack.remove(name); }));
+        }
+        em.emitLatencies(count, nameLength, "remove", removes);
+
+        em.emit(count, nameLength, "commit_after_remove_s", timed([&] { pack.write(); }));
+        em.emit(count, nameLength, "peak_rss_bytes", (double) memoryUsage().peak);
+
+        pack.close();
+        fs::remove(archive);
+    }
+
+    template<typename T>
+    std::vector<T> parseList(std::string const &arg) {
+        std::vector<T> res;
+        std::stringstream ss(arg);
+        std::string part;
+        while (std::getline(ss, part, ',')) {
+            std::stringstream conv(part);
+            T value;
+            conv >> value;
+            res.push_back(value);
+        }
+        return res;
+    }
+
+    void usage(const char *self) {
+        std::cerr << "Usage: " << self << " [options]" << std::endl
+                  << "  --counts 10000,...   directory sizes to build" << std::endl
+                  << "  --names 24,64,160    item name lengths" << std::endl
+                  << "  --lookups N          random lookups per case (default 100000)" << std::endl
+                  << "  --format json|csv    output format (default json lines)" << std::endl
+                  << "  --output FILE        write results to FILE instead of stdout" << std::endl
+                  << "  --workdir DIR        scratch directory (default system temp)" << std::endl
+                  << "  --seed N             lookup sampler seed" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+    BenchOptions opts;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        std::string value = argv[++i];
+        if (arg == "--counts") {
+            opts.counts = parseList<ullint>(value);
+        } else if (arg == "--names") {
+            opts.nameLengths = parseList<uint>(value);
+        } else if (arg == "--lookups") {
+            opts.lookups = (uint) std::stoul(value);
+        } else if (arg == "--format") {
+            opts.format = value;
+        } else if (arg == "--output") {
+            opts.output = value;
+        } else if (arg == "--workdir") {
+            opts.workdir = value;
+        } else if (arg == "--seed") {
+            opts.seed = (uint) std::stoul(value);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bool ownWorkdir = opts.workdir.empty();
+    if (ownWorkdir) {
+        opts.workdir = (fs::temp_directory_path() / fs::unique_path("zpack-bench-dir-%%%%%%")).string();
+    }
+    fs::create_directories(opts.workdir);
+
+    std::ofstream outFile;
+    if (!opts.output.empty()) {
+        outFile.open(opts.output, std::ios_base::out | std::ios_base::trunc);
+    }
+    Emitter em(opts.output.empty() ? std::cout : outFile, opts.format);
+
+    for (auto count : opts.counts) {
+        for (auto nameLength : opts.nameLengths) {
+            runCase(em, opts, count, nameLength);
+        }
+    }
+
+    if (ownWorkdir) {
+        fs::remove_all(opts.workdir);
+    }
+
+    return 0;
+}
@@ -1,7 +1,35 @@
+#include <algorithm>
+#include <map>
+#include <random>
+#include <thread>
+#include <sys/stat.h>
 #include <gtest/gtest.h>
+#include <boost/crc.hpp>
+#include "_sparse_io.h"
 #include "zpack.h"
+#include "zpack_lz4.h"
+#include "zpack_recompressor.h"
+#include "zpack_scanner.h"
+#include "zpack_snapshot.h"
+#include "zpack_stream_writer.h"
+#include "zpack_volumes.h"
 
 namespace {
+    class TraceCollector : public zpack_trace_listener {
+    public:
+        std::vector<ZPackTraceEvent> events;
+
+        void onEvent(ZPackTraceEvent const &event) override {
+            events.push_back(event);
+        }
+
+        size_t count(ZPackTraceKind kind, ZPackTracePhase phase) {
+            return (size_t) std::count_if(events.begin(), events.end(), [&](ZPackTraceEvent const &e) {
+                return e.kind == kind && e.phase == phase;
+            });
+        }
+    };
+
     TEST(General, CreateAndReadNewWithItem) {
         std::string tempFileName = tmpnam(NULL);
         std::string tempItemText = "AZZZAKAJSLKDNLAK SNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknf";
@@ -109,4 +137,1312 @@ namespace {
 
         remove(tempFileName.c_str());
     }
-}
\ No newline at end of file
+
+    TEST(General, WarmItems) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string tempItemText = "AZZZAKAJSLKDNLAK SNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF "
+            "ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknf";
+
+        ZPack pack1;
+
+        pack1.open(tempFileName.c_str(), true);
+        pack1.packItem("special_item", tempItemText, "");
+        pack1.packItem("special_item2", tempItemText, "");
+        pack1.write();
+        pack1.close();
+
+        ZPack pack2;
+        pack2.open(tempFileName.c_str());
+        auto warmed = pack2.warm({"special_item", "special_item2", "missing_item"});
+        auto extractItem = pack2.extractStr("special_item2");
+        pack2.close();
+
+        remove(tempFileName.c_str());
+
+        ASSERT_GT(warmed, 0);
+        ASSERT_EQ(extractItem, tempItemText);
+    }
+
+    TEST(General, DirectoryOverRecordsNumberLimit) {
+        std::string tempFileName = tmpnam(NULL);
+        const uint itemsCount = 0xFFFF + 100;
+
+        ZPack pack1;
+        pack1.setBlockSize(4096);
+        pack1.open(tempFileName.c_str(), true);
+        for (uint i = 0; i < itemsCount; i++) {
+            pack1.packItem("item_" + std::to_string(i), "payload " + std::to_string(i));
+        }
+        pack1.write();
+        pack1.close();
+
+        ZPack pack2;
+        pack2.open(tempFileName.c_str());
+        auto extractItem = pack2.extractStr("item_" + std::to_string(itemsCount - 1));
+        auto hasFirst = pack2.contains("item_0");
+        pack2.write();
+        auto stats = pack2.getStats();
+        pack2.close();
+
+        remove(tempFileName.c_str());
+
+        ASSERT_EQ(stats.records, itemsCount);
+        ASSERT_TRUE(hasFirst);
+        ASSERT_EQ(extractItem, "payload " + std::to_string(itemsCount - 1));
+    }
+
+    TEST(General, MetricsCountOperations) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string tempItemText = "AZZZAKAJSLKDNLAK SNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF "
+            "ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknf";
+
+        ZPack pack1;
+
+        pack1.open(tempFileName.c_str(), true);
+        pack1.packItem("special_item", tempItemText, "");
+        pack1.packItem("special_item2", tempItemText, "");
+        pack1.write();
+        pack1.extractStr("special_item");
+
+        auto metrics = pack1.getMetrics();
+        pack1.resetMetrics();
+        auto metricsReset = pack1.getMetrics();
+        pack1.close();
+
+        remove(tempFileName.c_str());
+
+        auto const &pack = metrics[ZPackOperation::PACK];
+        ASSERT_EQ(pack.calls, 2);
+        ASSERT_EQ(pack.bytesIn, tempItemText.size() * 2);
+        ASSERT_GT(pack.compressionRatio(), 1.0);
+        ASSERT_EQ(metrics[ZPackOperation::EXTRACT].bytesOut, tempItemText.size());
+        ASSERT_EQ(metrics[ZPackOperation::WRITE].calls, 1);
+        ASSERT_GT(pack.latencyPercentileMicros(0.5), 0);
+        ASSERT_EQ(metricsReset[ZPackOperation::PACK].calls, 0);
+        ASSERT_GT(metrics[ZPackOperation::EXTRACT].compressionRatio(), 1.0);
+    }
+
+    TEST(General, MetricsExpandingPack) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string noise;
+        unsigned int seed = 12345;
+        for (int i = 0; i < 64 * 1024; i++) {
+            seed = seed * 1103515245 + 12345;
+            noise += (char) (seed >> 16);
+        }
+
+        ZPack pack;
+        pack.open(tempFileName.c_str(), true);
+        pack.packItem("noise", noise);
+        auto metrics = pack.getMetrics();
+        pack.close();
+        remove(tempFileName.c_str());
+
+        ASSERT_LT(metrics[ZPackOperation::PACK].compressionRatio(), 1.0);
+    }
+
+    TEST(General, TraceListenerEvents) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string tempItemText = "AZZZAKAJSLKDNLAK SNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF "
+            "ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknf";
+
+        TraceCollector collector;
+        ZPack pack1;
+        pack1.setTraceListener(&collector);
+
+        pack1.open(tempFileName.c_str(), true);
+        pack1.packItem("special_item", tempItemText, "");
+        pack1.write();
+        pack1.extractStr("special_item");
+        pack1.close();
+
+        remove(tempFileName.c_str());
+
+        ASSERT_EQ(collector.count(ZPackTraceKind::PACK, ZPackTracePhase::BEGIN), 1);
+        ASSERT_EQ(collector.count(ZPackTraceKind::PACK, ZPackTracePhase::END), 1);
+        ASSERT_EQ(collector.count(ZPackTraceKind::COMPRESS, ZPackTracePhase::END), 1);
+        ASSERT_EQ(collector.count(ZPackTraceKind::DECOMPRESS, ZPackTracePhase::END), 1);
+        ASSERT_EQ(collector.count(ZPackTraceKind::DIRECTORY_WRITE, ZPackTracePhase::END), 1);
+        ASSERT_EQ(collector.count(ZPackTraceKind::READ, ZPackTracePhase::BEGIN),
+                  collector.count(ZPackTraceKind::READ, ZPackTracePhase::END));
+
+        auto extractEnd = std::find_if(collector.events.begin(), collector.events.end(), [](ZPackTraceEvent const &e) {
+            return e.kind == ZPackTraceKind::EXTRACT && e.phase == ZPackTracePhase::END;
+        });
+        ASSERT_NE(extractEnd, collector.events.end());
+        ASSERT_EQ(extractEnd->size, tempItemText.size());
+    }
+
+    TEST(Checksum, Crc32MatchesBoost) {
+        std::string data;
+        for (int i = 0; i < 100000; i++) {
+            data += (char) (i * 7919 % 251);
+        }
+
+        for (size_t len : {0, 1, 15, 16, 63, 64, 65, 1000, 4099, 100000}) {
+            boost::crc_32_type reference;
+            reference.process_bytes(data.data(), len);
+
+            zpack_checksum checksum;
+            checksum.process_bytes(data.data(), len / 3);
+            checksum.process_bytes(data.data() + len / 3, len - len / 3);
+
+            ASSERT_EQ(checksum.checksum(), reference.checksum()) << "length " << len;
+        }
+    }
+
+    TEST(Checksum, Xxh64KnownValue) {
+        zpack_checksum empty(ZPackChecksum::XXHASH64);
+        ASSERT_EQ(empty.checksum(), 0x51D8E999u);
+
+        // low halves of the reference XXH64 with seed 0 over bytes i * 7 + 1, lengths cover every
+        // tail step and the 32 byte stripes
+        std::string data;
+        for (int i = 0; i < 257; i++) {
+            data += (char) (i * 7 + 1);
+        }
+        const std::pair<size_t, uint32_t> known[] = {
+            {1, 0x1B21E730u}, {3, 0xC2FD373Au}, {4, 0x6AF4C124u}, {8, 0x5E0B3222u},
+            {31, 0x29F50073u}, {32, 0xE9ECD3D1u}, {33, 0x7BB9C183u}, {257, 0x05001C1Du},
+        };
+        for (auto const &vector : known) {
+            zpack_checksum whole(ZPackChecksum::XXHASH64);
+            whole.process_bytes(data.data(), vector.first);
+            ASSERT_EQ(whole.checksum(), vector.second) << "length " << vector.first;
+
+            zpack_checksum bytewise(ZPackChecksum::XXHASH64);
+            for (size_t i = 0; i < vector.first; i++) {
+                bytewise.process_bytes(data.data() + i, 1);
+            }
+            ASSERT_EQ(bytewise.checksum(), vector.second) << "length " << vector.first;
+        }
+
+        std::string tempFileName = tmpnam(NULL);
+        std::string tempItemText = "AZZZAKAJSLKDNLAK SNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF "
+            "ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknfSNDLK NSFLAKSNF ALKSFN ALKSFN ALKSFN LKFN ALSKNFALKSNFKsldknf";
+
+        ZPack pack1;
+        pack1.setChecksum(ZPackChecksum::XXHASH64);
+        pack1.open(tempFileName.c_str(), true);
+        pack1.packItem("special_item", tempItemText, "");
+        pack1.write();
+        pack1.close();
+
+        ZPack pack2;
+        pack2.open(tempFileName.c_str());
+        auto extractItem = pack2.extractStr("special_item");
+        pack2.close();
+
+        remove(tempFileName.c_str());
+
+        ASSERT_EQ(extractItem, tempItemText);
+    }
+
+    TEST(Directory, DecodeEntries) {
+        uchar raw[8];
+        assignInt<ullint>(0x0102030405060708ull, raw);
+        ASSERT_EQ(raw[0], 0x08);
+        ASSERT_EQ(readInt<ullint>(raw), 0x0102030405060708ull);
+
+        std::vector<uchar> blob;
+        const std::string names[] = {"first", "second/item"};
+        for (ullint i = 0; i < 2; i++) {
+            DirectoryFileHeaderRecord record = {};
+            assignInt<ullint>(100 * (i + 1), record.offsetFile);
+            assignInt<ullint>(42 + i, record.uncompressedSize);
+            assignInt<usint>((usint) names[i].size(), record.filenameLen);
+            assignInt<usint>(3, record.commentLen);
+
+            auto pos = (const uchar *) &record;
+            blob.insert(blob.end(), pos, pos + sizeof(record));
+            blob.insert(blob.end(), names[i].begin(), names[i].end());
+            blob.insert(blob.end(), {'c', 'm', 't'});
+        }
+
+        std::unordered_map<std::string, DirectoryFileQueue> entries;
+        ASSERT_EQ(ZPack::decodeDirectory(blob.data(), blob.size(), entries), ZPack::Errors::OK);
+        ASSERT_EQ(entries.size(), 2u);
+        ASSERT_EQ(entries[names[1]].filename, names[1]);
+        ASSERT_EQ(entries[names[1]].record.getOffsetFile(), 200u);
+        ASSERT_EQ(entries[names[0]].record.getUncompressedSize(), 42u);
+        ASSERT_EQ(entries[names[0]].comment, "cmt");
+
+        std::unordered_map<std::string, DirectoryFileQueue> truncated;
+        ASSERT_EQ(ZPack::decodeDirectory(blob.data(), sizeof(DirectoryFileHeaderRecord) + 2, truncated),
+                  ZPack::Errors::ERR_READ_ENTRY_NAME);
+    }
+
+    TEST(General, BufferPoolReuse) {
+        std::string tempFileName = tmpnam(NULL);
+
+        ZPack pack;
+        pack.open(tempFileName.c_str(), true);
+        for (int i = 0; i < 50; i++) {
+            pack.packItem("item_" + std::to_string(i), std::string(4096 + i, (char) ('a' + i % 26)));
+        }
+        pack.write();
+
+        for (int i = 0; i < 50; i++) {
+            ASSERT_EQ(pack.extractStr("item_" + std::to_string(i)), std::string(4096 + i, (char) ('a' + i % 26)));
+        }
+
+        auto stats = pack.getBufferPool().getStats();
+        pack.close();
+        remove(tempFileName.c_str());
+
+        ASSERT_GT(stats.acquired, 100u);
+        ASSERT_LT(stats.allocated, 10u);
+        ASSERT_EQ(stats.acquired, stats.reused + stats.allocated);
+
+        zpack_buffer_pool pool;
+        pool.setHugePages(true);
+        {
+            auto big = pool.acquire(4u << 20);
+            big.data()[0] = 1;
+            big.data()[big.size() - 1] = 1;
+        }
+        ASSERT_EQ(pool.getStats().cachedBytes, 4u << 20);
+        pool.trim();
+        ASSERT_EQ(pool.getStats().cachedBuffers, 0u);
+    }
+
+    TEST(General, SolidBlocks) {
+        std::string solidFileName = tmpnam(NULL);
+        std::string plainFileName = tmpnam(NULL);
+        auto itemText = [](int i) {
+            return "{\"sensor\":" + std::to_string(i % 17) + ",\"value\":" + std::to_string(i * 31 % 1000) + "}";
+        };
+
+        ZPack plain;
+        plain.open(plainFileName.c_str(), true);
+        ZPack solid;
+        solid.setSolid(16 * 1024);
+        solid.open(solidFileName.c_str(), true);
+        for (int i = 0; i < 2000; i++) {
+            plain.packItem("rec_" + std::to_string(i), itemText(i));
+            solid.packItem("rec_" + std::to_string(i), itemText(i));
+        }
+
+        // not flushed yet items are served from memory
+        ASSERT_EQ(solid.extractStr("rec_1999"), itemText(1999));
+
+        plain.write();
+        solid.write();
+        auto plainData = plain.getStats().directoryOffset;
+        auto solidData = solid.getStats().directoryOffset;
+        plain.close();
+        solid.close();
+
+        ASSERT_LT(solidData * 5, plainData);
+        ASSERT_LT(fs::file_size(solidFileName), fs::file_size(plainFileName));
+
+        ZPack reader;
+        reader.open(solidFileName.c_str());
+        for (int i = 0; i < 2000; i++) {
+            ASSERT_EQ(reader.extractStr("rec_" + std::to_string(i)), itemText(i));
+        }
+
+        for (int i = 0; i < 2000; i += 3) {
+            reader.remove("rec_" + std::to_string(i));
+        }
+        reader.repack();
+        ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+
+        for (int i = 1; i < 2000; i += 3) {
+            ASSERT_EQ(reader.extractStr("rec_" + std::to_string(i)), itemText(i));
+        }
+        ASSERT_EQ(reader.extractStr("rec_0"), "");
+        reader.close();
+
+        remove(solidFileName.c_str());
+        remove(plainFileName.c_str());
+    }
+
+    TEST(General, PipelinedLargeItem) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string data;
+        std::mt19937 rng(7);
+        for (int i = 0; i < 200000; i++) {
+            data += "line " + std::to_string(i) + " " + std::to_string(rng() % 1000) + "\n";
+        }
+
+        for (uint depth : {1u, 4u}) {
+            ZPack pack;
+            pack.setBlockSize(64 * 1024);
+            pack.setCompressionLevel(3);
+            pack.setPipelineDepth(depth);
+            pack.open(tempFileName.c_str(), true);
+            pack.packItem("big", data);
+            pack.packItem("small", "after the big one");
+            pack.write();
+            pack.close();
+
+            ZPack reader;
+            reader.setBlockSize(64 * 1024);
+            reader.setPipelineDepth(depth);
+            reader.open(tempFileName.c_str());
+            ASSERT_EQ(reader.extractStr("big"), data);
+            ASSERT_EQ(reader.extractStr("small"), "after the big one");
+            ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+            reader.close();
+        }
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, CompressionWorkers) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string data;
+        for (int i = 0; i < 150000; i++) {
+            data += "record " + std::to_string(i * 7919 % 100003) + ";";
+        }
+
+        ZPack pack;
+        pack.setBlockSize(256 * 1024);
+        pack.setCompressionLevel(3);
+        pack.setCompressionWorkers(2, 512 * 1024);
+        pack.open(tempFileName.c_str(), true);
+        pack.packItem("big", data);
+        pack.write();
+        pack.close();
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        ASSERT_EQ(reader.extractStr("big"), data);
+        ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, Lz4Codec) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string small = "latency critical asset, latency critical asset, latency critical asset, latency critical";
+        std::string big;
+        for (int i = 0; i < 100000; i++) {
+            big += "asset chunk " + std::to_string(i % 977) + "\n";
+        }
+
+        ZPack pack;
+        ASSERT_FALSE(pack.setCompressionMethod((ZPack::Compression) 99));
+        ASSERT_EQ(pack.error_code, ZPack::Errors::ERR_UNKNOWN_COMPRESSION);
+        pack.clear();
+
+        ASSERT_TRUE(pack.setCompressionMethod(ZPack::CompressLz4));
+        pack.setBlockSize(128 * 1024);
+        pack.setCompressionLevel(1);
+        pack.open(tempFileName.c_str(), true);
+        pack.packItem("small", small);
+        pack.packItem("big", big);
+        pack.setCompressionMethod(ZPack::CompressZstd);
+        pack.packItem("zstd", small);
+        pack.write();
+        auto stats = pack.getStats();
+        pack.close();
+
+        ASSERT_LT(stats.filesSizeCompressed, stats.filesSizeUncompressed / 4);
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        ASSERT_EQ(reader.extractStr("small"), small);
+        ASSERT_EQ(reader.extractStr("big"), big);
+        ASSERT_EQ(reader.extractStr("zstd"), small);
+        reader.setPipelineDepth(1);
+        ASSERT_EQ(reader.extractStr("big"), big);
+        ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+        reader.close();
+
+        // without a level LZ4 stays on the fast compressor, the default 19 of zstd would mean HC
+        zpack_lz4 fast;
+        ASSERT_EQ(fast.getCompressionLevel(), zpack_lz4::defaultLevel);
+        auto lz4Size = [&tempFileName, &big](bool hc) {
+            ZPack lz4Pack;
+            lz4Pack.setCompressionMethod(ZPack::CompressLz4);
+            if (hc) lz4Pack.setCompressionLevel(12);
+            lz4Pack.open(tempFileName.c_str(), true);
+            lz4Pack.packItem("big", big);
+            lz4Pack.write();
+            auto size = lz4Pack.getStats().filesSizeCompressed;
+            lz4Pack.close();
+            return size;
+        };
+        ASSERT_GT(lz4Size(false), lz4Size(true));
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, PrefixIndex) {
+        std::string tempFileName = tmpnam(NULL);
+
+        ZPack pack;
+        pack.open(tempFileName.c_str(), true);
+        pack.packItem("b.png", "1234", "assets/textures");
+        pack.packItem("a.png", "12", "assets/textures");
+        pack.packItem("c.jpg", "123456", "assets/textures/hd");
+        pack.packItem("theme.ogg", "1", "assets/sounds");
+        pack.packItem("readme.txt", "readme");
+
+        std::vector<std::string> expected{"assets/textures/a.png", "assets/textures/b.png", "assets/textures/hd/c.jpg"};
+        ASSERT_EQ(pack.listNames("assets/textures/"), expected);
+        ASSERT_EQ(pack.listNames().size(), 5u);
+        ASSERT_EQ(pack.globNames("assets/*.png"), std::vector<std::string>({"assets/textures/a.png", "assets/textures/b.png"}));
+
+        auto stats = pack.subtreeStats("assets/textures/");
+        ASSERT_EQ(stats.items, 3u);
+        ASSERT_EQ(stats.uncompressedSize, 12u);
+
+        pack.remove("assets/textures/b.png");
+        ullint walked = 0;
+        pack.forEachEntry("assets/", [&walked](ZPackEntry const &entry) {
+            walked += entry.uncompressedSize;
+            return entry.name != "assets/textures/a.png";
+        });
+        ASSERT_EQ(walked, 3u);
+
+        pack.close();
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, ConcurrentWriters) {
+        std::string tempFileName = tmpnam(NULL);
+        auto itemText = [](int writer, int i) {
+            std::string text = "writer " + std::to_string(writer) + " item " + std::to_string(i) + " ";
+            // every tenth item spans several blocks and goes through the staging file
+            size_t repeat = i % 10 == 0 ? 20000 : 20;
+            std::string res;
+            for (size_t r = 0; r < repeat; r++) res += text;
+            return res;
+        };
+
+        ZPack pack;
+        pack.setBlockSize(64 * 1024);
+        pack.setCompressionLevel(1);
+        pack.open(tempFileName.c_str(), true);
+        pack.packItem("before", "packed before concurrent writers were enabled");
+        pack.setConcurrentWriters(true);
+
+        std::vector<std::thread> writers;
+        for (int w = 0; w < 4; w++) {
+            writers.emplace_back([&pack, &itemText, w] {
+                for (int i = 0; i < 40; i++) {
+                    pack.packItem("item_" + std::to_string(i), itemText(w, i), "writer_" + std::to_string(w));
+                }
+            });
+        }
+        for (auto &writer : writers) {
+            writer.join();
+        }
+        pack.setCompressionMethod(ZPack::CompressNone);
+        pack.packItem("stored", itemText(9, 0));
+        ASSERT_EQ(pack.error_code, ZPack::Errors::OK);
+        pack.write();
+        pack.close();
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        ASSERT_EQ(reader.listNames().size(), 162u);
+        ASSERT_EQ(reader.extractStr("stored"), itemText(9, 0));
+        ASSERT_EQ(reader.extractStr("before"), "packed before concurrent writers were enabled");
+        for (int w = 0; w < 4; w++) {
+            for (int i = 0; i < 40; i++) {
+                ASSERT_EQ(reader.extractStr("writer_" + std::to_string(w) + "/item_" + std::to_string(i)),
+                          itemText(w, i));
+            }
+        }
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, SnapshotReaders) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string big(3 * 1024 * 1024, 'x');
+        for (size_t i = 0; i < big.size(); i += 7) big[i] = (char) ('a' + i % 23);
+
+        ZPack pack;
+        pack.setBlockSize(256 * 1024);
+        pack.setCompressionLevel(1);
+        pack.open(tempFileName.c_str(), true);
+        ASSERT_EQ(pack.snapshot(), nullptr);
+        pack.setSnapshots(true);
+
+        pack.packItem("first", "first version of the first item");
+        pack.packItem("big", big);
+        pack.publish();
+        auto first = pack.snapshot();
+        ASSERT_EQ(first->size(), 2u);
+
+        std::thread reader([first, &big] {
+            for (int i = 0; i < 5; i++) {
+                ASSERT_EQ(first->extractStr("big"), big);
+            }
+        });
+        pack.packItem("first", "second version of the first item");
+        pack.packItem("second", "second item");
+        pack.write();
+        reader.join();
+
+        auto second = pack.snapshot();
+        ASSERT_GT(second->generation(), first->generation());
+        ASSERT_EQ(first->extractStr("first"), "first version of the first item");
+        ASSERT_FALSE(first->contains("second"));
+        ASSERT_EQ(second->extractStr("first"), "second version of the first item");
+
+        pack.remove("big");
+        pack.repack();
+        ASSERT_EQ(first->extractStr("big"), big);
+        ASSERT_FALSE(pack.snapshot()->contains("big"));
+
+        auto external = zpack_snapshot::open(tempFileName);
+        ASSERT_NE(external, nullptr);
+        ASSERT_EQ(external->listNames(), std::vector<std::string>({"first", "second"}));
+        ASSERT_EQ(external->extractStr("second"), "second item");
+        pack.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, StreamWriter) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string big;
+        for (int i = 0; i < 40000; i++) big += "line " + std::to_string(i) + "\n";
+
+        // a string stream stands in for a pipe, the writer never seeks
+        std::ostringstream pipe;
+        zpack_stream_writer writer(pipe);
+        writer.setBlockSize(64 * 1024);
+        writer.setCompressionLevel(1);
+        ASSERT_TRUE(writer.packItem("small.txt", "small item", "docs"));
+        ASSERT_TRUE(writer.packItem("big.txt", big, "docs"));
+        std::istringstream source(big);
+        ASSERT_TRUE(writer.packStream(source, "stdin", 0));
+        writer.setCompressionMethod(ZPack::CompressNone);
+        ASSERT_TRUE(writer.packItem("stored.txt", big));
+        ASSERT_TRUE(writer.finish());
+        ASSERT_EQ(writer.bytesWritten(), pipe.str().size());
+
+        {
+            std::ofstream out(tempFileName, std::ios_base::binary);
+            out << pipe.str();
+        }
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        ASSERT_EQ(reader.listNames().size(), 4u);
+        ASSERT_EQ(reader.extractStr("docs/small.txt"), "small item");
+        ASSERT_EQ(reader.extractStr("docs/big.txt"), big);
+        ASSERT_EQ(reader.extractStr("stdin"), big);
+        ASSERT_EQ(reader.extractStr("stored.txt"), big);
+
+        // repack keeps the trailing descriptors with their items
+        reader.remove("docs/small.txt");
+        reader.repack();
+        ASSERT_EQ(reader.extractStr("stdin"), big);
+        ASSERT_EQ(reader.extractStr("stored.txt"), big);
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, ScanAndRebuild) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string big;
+        for (int i = 0; i < 40000; i++) big += "row " + std::to_string(i) + "\n";
+
+        ZPack pack;
+        pack.setBlockSize(64 * 1024);
+        pack.setCompressionLevel(1);
+        pack.setSolid(16 * 1024);
+        pack.open(tempFileName.c_str(), true);
+        for (int i = 0; i < 20; i++) {
+            pack.packItem("small_" + std::to_string(i), "small item number " + std::to_string(i));
+        }
+        pack.write();
+        pack.packItem("big", big);
+        pack.packItem("last", "the last item");
+        pack.write();
+        auto directoryOffset = pack.getStats().directoryOffset;
+        pack.close();
+
+        std::string archive;
+        {
+            std::ifstream in(tempFileName, std::ios_base::binary);
+            archive.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        // the forward scan sees a stream only, as if the archive was still arriving through a pipe
+        std::istringstream pipe(archive);
+        zpack_scanner scanner(pipe);
+        std::map<std::string, std::string> items;
+        while (scanner.next()) {
+            std::ostringstream out;
+            ASSERT_TRUE(scanner.extract(out)) << scanner.entry().filename;
+            items[scanner.entry().filename] = out.str();
+        }
+        ASSERT_TRUE(scanner.complete());
+        ASSERT_EQ(scanner.skippedBytes(), 0u);
+        ASSERT_EQ(items.size(), 22u);
+        ASSERT_EQ(items["big"], big);
+        ASSERT_EQ(items["small_7"], "small item number 7");
+
+        // cut the directory and part of the last item
+        fs::resize_file(tempFileName, directoryOffset - 5);
+
+        ZPack damaged;
+        damaged.open(tempFileName.c_str());
+        ASSERT_EQ(damaged.rebuildDirectory(), 21u);
+        damaged.write();
+        damaged.close();
+
+        ZPack rebuilt;
+        rebuilt.open(tempFileName.c_str());
+        ASSERT_EQ(rebuilt.error_code, ZPack::Errors::OK);
+        ASSERT_EQ(rebuilt.extractStr("big"), big);
+        ASSERT_EQ(rebuilt.extractStr("small_19"), "small item number 19");
+        ASSERT_FALSE(rebuilt.contains("last"));
+        rebuilt.close();
+
+        // items of a forward-only writer end with a descriptor found by the scan
+        std::ostringstream streamed;
+        zpack_stream_writer writer(streamed);
+        writer.setBlockSize(64 * 1024);
+        writer.setCompressionLevel(1);
+        writer.packItem("big", big);
+        writer.setCompressionMethod(ZPack::CompressNone);
+        writer.packItem("stored", big);
+        writer.finish();
+
+        std::istringstream streamedPipe(streamed.str());
+        zpack_scanner streamedScanner(streamedPipe);
+        size_t found = 0;
+        while (streamedScanner.next()) {
+            std::ostringstream out;
+            ASSERT_TRUE(streamedScanner.extract(out));
+            ASSERT_EQ(out.str(), big);
+            ASSERT_EQ(streamedScanner.entry().record.getUncompressedSize(), big.size());
+            found++;
+        }
+        ASSERT_EQ(found, 2u);
+        ASSERT_TRUE(streamedScanner.complete());
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, ScanGarbageSolidRecord) {
+        std::string tempFileName = tmpnam(NULL);
+
+        ZPack pack;
+        pack.setSolid(16 * 1024);
+        pack.open(tempFileName.c_str(), true);
+        for (int i = 0; i < 5; i++) {
+            pack.packItem("small_" + std::to_string(i), "small item number " + std::to_string(i));
+        }
+        pack.write();
+        pack.close();
+
+        // a solid block header claiming a terabyte in front of the archive: local header signature, solid flag
+        LocalFileHeaderRecord garbage{};
+        assignInt<uint>(0x0201534e, garbage.signature);
+        assignInt<usint>(4, garbage.general);
+        assignInt<usint>(ZPack::CompressZstd, garbage.compression);
+        assignInt<ullint>(1ULL << 40, garbage.compressedSize);
+        assignInt<ullint>(1ULL << 40, garbage.uncompressedSize);
+        std::string archive((const char *) &garbage, sizeof(garbage));
+        {
+            std::ifstream in(tempFileName, std::ios_base::binary);
+            archive.append(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+
+        std::istringstream pipe(archive);
+        zpack_scanner scanner(pipe);
+        size_t found = 0;
+        while (scanner.next()) {
+            std::ostringstream out;
+            ASSERT_TRUE(scanner.extract(out));
+            found++;
+        }
+        ASSERT_EQ(found, 5u);
+        ASSERT_TRUE(scanner.complete());
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, DirectIO) {
+        fs::path root = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(root);
+        std::string archive = (root / "archive.zpk").string();
+        std::string source = (root / "source.bin").string();
+
+        // sizes off the 4096 alignment on purpose, heads and tails take the unaligned path
+        std::string payload;
+        for (size_t i = 0; payload.size() < 300000 + 123; i++) {
+            payload += "direct line " + std::to_string(i * 7919 % 100003) + "\n";
+        }
+        {
+            std::ofstream sfile(source, std::ios_base::binary);
+            sfile << payload;
+        }
+
+        ZPack pack;
+        pack.setBlockSize(64 * 1024);
+        pack.setDirectIO(true);
+        pack.open(archive.c_str(), true);
+        ASSERT_TRUE(pack.packFile(source, "files"));
+        pack.packItem("small", "short item");
+        pack.setCompressionMethod(ZPack::CompressNone);
+        pack.packItem("stored", payload.substr(0, 150001));
+        pack.write();
+        ASSERT_EQ(pack.error_code, ZPack::Errors::OK);
+        pack.close();
+
+        ZPack reader;
+        reader.setDirectIO(true);
+        reader.open(archive.c_str());
+        ASSERT_EQ(reader.extractStr("files/source.bin"), payload);
+        ASSERT_EQ(reader.extractStr("stored"), payload.substr(0, 150001));
+
+        fs::path out = root / "out";
+        ASSERT_TRUE(reader.extractFile("files/source.bin", out.string() + "/"));
+        ASSERT_EQ(fs::file_size(out / "files/source.bin"), payload.size());
+        {
+            std::ifstream efile((out / "files/source.bin").string(), std::ios_base::binary);
+            std::string extracted((std::istreambuf_iterator<char>(efile)), std::istreambuf_iterator<char>());
+            ASSERT_EQ(extracted, payload);
+        }
+
+        reader.remove("small");
+        reader.repack();
+        ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+        ASSERT_EQ(reader.extractStr("stored"), payload.substr(0, 150001));
+        ASSERT_EQ(reader.extractStr("files/source.bin"), payload);
+        reader.close();
+
+        fs::remove_all(root);
+    }
+
+    TEST(General, SparseFiles) {
+        fs::path root = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(root);
+        std::string archive = (root / "archive.zpk").string();
+        std::string source = (root / "image.raw").string();
+
+        // data at the start and in the middle, a hole between and one up to the end
+        const ullint imageSize = 16 * 1024 * 1024;
+        std::string head(10000, 'h');
+        std::string middle(70000, 'm');
+        {
+            std::ofstream sfile(source, std::ios_base::binary);
+            sfile << head;
+            sfile.seekp(8 * 1024 * 1024);
+            sfile << middle;
+        }
+        fs::resize_file(source, imageSize);
+
+        ZPack pack;
+        pack.setBlockSize(256 * 1024);
+        pack.open(archive.c_str(), true);
+        ASSERT_TRUE(pack.packFile(source));
+        pack.write();
+        pack.close();
+
+        ZPack reader;
+        reader.open(archive.c_str());
+        std::string expected(imageSize, '\0');
+        expected.replace(0, head.size(), head);
+        expected.replace(8 * 1024 * 1024, middle.size(), middle);
+        ASSERT_EQ(reader.extractStr("image.raw"), expected);
+
+        fs::path out = root / "out";
+        ASSERT_TRUE(reader.extractFile("image.raw", out.string() + "/"));
+        std::string extractedPath = (out / "image.raw").string();
+        ASSERT_EQ(fs::file_size(extractedPath), imageSize);
+        {
+            std::ifstream efile(extractedPath, std::ios_base::binary);
+            std::string extracted((std::istreambuf_iterator<char>(efile)), std::istreambuf_iterator<char>());
+            ASSERT_TRUE(extracted == expected);
+        }
+
+        // only the data extents get blocks when the filesystem has holes at all
+        struct stat sourceStat{}, extractedStat{};
+        ASSERT_EQ(stat(source.c_str(), &sourceStat), 0);
+        ASSERT_EQ(stat(extractedPath.c_str(), &extractedStat), 0);
+        if ((ullint) sourceStat.st_blocks * 512 < imageSize) {
+            ASSERT_LT((ullint) extractedStat.st_blocks * 512, imageSize / 4);
+        }
+        reader.close();
+
+        fs::remove_all(root);
+    }
+
+    TEST(General, SparseFileManyHoles) {
+        fs::path root = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(root);
+        std::string archive = (root / "archive.zpk").string();
+        std::string source = (root / "scattered.raw").string();
+
+        // a byte every 8 KiB leaves more holes than the extra fields of one entry can map
+        const ullint imageSize = 10000ULL * 8192;
+        {
+            std::ofstream sfile(source, std::ios_base::binary);
+            for (ullint offset = 0; offset < imageSize; offset += 8192) {
+                sfile.seekp((std::streamoff) offset);
+                sfile.put('d');
+            }
+        }
+        fs::resize_file(source, imageSize);
+
+        ZPack pack;
+        pack.setCompressionLevel(1);
+        pack.open(archive.c_str(), true);
+        ASSERT_TRUE(pack.packItem("plain", "not sparse at all"));
+        ASSERT_TRUE(pack.packFile(source));
+        pack.write();
+        pack.close();
+
+        ZPack reader;
+        reader.open(archive.c_str());
+        ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+        ASSERT_EQ(reader.extractStr("plain"), "not sparse at all");
+
+        std::string expected(imageSize, '\0');
+        for (ullint offset = 0; offset < imageSize; offset += 8192) expected[offset] = 'd';
+        fs::path out = root / "out";
+        ASSERT_TRUE(reader.extractFile("scattered.raw", out.string() + "/"));
+        {
+            std::ifstream efile((out / "scattered.raw").string(), std::ios_base::binary);
+            std::string extracted((std::istreambuf_iterator<char>(efile)), std::istreambuf_iterator<char>());
+            ASSERT_TRUE(extracted == expected);
+        }
+        reader.close();
+
+        fs::remove_all(root);
+    }
+
+    TEST(General, SparseTargetStaleMap) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string content(3 * 4096, 'x');
+        std::fill(content.begin() + 8192, content.end(), '\0');
+
+        // the map claims the middle block is a hole, but it holds data by now
+        {
+            _SparseWriteBuf target(1024, {{4096, 8192}});
+            ASSERT_TRUE(target.open(tempFileName.c_str()));
+            std::ostream out(&target);
+            out.write(content.data(), (std::streamsize) content.size());
+            ASSERT_TRUE(out.good());
+            ASSERT_TRUE(target.close());
+        }
+
+        std::ifstream in(tempFileName, std::ios_base::binary);
+        std::string written((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        ASSERT_TRUE(written == content);
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, Verify) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string stored(5000, 's');
+        stored += "marker of the stored item";
+
+        ZPack pack;
+        pack.open(tempFileName.c_str(), true);
+        pack.packItem("compressed", std::string(100000, 'c'));
+        pack.setCompressionMethod(ZPack::CompressNone);
+        pack.packItem("stored", stored);
+        pack.write();
+        ASSERT_TRUE(pack.verify("compressed"));
+        ASSERT_TRUE(pack.verify("stored"));
+        ASSERT_FALSE(pack.verify("missing"));
+        pack.close();
+
+        {
+            std::fstream archive(tempFileName, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+            std::string content((std::istreambuf_iterator<char>(archive)), std::istreambuf_iterator<char>());
+            size_t pos = content.find("marker of the stored item");
+            ASSERT_NE(pos, std::string::npos);
+            archive.clear();
+            archive.seekp((std::streamoff) pos);
+            archive.put('M');
+        }
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        ASSERT_TRUE(reader.verify("compressed"));
+        ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+        ASSERT_FALSE(reader.verify("stored"));
+        ASSERT_EQ(reader.error_code, ZPack::Errors::ERR_EXTRACT_GENERAL);
+        ASSERT_EQ(reader.getMetrics()[ZPackOperation::EXTRACT].errors, 1u);
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, Recompress) {
+        std::string tempFileName = tmpnam(NULL);
+        auto itemText = [](int i) {
+            std::string res;
+            for (int line = 0; res.size() < 200000; line++) {
+                res += "item " + std::to_string(i) + " line " + std::to_string(line * 7919 % 65521) + " of ingest\n";
+            }
+            return res;
+        };
+
+        ZPack pack;
+        pack.setBlockSize(64 * 1024);
+        pack.open(tempFileName.c_str(), true);
+        pack.setCompressionLevel(1);
+        for (int i = 0; i < 6; i++) {
+            pack.packItem("hot/item_" + std::to_string(i), itemText(i));
+        }
+        pack.setCompressionLevel(19);
+        pack.packItem("cold/item", itemText(100));
+        pack.write();
+        ullint before = pack.subtreeStats("hot/").compressedSize;
+
+        ZPackRecompressPolicy policy;
+        policy.level = 19;
+        policy.belowLevel = 10;
+        policy.maxBytes = 1;
+
+        // one item fits the budget of a run, the rest is left for the next ones
+        zpack_recompressor job(pack, policy);
+        ASSERT_EQ(job.pending(), 6u);
+        ZPackRecompressResult first = job.run();
+        ASSERT_EQ(first.items + first.kept, 1u);
+        ASSERT_FALSE(first.finished);
+        ASSERT_EQ(job.pending(), 5u);
+
+        policy.maxBytes = 0;
+        zpack_recompressor rest(pack, policy);
+        ZPackRecompressResult second = rest.run();
+        ASSERT_TRUE(second.finished);
+        ASSERT_EQ(second.failed, 0u);
+        ASSERT_EQ(second.items + second.kept, 5u);
+        ASSERT_LE(second.compressedAfter, second.compressedBefore);
+        ASSERT_LE(pack.subtreeStats("hot/").compressedSize, before);
+        pack.close();
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        for (int i = 0; i < 6; i++) {
+            ASSERT_EQ(reader.extractStr("hot/item_" + std::to_string(i)), itemText(i));
+        }
+        ASSERT_EQ(reader.extractStr("cold/item"), itemText(100));
+        ASSERT_EQ(zpack_recompressor(reader, policy).pending(), 0u);
+        reader.repack();
+        ASSERT_EQ(reader.extractStr("hot/item_5"), itemText(5));
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, RecompressStoredOnce) {
+        std::string tempFileName = tmpnam(NULL);
+
+        ZPack pack;
+        pack.open(tempFileName.c_str(), true);
+        pack.setCompressionLevel(1);
+        // too small to compress, packed stored
+        pack.packItem("tiny", "abc");
+        pack.write();
+
+        ZPackRecompressPolicy policy;
+        policy.level = 19;
+        ZPackRecompressResult first = zpack_recompressor(pack, policy).run();
+        ASSERT_EQ(first.failed, 0u);
+        ullint size = fs::file_size(tempFileName);
+
+        zpack_recompressor again(pack, policy);
+        ASSERT_EQ(again.pending(), 0u);
+        again.run();
+        ASSERT_EQ(fs::file_size(tempFileName), size);
+        ASSERT_EQ(pack.extractStr("tiny"), "abc");
+        pack.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, RecompressReadableDuringRun) {
+        std::string tempFileName = tmpnam(NULL);
+        auto itemText = [](int i) {
+            std::string res;
+            for (int line = 0; res.size() < 50000; line++) {
+                res += "item " + std::to_string(i) + " line " + std::to_string(line * 7919 % 65521) + "\n";
+            }
+            return res;
+        };
+
+        // opens the archive from outside as every item of the run starts
+        class ArchiveProbe : public zpack_trace_listener {
+        public:
+            std::string archive;
+            int opened = 0;
+            int readable = 0;
+
+            void onEvent(ZPackTraceEvent const &event) override {
+                if (event.kind != ZPackTraceKind::PACK || event.phase != ZPackTracePhase::BEGIN) return;
+                opened++;
+                auto snapshot = zpack_snapshot::open(archive);
+                if (snapshot && snapshot->size() == 4 && !snapshot->extractStr("item_3").empty()) readable++;
+            }
+        };
+
+        ZPack pack;
+        pack.open(tempFileName.c_str(), true);
+        pack.setCompressionLevel(1);
+        for (int i = 0; i < 4; i++) {
+            pack.packItem("item_" + std::to_string(i), itemText(i));
+        }
+        pack.write();
+
+        ArchiveProbe probe;
+        probe.archive = tempFileName;
+        pack.setTraceListener(&probe);
+
+        ZPackRecompressPolicy policy;
+        policy.level = 19;
+        policy.dutyCycle = 0.5;
+        ZPackRecompressResult result = zpack_recompressor(pack, policy).run();
+        pack.setTraceListener(nullptr);
+        ASSERT_TRUE(result.finished);
+        ASSERT_EQ(result.items + result.kept, 4u);
+        ASSERT_EQ(probe.opened, 4);
+        ASSERT_EQ(probe.readable, 4);
+        pack.close();
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        for (int i = 0; i < 4; i++) {
+            ASSERT_EQ(reader.extractStr("item_" + std::to_string(i)), itemText(i));
+        }
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, CompressedDirectory) {
+        std::string plainName = tmpnam(NULL);
+        std::string compressedName = tmpnam(NULL);
+        auto itemName = [](int i) {
+            return "assets/textures/level_" + std::to_string(i / 50) + "/tile_" + std::to_string(i) + ".png";
+        };
+        auto fill = [&](ZPack &pack) {
+            for (int i = 0; i < 500; i++) {
+                pack.packItem(itemName(i), "tile " + std::to_string(i), "", "imported by build " + std::to_string(i / 100));
+            }
+            pack.write();
+            ZPackStats stats = pack.getStats();
+            return stats.lastOffset - stats.directoryOffset;
+        };
+
+        ZPack plain;
+        plain.open(plainName.c_str(), true);
+        ullint plainSize = fill(plain);
+        plain.close();
+
+        ZPack pack;
+        pack.open(compressedName.c_str(), true);
+        pack.setCompressedDirectory(true);
+        ullint compressedSize = fill(pack);
+        pack.close();
+        ASSERT_LT(compressedSize * 2, plainSize);
+
+        // the format is kept by an archive opened later
+        ZPack reader;
+        reader.open(compressedName.c_str());
+        ASSERT_EQ(reader.error_code, ZPack::Errors::OK);
+        ASSERT_EQ(reader.listNames("assets/").size(), 500u);
+        ASSERT_EQ(reader.extractStr(itemName(321)), "tile 321");
+        reader.remove(itemName(0));
+        reader.repack();
+        ASSERT_LE(reader.getStats().lastOffset - reader.getStats().directoryOffset, compressedSize);
+        reader.close();
+
+        auto snapshot = zpack_snapshot::open(compressedName);
+        ASSERT_NE(snapshot, nullptr);
+        ASSERT_EQ(snapshot->size(), 499u);
+        ASSERT_EQ(snapshot->extractStr(itemName(499)), "tile 499");
+        ASSERT_FALSE(snapshot->contains(itemName(0)));
+        snapshot.reset();
+
+        // switched back the next write is a classic directory
+        ZPack classic;
+        classic.open(compressedName.c_str());
+        classic.setCompressedDirectory(false);
+        classic.packItem(itemName(0), "tile 0", "", "imported by build 0");
+        classic.write();
+        ASSERT_EQ(classic.getStats().lastOffset - classic.getStats().directoryOffset, plainSize);
+        classic.close();
+
+        ZPack check;
+        check.open(compressedName.c_str());
+        ASSERT_EQ(check.listNames().size(), 500u);
+        ASSERT_EQ(check.extractStr(itemName(0)), "tile 0");
+        check.close();
+
+        remove(plainName.c_str());
+        remove(compressedName.c_str());
+    }
+
+    TEST(General, CompressedDirectoryDamagedSize) {
+        std::string tempFileName = tmpnam(NULL);
+
+        ZPack pack;
+        pack.open(tempFileName.c_str(), true);
+        pack.setCompressedDirectory(true);
+        pack.packItem("item", "payload");
+        pack.write();
+        ullint directoryOffset = pack.getStats().directoryOffset;
+        pack.close();
+
+        // a size claim far beyond what the few directory bytes can decode to
+        std::fstream file(tempFileName, std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+        uchar encodedSize[8];
+        assignInt<ullint>(1ULL << 33, encodedSize);
+        file.seekp((std::streamoff) (directoryOffset + sizeof(uint)));
+        file.write((const char *) encodedSize, sizeof(encodedSize));
+        file.close();
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        ASSERT_NE(reader.error_code, ZPack::Errors::OK);
+        ASSERT_FALSE(reader.contains("item"));
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, MemoryBudget) {
+        std::string tempFileName = tmpnam(NULL);
+        std::string data;
+        for (int line = 0; data.size() < 2 * 1024 * 1024; line++) {
+            data += "record " + std::to_string(line * 104729 % 999983) + " value " + std::to_string(line % 977) + "\n";
+        }
+        const ullint budget = 16 * 1024 * 1024;
+
+        ZPack unlimited;
+        unlimited.open(tempFileName.c_str(), true);
+        unlimited.setCompressionLevel(19);
+        unlimited.packItem("data", data);
+        unlimited.write();
+        ASSERT_GT(unlimited.getMemoryStats()[ZPackMemoryComponent::CODEC].peak, budget);
+        unlimited.close();
+
+        ZPack pack;
+        pack.setMemoryBudget(budget);
+        pack.open(tempFileName.c_str(), true);
+        pack.setCompressionLevel(19);
+        pack.setCompressionWorkers(4);
+        pack.packItem("data", data);
+        pack.write();
+        ASSERT_EQ(pack.extractStr("data"), data);
+
+        ZPackMemoryStats usage = pack.getMemoryStats();
+        ASSERT_EQ(usage.budget, budget);
+        ASSERT_GT(usage[ZPackMemoryComponent::CODEC].peak, 0u);
+        ASSERT_EQ(usage[ZPackMemoryComponent::CODEC].current, 0u);
+        ASSERT_GT(usage[ZPackMemoryComponent::BUFFERS].peak, 0u);
+        ASSERT_GT(usage[ZPackMemoryComponent::DIRECTORY].current, 0u);
+        ASSERT_LE(usage.total.peak, budget);
+
+        pack.resetMemoryPeaks();
+        usage = pack.getMemoryStats();
+        ASSERT_EQ(usage.total.peak, usage.total.current);
+        pack.close();
+
+        ZPack reader;
+        reader.open(tempFileName.c_str());
+        ASSERT_EQ(reader.extractStr("data"), data);
+        reader.close();
+
+        remove(tempFileName.c_str());
+    }
+
+    TEST(General, Volumes) {
+        fs::path root = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(root);
+        std::string manifest = (root / "archive.zpv").string();
+        auto itemText = [](int i) {
+            return std::string((size_t) (i + 1) * 100, (char) ('a' + i % 26));
+        };
+
+        ZPackVolumes volumes;
+        ASSERT_TRUE(volumes.create(manifest, {"archive.0.zpk", "archive.1.zpk", "archive.2.zpk"},
+                                   ZPackVolumes::Placement::SIZE));
+        for (int i = 0; i < 30; i++) {
+            ASSERT_TRUE(volumes.packItem("item_" + std::to_string(i), itemText(i), "data"));
+        }
+        volumes.write();
+        volumes.close();
+
+        ZPackVolumes reader;
+        ASSERT_TRUE(reader.open(manifest));
+        ASSERT_EQ(reader.volumesCount(), 3u);
+        ASSERT_EQ(reader.getStats().records, 30u);
+        for (uint i = 0; i < 3; i++) {
+            ASSERT_GT(reader.volume(i).subtreeStats("").uncompressedSize, 0u);
+        }
+
+        std::vector<std::string> names;
+        for (int i = 0; i < 30; i++) {
+            names.push_back("data/item_" + std::to_string(i));
+            ASSERT_EQ(reader.extractStr(names.back()), itemText(i));
+        }
+        ASSERT_EQ(reader.volumeOf("data/missing"), 3u);
+
+        fs::path out = root / "out";
+        fs::create_directories(out);
+        ASSERT_EQ(reader.extractFiles(names, out.string() + "/"), 30u);
+        ASSERT_EQ(fs::file_size(out / "data/item_29"), 3000u);
+
+        uint volume = reader.volumeOf("data/item_7");
+        ASSERT_TRUE(reader.remove("data/item_7"));
+        ASSERT_TRUE(reader.repackVolume(volume));
+        ASSERT_FALSE(reader.contains("data/item_7"));
+        ASSERT_EQ(reader.extractStr("data/item_8"), itemText(8));
+
+        // an emptied volume is the lightest one again
+        for (int i = 0; i < 30; i++) {
+            if (i != 7 && reader.volumeOf(names[i]) == volume) {
+                ASSERT_TRUE(reader.remove(names[i]));
+            }
+        }
+        for (int i = 0; i < 3; i++) {
+            ASSERT_TRUE(reader.packItem("refill_" + std::to_string(i), itemText(0), "data"));
+            ASSERT_EQ(reader.volumeOf("data/refill_" + std::to_string(i)), volume);
+        }
+        reader.close();
+
+        fs::remove_all(root);
+    }
+
+    TEST(General, VolumesSizeBooking) {
+        fs::path root = fs::temp_directory_path() / fs::unique_path();
+        fs::create_directories(root);
+        std::string manifest = (root / "archive.zpv").string();
+
+        ZPackVolumes volumes;
+        ASSERT_TRUE(volumes.create(manifest, {"archive.0.zpk", "archive.1.zpk"}, ZPackVolumes::Placement::SIZE));
+
+        // a failed pack books nothing, the volume stays the lightest one; opened on a directory it
+        // cannot write
+        volumes.volume(0).close();
+        volumes.volume(0).open(root.string().c_str());
+        ASSERT_FALSE(volumes.packItem("lost", std::string(5000, 'l')));
+        volumes.volume(0).open((root / "archive.0.zpk").string().c_str());
+        ASSERT_TRUE(volumes.packItem("a", std::string(3000, 'a')));
+        ASSERT_EQ(volumes.volumeOf("a"), 0u);
+        ASSERT_TRUE(volumes.packItem("b", std::string(1000, 'b')));
+        ASSERT_EQ(volumes.volumeOf("b"), 1u);
+
+        // a replaced item counts with its new size
+        ASSERT_TRUE(volumes.packItem("a", std::string(100, 'a')));
+        ASSERT_EQ(volumes.volumeOf("a"), 0u);
+        ASSERT_TRUE(volumes.packItem("c", std::string(10, 'c')));
+        ASSERT_EQ(volumes.volumeOf("c"), 0u);
+        volumes.close();
+
+        fs::remove_all(root);
+    }
+}
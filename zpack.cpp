@@ -1,29 +1,240 @@
 #include <chrono>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+#include <thread>
+#include <fnmatch.h>
 #include "zpack.h"
+#include "zpack_scanner.h"
+#include "zpack_snapshot.h"
+#include "_direct_io.h"
+#include "_directory_codec.h"
+#include "_io_hints.h"
+#include "_positional_io.h"
+#include "_sparse_io.h"
+#include "_pipeline.h"
 #include "_cfg.h"
 
+ZPack::ZPack() {
+    bufferPool.setMemory(&memory);
+}
+
 ZPack::~ZPack() {
     close();
     list.clear();
+    solidCache.clear();
 }
 
 ZPackStats ZPack::getStats() {
     return stats;
 }
 
+void ZPack::setTraceListener(zpack_trace_listener *listener) {
+    tracer = listener;
+}
+
+ZPackMetrics ZPack::getMetrics() const {
+    return metrics.snapshot();
+}
+
+void ZPack::resetMetrics() {
+    metrics.reset();
+}
+
+void ZPack::setCompressionLevel(short int level) {
+    compressionLevel = level;
+    compressionLevelSet = true;
+    applyMemoryBudget();
+}
+
+bool ZPack::setCompressionMethod(Compression method) {
+    if (method != CompressNone && !zpack_codec_registry::has(method)) {
+        error_code = Errors::ERR_UNKNOWN_COMPRESSION;
+        return false;
+    }
+
+    compressionMethod = method;
+    applyMemoryBudget();
+    return true;
+}
+
+void ZPack::setCompressionWorkers(uint workers, uint jobSize, int overlapLog) {
+    configured.workers = workers;
+    compressionJobSize = jobSize;
+    compressionOverlapLog = overlapLog;
+    applyMemoryBudget();
+}
+
+void ZPack::setChecksum(ZPackChecksum type) {
+    checksumType = type;
+}
+
+zpack_buffer_pool &ZPack::getBufferPool() {
+    return bufferPool;
+}
+
+void ZPack::setSolid(uint blockSize, uint itemSizeMax) {
+    if (blockSize > blockSizeMax) blockSize = blockSizeMax;
+    solidBlockSize = blockSize;
+    solidItemMax = itemSizeMax > 0 ? std::min(itemSizeMax, blockSize) : blockSize / 4;
+    applyMemoryBudget();
+}
+
+void ZPack::setSolidCacheBlocks(uint blocks) {
+    configured.solidCacheBlocks = blocks > 0 ? blocks : 1;
+    applyMemoryBudget();
+}
+
+void ZPack::setPipelineDepth(uint depth) {
+    configured.pipelineDepth = depth;
+    applyMemoryBudget();
+}
+
+void ZPack::setDirectIO(bool enable) {
+    directIO = enable;
+    pioClose(directFd);
+    if (enable && file.is_open()) {
+        directFd = directOpen(archive_name.c_str(), false);
+    }
+}
+
+void ZPack::setCompressedDirectory(bool enable) {
+    compressedDirectory = enable;
+}
+
+void ZPack::setBlockSize(uint size) {
+    configured.blockSize = size > 0 ? size : blockSizeMax;
+    applyMemoryBudget();
+}
+
+void ZPack::setMemoryBudget(ullint bytes) {
+    if (bytes != 0 && memoryBudget == 0) {
+        poolCachedConfigured = bufferPool.getMaxCachedBytes();
+    } else if (bytes == 0 && memoryBudget != 0) {
+        bufferPool.setMaxCachedBytes(poolCachedConfigured);
+    }
+    memoryBudget = bytes;
+    accountDirectory();
+    applyMemoryBudget();
+}
+
+ZPackMemoryStats ZPack::getMemoryStats() {
+    accountDirectory();
+    ZPackMemoryStats res = memory.snapshot();
+    res.budget = memoryBudget;
+    return res;
+}
+
+void ZPack::resetMemoryPeaks() {
+    memory.resetPeaks();
+}
+
+void ZPack::applyMemoryBudget() {
+    blockSizeBytes = configured.blockSize;
+    pipelineDepth = configured.pipelineDepth;
+    compressionWorkers = configured.workers;
+    solidCacheBlocks = configured.solidCacheBlocks;
+    compressionWindowLog = 0;
+
+    if (memoryBudget != 0) {
+        ullint fixed = memory.held(ZPackMemoryComponent::DIRECTORY) + fileBufferSize;
+        ullint left = memoryBudget > fixed ? memoryBudget - fixed : 0;
+        ullint codecShare = left / 2;
+        ullint bufferShare = left - codecShare;
+
+        // the window goes down to 1MB first, then worker threads, then the window again
+        Compression method = compressionMethod;
+        auto codec = createCompression(method);
+        if (codec) {
+            const int windowLogMax = 27;
+            int log = windowLogMax;
+            codec->setWindowLog(log);
+            while (log > 20 && codec->getContextSize() > codecShare) codec->setWindowLog(--log);
+            while (compressionWorkers > 0 && codec->getContextSize() > codecShare) {
+                codec->setWorkers(--compressionWorkers, compressionJobSize, compressionOverlapLog);
+            }
+            while (log > 10 && codec->getContextSize() > codecShare) codec->setWindowLog(--log);
+            if (log < windowLogMax) compressionWindowLog = log;
+        }
+
+        // a quarter at most stays cached in the pool, solid blocks and items in flight share the rest
+        size_t poolCached = std::min<ullint>(poolCachedConfigured, bufferShare / 4);
+        bufferPool.setMaxCachedBytes(poolCached);
+        ullint rest = bufferShare - poolCached;
+        if (solidBlockSize > 0) {
+            ullint cacheBlocks = rest / 4 / solidBlockSize;
+            if (cacheBlocks < solidCacheBlocks) solidCacheBlocks = cacheBlocks > 0 ? (uint) cacheBlocks : 1;
+            // the cache and the block being collected
+            ullint solidBytes = (ullint) (solidCacheBlocks + 1) * solidBlockSize;
+            rest = rest > solidBytes ? rest - solidBytes : 0;
+        }
+
+        // every block in flight is held as input and as codec output, the pipeline queues two stages
+        // of them and has one in each of its three threads
+        uint block = std::min(blockSizeBytes, blockSizeMax);
+        auto inFlight = [this](uint size) {
+            return (ullint) size * 2 * (pipelineDepth > 1 ? 2 * pipelineDepth + 3 : 1);
+        };
+        while (inFlight(block) > rest) {
+            if (block > 1024 * 1024) block /= 2;
+            else if (pipelineDepth > 1) pipelineDepth--;
+            else if (block > 64 * 1024) block /= 2;
+            else break;
+        }
+        blockSizeBytes = block;
+    }
+
+    while (solidCache.size() > solidCacheBlocks) {
+        solidCache.pop_back();
+    }
+}
+
+void ZPack::accountDirectory() {
+    typedef std::unordered_map<std::string, DirectoryFileQueue>::value_type node;
+    // strings short enough for the inline buffer have no allocation of their own
+    auto heap = [](std::string const &s) -> ullint {
+        return s.capacity() >= sizeof(std::string) ? s.capacity() + 1 : 0;
+    };
+
+    std::lock_guard<std::mutex> guard(directoryLock);
+    ullint bytes = list.bucket_count() * sizeof(void *) + nameIndex.capacity() * sizeof(const std::string *);
+    for (auto const &item : list) {
+        // the node carries a next pointer and the cached hash next to the value
+        bytes += sizeof(node) + 2 * sizeof(void *) + heap(item.first) + heap(item.second.filename) +
+                 heap(item.second.comment) + item.second.extra.capacity() * sizeof(LocalFileExtraField);
+    }
+    memory.assign(ZPackMemoryComponent::DIRECTORY, bytes);
+}
+
 void ZPack::write() {
     if (!file.is_open())
         return;
 
+    zpack_metrics_scope m(metrics, ZPackOperation::WRITE);
+
+    if (!flushSolid()) {
+        m.failed = true;
+        return;
+    }
+
     ullint offset_diff = writeDirectory(file);
+    if (offset_diff == directoryRefused) {
+        m.failed = true;
+        return;
+    }
     file.flush();
+    m.io();
+    m.bytesOut = stats.lastOffset - stats.directoryOffset;
+    m.failed = file.fail();
     if (offset_diff > 0) {
         file.close();
         file.clear();
 
         fs::resize_file(archive_name, offset_diff);
         open(archive_name.c_str());
+    } else {
+        publishSnapshot();
     }
 }
 
@@ -32,6 +243,12 @@ void ZPack::close() {
         file.close();
         file.clear();
     }
+    writeCursor = noWriteCursor;
+
+    ioHintClose(hintFd);
+    pioClose(writeFd);
+    pioClose(directFd);
+    std::atomic_store(&published, std::shared_ptr<const zpack_snapshot>());
 }
 
 void ZPack::clear() {
@@ -40,14 +257,29 @@ void ZPack::clear() {
 
 std::unique_ptr<zpack_compression> ZPack::createCompression(Compression &method) {
     std::unique_ptr<zpack_compression> ar_ptr = nullptr;
-    if (method == CompressZstd || method == CompressZstdStream) {
-        ar_ptr = std::unique_ptr<zpack_compression>(new zpack_zstd());
+    if (method != CompressNone) {
+        ar_ptr = zpack_codec_registry::create(method);
+    }
+
+    if (ar_ptr) {
+        if (compressionLevelSet) ar_ptr->setCompressionLevel(compressionLevel);
+        ar_ptr->setBufferPool(&bufferPool);
+        ar_ptr->setWorkers(compressionWorkers, compressionJobSize, compressionOverlapLog);
+        ar_ptr->setWindowLog(compressionWindowLog);
+        ar_ptr->setMemory(&memory);
     }
 
     return ar_ptr;
 }
 
+short int ZPack::codecLevel(Compression method) {
+    auto codec = createCompression(method);
+    return codec ? codec->getCompressionLevel() : compressionLevel;
+}
+
 ZPack *ZPack::open(const char *filename_to_open, bool trunicate) {
+    zpack_metrics_scope m(metrics, ZPackOperation::OPEN);
+
     archive_name = filename_to_open;
     auto flags = std::ios_base::binary | std::ios_base::in | std::ios_base::out | std::ios_base::ate;
     if (trunicate) {
@@ -56,6 +288,17 @@ ZPack *ZPack::open(const char *filename_to_open, bool trunicate) {
 
     rootPath = fs::path(archive_name).remove_filename();
 
+    solidPending.clear();
+    solidPendingNames.clear();
+    solidCache.clear();
+
+    if (!fileBuffer) {
+        fileBuffer.reset(new char[fileBufferSize]);
+        memory.hold(ZPackMemoryComponent::BUFFERS, fileBufferSize);
+    }
+    file.rdbuf()->pubsetbuf(fileBuffer.get(), fileBufferSize);
+    writeCursor = noWriteCursor;
+
     file.open(archive_name, flags);
     if (!file.is_open()) {
         file.clear();
@@ -69,6 +312,12 @@ ZPack *ZPack::open(const char *filename_to_open, bool trunicate) {
         std::cerr << "ZPack::open failed: " << errno << " msg: " << strerror(errno) << std::endl;
     }
 
+    // separate descriptor used only for page cache hints, fstream does not expose its own
+    ioHintClose(hintFd);
+    if (file.is_open()) {
+        hintFd = ioHintOpen(archive_name.c_str());
+    }
+
     #if ZPACK_DEBUG
     std::cout << std::endl << "Opening archive with" << std::endl
               << "dirOffset: " << dir_end.getRecordOffset() << std::endl
@@ -93,14 +342,33 @@ ZPack *ZPack::open(const char *filename_to_open, bool trunicate) {
             if (rd > 0) {
                 std::cerr << "Reading directory failed: " << std::endl
                           << "error:    " << rd << std::endl << std::endl;
+                m.failed = true;
             }
+            m.bytesIn = dir_end.getRecordSize() + sizeof(EndOfDirectoryRecord);
         }
     }
 
+    pioClose(directFd);
+    if (directIO && file.is_open()) {
+        directFd = directOpen(archive_name.c_str(), false);
+    }
+
+    pioClose(writeFd);
+    if (concurrentWriters && file.is_open()) {
+        writeFd = pioOpen(archive_name.c_str(), true);
+    }
+    appendOffset = dir_end.getRecordOffset();
+
+    publishSnapshot();
+
+    m.io();
+    if (file.fail()) m.failed = true;
+
     return this;
 }
 
 usint ZPack::readDirectory() {
+    writeCursor = noWriteCursor;
     file.seekg(-sizeof(EndOfDirectoryRecord), std::ios_base::end);
     dir_end.read(file);
     if ((int) sizeof(EndOfDirectoryRecord) > file.gcount()) {
@@ -122,11 +390,14 @@ usint ZPack::readDirectory() {
         << "commentLen: " << dir_end.getCommentLen() << std::endl << std::endl;
     #endif
 
-    if (dir_end.getSignature() != DirectoryRecord) {
+    bool compressed = dir_end.getSignature() == CompressedDirectoryRecord;
+    if (dir_end.getSignature() != DirectoryRecord && !compressed) {
         dir_end = {};
         error_code = Errors::ERR_DIRECTORY_END_SIGNATURE;
         return 1;
     }
+    // an archive keeps the directory format it was opened with
+    compressedDirectory = compressed;
 
     file.clear();
 
@@ -134,98 +405,219 @@ usint ZPack::readDirectory() {
         return 0;
 
     list.clear();
-    file.seekg(dir_end.getRecordOffset());
+    nameIndexDirty = true;
+    ioHint(hintFd, dir_end.getRecordOffset(), dir_end.getRecordSize(), IoHint::WILLNEED);
+    zpack_trace_span dirSpan(tracer, ZPackTraceKind::DIRECTORY_READ, nullptr, dir_end.getRecordOffset(),
+                             dir_end.getRecordSize());
+    seekRead(dir_end.getRecordOffset());
 
     if (!file) {
         error_code = Errors::ERR_OPENING_ARCHIVE_FILE;
         return 1;
     }
 
-    for (uint i = 0; i < dir_end.getRecordsNumber(); i++) {
-        DirectoryFileHeaderRecord dfq{};
-        dfq.read(file);
-        if (file.gcount() != sizeof(dfq)) {
+    std::vector<uchar> blob(dir_end.getRecordSize());
+    file.read((char *) blob.data(), (std::streamsize) blob.size());
+    if ((size_t) file.gcount() != blob.size()) {
+        error_code = Errors::ERR_READ_ENTRY_HEADER;
+        return 1;
+    }
+    if (compressed) {
+        std::vector<uchar> packed;
+        packed.swap(blob);
+        if (!unpackDirectory(packed.data(), packed.size(), blob)) {
             error_code = Errors::ERR_READ_ENTRY_HEADER;
             return 1;
         }
+    }
 
-        auto filenameLen = dfq.getFilenameLen();
-        std::string filename;
-        if (filenameLen > 0) {
-            char *sbuf = new char[filenameLen + 1]();
-            file.read(sbuf, (int) filenameLen);
-            filename.reserve(filenameLen);
-            filename = sbuf;
-            delete[] sbuf;
-            if (file.gcount() != filenameLen) {
-                error_code = Errors::ERR_READ_ENTRY_NAME;
-                return 1;
-            }
+    list.reserve(directoryEntriesHint(dir_end, blob.size()));
+    auto decoded = decodeDirectory(blob.data(), blob.size(), list);
+    if (decoded != Errors::OK) {
+        list.clear();
+        error_code = decoded;
+        return 1;
+    }
+
+    ullint dirConsumed = blob.size();
+    dirSpan.end(dirConsumed);
+
+    accountDirectory();
+    if (memoryBudget != 0) applyMemoryBudget();
+
+    file.seekg(0);
+    file.seekp(dir_end.getRecordOffset());
+    writeCursor = dir_end.getRecordOffset();
+    return 0;
+}
+
+// checks every record of a directory blob fits and hands it to fn with the positions of its parts
+template<typename F>
+static ZPack::Errors walkDirectory(const uchar *blob, size_t size, F fn) {
+    const size_t recordSize = sizeof(DirectoryFileHeaderRecord);
+
+    size_t pos = 0;
+    while (pos < size) {
+        if (size - pos < recordSize) {
+            return ZPack::Errors::ERR_READ_ENTRY_HEADER;
         }
 
-        auto extraLen = dfq.getExtraLen();
-        usint extraEntries = extraLen / sizeof(LocalFileExtraField);
-        std::vector<LocalFileExtraField> extraItems;
-        for (uint ex = 0; ex < extraEntries; ex++) {
-            LocalFileExtraField lfef{};
-            lfef.read(file);
-            if (file.gcount() != sizeof(lfef)) {
-                error_code = Errors::ERR_READ_ENTRY_EXTRA;
-                return 1;
-            }
+        size_t recordPos = pos;
+        auto record = (const DirectoryFileHeaderRecord *) (blob + pos);
+        usint filenameLen = record->getFilenameLen();
+        usint extraLen = record->getExtraLen();
+        usint commentLen = record->getCommentLen();
+        pos += recordSize;
 
-            extraItems.push_back(lfef);
+        if (size - pos < filenameLen) {
+            return ZPack::Errors::ERR_READ_ENTRY_NAME;
         }
+        size_t namePos = pos;
+        pos += filenameLen;
 
-        std::string comment;
-        auto commentLen = dfq.getCommentLen();
-        if (commentLen > 0) {
-            char *sbuf = new char[commentLen + 1]();
-            file.read(sbuf, commentLen);
-            comment.reserve(commentLen);
-            comment = sbuf;
-            delete[] sbuf;
-            if (file.gcount() != commentLen) {
-                error_code = Errors::ERR_READ_ENTRY_COMMENT;
-                return 1;
-            }
+        if (size - pos < extraLen) {
+            return ZPack::Errors::ERR_READ_ENTRY_EXTRA;
         }
+        size_t extraPos = pos;
+        pos += extraLen;
 
-        #if ZPACK_DEBUG
-        std::cout << "Read dir entry header: " << std::hex << std::endl
-                  << "signature:        " << dfq.getSignature() << std::endl << std::dec
-                  << "filename:         " << filename << std::endl
-                  << "filenameReal:     " << filename.size() << std::endl
-                  << "filenameLen:      " << dfq.getFilenameLen() << std::endl
-                  << "lastRead:         " << file.gcount() << std::endl
-                  << "versionBy:        " << dfq.getVersionBy() << std::endl
-                  << "versionMin:       " << dfq.getVersionMin() << std::endl
-                  << "general:          " << dfq.getGeneral() << std::endl
-                  << "compressMethod:   " << dfq.getCompressMethod() << std::endl
-                  << "mtime:            " << dfq.getMtime() << std::endl
-                  << "compressedSize:   " << dfq.getCompressedSize() << std::endl
-                  << "uncompressedSize: " << dfq.getUncompressedSize() << std::endl
-                  << "offsetFile:       " << dfq.getOffsetFile() << std::endl
-                  << "offsetRecord:     " << dfq.getOffsetRecord() << std::endl
-                  << "crc32:            " << dfq.getCrc32() << std::endl
-                  << "commentLen:       " << dfq.getCommentLen() << std::endl
-                  << "comment:          " << comment << std::endl << std::endl;
-        #endif
+        if (size - pos < commentLen) {
+            return ZPack::Errors::ERR_READ_ENTRY_COMMENT;
+        }
+        fn(recordPos, namePos, extraPos, pos);
+        pos += commentLen;
+    }
 
-        list.insert({
-                        filename,
-                        DirectoryFileQueue{
-                            dfq,
-                            extraItems,
-                            filename,
-                            comment
-                        }
-                    });
+    return ZPack::Errors::OK;
+}
+
+ZPack::Errors ZPack::decodeDirectory(const uchar *blob, size_t size,
+                                     std::unordered_map<std::string, DirectoryFileQueue> &entries) {
+    return walkDirectory(blob, size, [&](size_t recordPos, size_t namePos, size_t extraPos, size_t commentPos) {
+        auto record = (const DirectoryFileHeaderRecord *) (blob + recordPos);
+        std::string name((const char *) blob + namePos, record->getFilenameLen());
+        auto added = entries.emplace(name, DirectoryFileQueue());
+        // the first of duplicated names wins
+        if (!added.second) return;
+
+        DirectoryFileQueue &entry = added.first->second;
+        std::memcpy(&entry.record, record, sizeof(DirectoryFileHeaderRecord));
+        entry.filename = std::move(name);
+        entry.extra.resize(record->getExtraLen() / sizeof(LocalFileExtraField));
+        if (!entry.extra.empty()) {
+            std::memcpy(entry.extra.data(), blob + extraPos, entry.extra.size() * sizeof(LocalFileExtraField));
+        }
+        entry.comment.assign((const char *) blob + commentPos, record->getCommentLen());
+    });
+}
+
+size_t ZPack::directoryEntriesHint(EndOfDirectoryRecord &dirEnd, size_t blobSize) {
+    // the record count saturates at 0xFFFF, bigger directories are estimated from their size
+    if (dirEnd.getRecordsNumber() < 0xFFFF) return dirEnd.getRecordsNumber();
+    return blobSize / (sizeof(DirectoryFileHeaderRecord) + 16);
+}
+
+void ZPack::seekWrite(ullint offset) {
+    if (writeCursor != offset) {
+        file.seekp(offset);
+        writeCursor = offset;
     }
+}
 
-    file.seekg(0);
-    file.seekp(dir_end.getRecordOffset());
-    return 0;
+size_t ZPack::readArchive(char *dest, size_t size, ullint offset) {
+    if (directFd >= 0) {
+        if (!directBounce) directBounce.reset(new _AlignedBuffer());
+        long long got = directReadAt(directFd, dest, size, offset, *directBounce);
+        return got > 0 ? (size_t) got : 0;
+    }
+
+    file.read(dest, (std::streamsize) size);
+    return (size_t) file.gcount();
+}
+
+void ZPack::seekRead(ullint offset) {
+    // get and put positions of a filebuf are shared, reading moves the cursor away
+    writeCursor = noWriteCursor;
+    file.seekg(offset);
+}
+
+size_t ZPack::fillLocalHeader(char *dest, LocalFileHeaderRecord const &header, std::string const &name,
+                              std::vector<LocalFileExtraField> const &extra) {
+    char *pos = dest;
+    std::memcpy(pos, &header, sizeof(header));
+    pos += sizeof(header);
+    std::memcpy(pos, name.data(), name.size());
+    pos += name.size();
+    if (!extra.empty()) {
+        std::memcpy(pos, extra.data(), extra.size() * sizeof(LocalFileExtraField));
+        pos += extra.size() * sizeof(LocalFileExtraField);
+    }
+
+    return (size_t) (pos - dest);
+}
+
+void ZPack::writeLocalHeader(LocalFileHeaderRecord const &header, std::string const &name,
+                             std::vector<LocalFileExtraField> const &extra) {
+    size_t headSize = sizeof(header) + name.size() + extra.size() * sizeof(LocalFileExtraField);
+    zpack_buffer head = bufferPool.acquire(headSize);
+    fillLocalHeader(head.data(), header, name, extra);
+
+    file.write(head.data(), (std::streamsize) headSize);
+    writeCursor += headSize;
+}
+
+LocalFileHeaderRecord ZPack::localHeader(std::string const &name, LocalFileExtraField &extra, fs::perms perms,
+                                         llint modificationTime, ZPackChecksum checksum) {
+    extra = LocalFileExtraField{};
+    assignInt<usint>(Permissions, extra.id);
+    assignInt<usint>(perms, extra.value);
+
+    LocalFileHeaderRecord header{};
+    assignInt<uint>(LocalHeader, header.signature);
+    assignInt<usint>(version, header.version);
+    assignInt<usint>(checksum == ZPackChecksum::XXHASH64 ? ChecksumXXH64 : 0, header.general);
+    assignInt<llint>(modificationTime, header.mtime);
+    assignInt<usint>((usint) name.size(), header.filenameLen);
+    assignInt<usint>(sizeof(extra), header.extraLen);
+
+    return header;
+}
+
+void ZPack::sealLocalHeader(LocalFileHeaderRecord &header, usint flags, Compression method, uint crc,
+                            ullint compressedSize, ullint uncompressedSize) {
+    assignInt<usint>(header.getGeneral() | flags, header.general);
+    assignInt<usint>(method, header.compression);
+    assignInt<uint>(crc, header.crc32);
+    assignInt<ullint>(compressedSize, header.compressedSize);
+    assignInt<ullint>(uncompressedSize, header.uncompressedSize);
+}
+
+size_t ZPack::packRecord(zpack_buffer &record, LocalFileHeaderRecord &header, std::string const &name,
+                         LocalFileExtraField const &extra, const char *block, size_t size, Compression &method,
+                         codec_factory const &codec, zpack_checksum &checksum, zpack_buffer_pool &pool) {
+    size_t headSize = sizeof(header) + name.size() + sizeof(extra);
+    if (size <= 80) {
+        method = CompressNone;
+    }
+
+    ullint payloadSize = size;
+    std::unique_ptr<zpack_compression> ar = method != CompressNone ? codec(method) : nullptr;
+    if (ar) {
+        // compressed straight behind the header, the record leaves in a single write
+        ullint bound = ar->getCompressedSize(size);
+        record = pool.acquire(headSize + bound);
+        payloadSize = ar->compressBlock(block, size, record.data() + headSize, bound);
+    } else {
+        method = CompressNone;
+        record = pool.acquire(headSize + size);
+        std::memcpy(record.data() + headSize, block, size);
+    }
+    checksum.process_bytes(block, size);
+
+    sealLocalHeader(header, 0, method, checksum.checksum(), payloadSize, size);
+    fillLocalHeader(record.data(), header, name, {extra});
+
+    return headSize + (size_t) payloadSize;
 }
 
 bool ZPack::packFile(std::string const &filename, std::string const &directory, const std::string &comment) {
@@ -237,29 +629,97 @@ bool ZPack::packFile(std::string const &filename, std::string const &directory,
     std::string itemname =
         directory + (directory.back() != '/' && !directory.empty() ? "/" : "") + path.filename().string();
 
-    #if ZPACK_DEBUG
-    std::cout << "Dirs variants: " << std::endl
-              << "buf size max  : " << blockSizeMax << std::endl
-              << "orig file     : " << filename << std::endl
-              << "root path     : " << rootPath.string() << std::endl
-              << "bst path      : " << path.string() << std::endl
-              << "bst path2     : " << itemname << std::endl << std::endl;
-    #endif
-
-    std::ifstream sfile(filename, std::ios_base::binary | std::ios_base::in);
-    if (!sfile.is_open()) {
-        error_code = Errors::ERR_PACK_FILE_OPEN;
-        return false;
+    size_t sourceBufSize = blockSizeBytes > blockSizeMax ? blockSizeMax : blockSizeBytes;
+    std::vector<_SparseHole> holes = sparseHoles(filename.c_str(), fsize);
+    std::unique_ptr<std::streambuf> source;
+    if (!holes.empty()) {
+        auto sparseSource = new _SparseReadBuf(sourceBufSize, holes, fsize);
+        source.reset(sparseSource);
+        if (!sparseSource->open(filename.c_str(), directIO)) source.reset();
+    }
+    if (!source && directIO) {
+        auto directSource = new _DirectReadBuf(sourceBufSize);
+        source.reset(directSource);
+        if (!directSource->open(filename.c_str())) source.reset();
+    }
+    std::istream sourceStream(source.get());
+
+    std::ifstream sfile;
+    if (!source) {
+        sfile.open(filename, std::ios_base::binary | std::ios_base::in);
+        if (!sfile.is_open()) {
+            packError(Errors::ERR_PACK_FILE_OPEN);
+            return false;
+        }
     }
 
-    return this->packData(
-        sfile,
+    bool packed = this->packData(
+        source ? sourceStream : (std::istream &) sfile,
         itemname,
         perms,
         fsize,
         mtime,
-        comment
+        comment,
+        compressionMethod
     );
+
+    if (packed && !holes.empty()) {
+        recordSparseHoles(itemname, holes);
+    }
+
+    return packed;
+}
+
+bool ZPack::replaceExtra(DirectoryFileQueue &entry, usint id, std::string const &bytes) {
+    if ((bytes.size() + 1) / 2 * 2 > extraCapacity(entry, id)) return false;
+
+    std::vector<LocalFileExtraField> &extra = entry.extra;
+    extra.erase(std::remove_if(extra.begin(), extra.end(), [id](LocalFileExtraField const &field) {
+        return field.getId() == id;
+    }), extra.end());
+
+    for (size_t i = 0; i < bytes.size(); i += 2) {
+        LocalFileExtraField field{};
+        assignInt<usint>(id, field.id);
+        field.value[0] = (uchar) bytes[i];
+        field.value[1] = i + 1 < bytes.size() ? (uchar) bytes[i + 1] : 0;
+        extra.push_back(field);
+    }
+    assignInt<usint>((usint) (extra.size() * sizeof(LocalFileExtraField)), entry.record.extraLen);
+
+    return true;
+}
+
+size_t ZPack::extraCapacity(DirectoryFileQueue const &entry, usint id) {
+    size_t others = (size_t) std::count_if(entry.extra.begin(), entry.extra.end(), [id](LocalFileExtraField const &field) {
+        return field.getId() != id;
+    });
+
+    return (0xFFFF - others * sizeof(LocalFileExtraField)) / sizeof(LocalFileExtraField) * 2;
+}
+
+std::string ZPack::extraBytes(DirectoryFileQueue const &entry, usint id) {
+    std::string res;
+    for (LocalFileExtraField const &field : entry.extra) {
+        if (field.getId() == id) {
+            res.push_back((char) field.value[0]);
+            res.push_back((char) field.value[1]);
+        }
+    }
+    return res;
+}
+
+void ZPack::recordSparseHoles(std::string const &itemname, std::vector<_SparseHole> const &holes) {
+    std::lock_guard<std::mutex> guard(directoryLock);
+    auto item = list.find(itemname);
+    if (item == list.end()) return;
+
+    // extraLen is 16 bits wide and every field carries two map bytes, dropped holes stay in the payload as zeros
+    replaceExtra(item->second, SparseHoles, encodeSparseHoles(holes, extraCapacity(item->second, SparseHoles)));
+}
+
+std::vector<_SparseHole> ZPack::sparseHolesOf(DirectoryFileQueue const &sitem) {
+    return decodeSparseHoles(extraBytes(sitem, SparseHoles));
 }
 
 bool ZPack::packItem(std::string const &itemname, std::string const &data, std::string const &directory,
@@ -275,7 +735,7 @@ bool ZPack::packItem(std::string const &itemname, std::string const &data, std::
     std::string itemname_normalized = directory + (directory.back() != '/' && !directory.empty() ? "/" : "") + itemname;
 
     if (dataSize == 0) {
-        error_code = Errors::ERR_PACK_ITEM_SIZE;
+        packError(Errors::ERR_PACK_ITEM_SIZE);
         return false;
     }
 
@@ -285,10 +745,17 @@ bool ZPack::packItem(std::string const &itemname, std::string const &data, std::
         perms,
         dataSize,
         mtime,
-        comment
+        comment,
+        compressionMethod
     );
 }
 
+// CompressionLevel extra, two's complement since zstd fast levels are negative
+static std::string levelExtra(short int level) {
+    auto value = (usint) level;
+    return std::string{(char) (value & 0xff), (char) (value >> 8)};
+}
+
 bool ZPack::packData(
     std::istream &stream,
     std::string const &itemname,
@@ -298,6 +765,12 @@ bool ZPack::packData(
     const std::string &comment,
     Compression compress_method
 ) {
+    if (concurrentWriters) {
+        return packShared(stream, itemname, perms, fileSize, modificationTime, comment, compress_method);
+    }
+
+    zpack_metrics_scope m(metrics, ZPackOperation::PACK);
+
     if (stream.good() && file.good()) {
         {
             auto existed = list.find(itemname);
@@ -311,148 +784,141 @@ bool ZPack::packData(
             }
         }
 
+        if (solidBlockSize > 0 && fileSize <= solidItemMax) {
+            m.bytesIn = fileSize;
+            m.failed = !packSolid(stream, itemname, perms, fileSize, modificationTime, comment);
+            return !m.failed;
+        }
+
         ullint offset_start = dir_end.getRecordOffset();
         ullint offset_end = 0;
-        usint general_flag = 0;
-        bool single_step = false;
+
+        zpack_trace_span packSpan(tracer, ZPackTraceKind::PACK, &itemname, offset_start, fileSize);
 
         uint ibufSize = blockSizeBytes;
         if (ibufSize > blockSizeMax) ibufSize = blockSizeMax;
-        char *ibuf = new char[ibufSize];
-        char *obuf = nullptr;
-        ullint compressedSize = fileSize;
+        zpack_buffer ibufHolder = bufferPool.acquire(ibufSize);
+        char *ibuf = ibufHolder.data();
 
-        std::unique_ptr<zpack_compression> ar = nullptr;
-
-        boost::crc_32_type crc32;
-        uint crc32_result = 0;
+        zpack_checksum crc32(checksumType);
 
         LocalFileExtraField extra_perms{};
-        assignInt<usint>(Permissions, extra_perms.id);
-        assignInt<usint>(perms, extra_perms.value);
-
-        LocalFileHeaderRecord loc_hd{};
-        assignInt<uint>(LocalHeader, loc_hd.signature);
-        assignInt<usint>(version, loc_hd.version);
-        assignInt<usint>(general_flag, loc_hd.general);
-        assignInt<usint>(compress_method, loc_hd.compression);
-        assignInt<llint>(modificationTime, loc_hd.mtime);
-        assignInt<uint>(0, loc_hd.crc32);
-        assignInt<ullint>(fileSize, loc_hd.compressedSize);
-        assignInt<ullint>(fileSize, loc_hd.uncompressedSize);
-        assignInt<usint>((usint) itemname.size(), loc_hd.filenameLen);
-        assignInt<usint>(sizeof(extra_perms), loc_hd.extraLen);
-        assignInt<ullint>(0, loc_hd.offsetGap);
+        LocalFileHeaderRecord loc_hd = localHeader(itemname, extra_perms, perms, modificationTime, checksumType);
 
         if (fileSize <= ibufSize) {
-            single_step = true;
-            if (fileSize <= 80) {
-                compress_method = CompressNone;
+            {
+                zpack_trace_span readSpan(tracer, ZPackTraceKind::READ, &itemname, 0, fileSize);
+                stream.read(ibuf, ibufSize);
+                readSpan.end((ullint) stream.gcount());
             }
-
-            stream.read(ibuf, ibufSize);
-            if (compress_method != CompressNone) {
-                ar = createCompression(compress_method);
-                compressedSize = ar->getCompressedSize(fileSize);
-                obuf = new char[compressedSize];
-
-                compressedSize = ar->compressBlock(ibuf, (size_t) stream.gcount(), obuf, compressedSize);
+            m.io();
+
+            zpack_buffer record;
+            size_t recordSize = 0;
+            {
+                zpack_trace_span compressSpan(tracer, ZPackTraceKind::COMPRESS, &itemname, 0, fileSize);
+                recordSize = packRecord(record, loc_hd, itemname, extra_perms, ibuf, (size_t) stream.gcount(),
+                                        compress_method, [this](Compression &method) {
+                                            return createCompression(method);
+                                        }, crc32, bufferPool);
+                compressSpan.end(loc_hd.getCompressedSize());
             }
-
-            crc32.process_bytes(ibuf, (size_t) stream.gcount());
-            crc32_result = crc32.checksum();
-
-            assignInt<uint>(crc32_result, loc_hd.crc32);
-            assignInt<ullint>(compressedSize, loc_hd.compressedSize);
-            assignInt<usint>(compress_method, loc_hd.compression);
+            m.codec();
+
+            zpack_trace_span writeSpan(tracer, ZPackTraceKind::WRITE, &itemname, offset_start, recordSize);
+            seekWrite(offset_start);
+            file.write(record.data(), (std::streamsize) recordSize);
+            writeCursor += recordSize;
+            writeSpan.end(recordSize);
+            m.io();
         } else {
-            general_flag |= Streamed;
-
-            ar = createCompression(compress_method);
-
-            assignInt<ullint>(0, loc_hd.uncompressedSize);
-            assignInt<ullint>(0, loc_hd.compressedSize);
-            assignInt<usint>(general_flag, loc_hd.general);
-        }
-
-        #if ZPACK_DEBUG
-        std::cout << "PACK DATA " << itemname << " gen size " << sizeof(LocalFileHeaderRecord) << " size "
-                  << sizeof(loc_hd) << " align " << alignof(loc_hd) << std::endl;
-        #endif
+            std::unique_ptr<zpack_compression> ar = createCompression(compress_method);
+            sealLocalHeader(loc_hd, Streamed, compress_method, 0, 0, 0);
 
-        file.seekp(offset_start);
-        loc_hd.write(file);
-        file.write(itemname.c_str(), itemname.size());
-        file.write((const char *) &extra_perms, sizeof(extra_perms));
+            zpack_trace_span headerSpan(tracer, ZPackTraceKind::WRITE, &itemname, offset_start,
+                                        sizeof(loc_hd) + itemname.size() + sizeof(extra_perms));
+            seekWrite(offset_start);
+            writeLocalHeader(loc_hd, itemname, {extra_perms});
+            headerSpan.end(sizeof(loc_hd) + itemname.size() + sizeof(extra_perms));
 
-        auto fileOffset = file.tellp();
-
-        if (single_step) {
-            if (compress_method != CompressNone) {
-                file.write(obuf, (std::streamsize) compressedSize);
-            } else {
-                file.write(ibuf, stream.gcount());
-            }
-        } else {
             if (compress_method != CompressNone) ar->streamCompressSetup();
 
-            while (stream.good() && file.good()) {
-                stream.read(ibuf, ibufSize);
-                if (compress_method != CompressNone) {
-                    ar->streamCompressConsume(file, ibuf, (size_t) stream.gcount());
-                } else {
-                    file.write(ibuf, stream.gcount());
+            ullint sourceOffset = 0;
+            auto dataOffset = (ullint) writeCursor;
+            ullint writeOffset = dataOffset;
+            if (pipelineDepth > 1) {
+                writeOffset = packPipelined(stream, itemname, ibufSize,
+                                            compress_method != CompressNone ? ar.get() : nullptr, crc32, m,
+                                            dataOffset);
+            } else {
+                while (stream.good() && file.good()) {
+                    m.mark();
+                    {
+                        zpack_trace_span readSpan(tracer, ZPackTraceKind::READ, &itemname, sourceOffset, ibufSize);
+                        stream.read(ibuf, ibufSize);
+                        readSpan.end((ullint) stream.gcount());
+                    }
+                    m.io();
+                    sourceOffset += stream.gcount();
+                    // compressed output goes through the stream buffer, so it is accounted as codec time
+                    if (compress_method != CompressNone) {
+                        zpack_trace_span compressSpan(tracer, ZPackTraceKind::COMPRESS, &itemname, writeOffset,
+                                                      (ullint) stream.gcount());
+                        ar->streamCompressConsume(file, ibuf, (size_t) stream.gcount());
+                        crc32.process_bytes(ibuf, (size_t) stream.gcount());
+                        compressSpan.end(dataOffset + ar->getStreamCompressBytes() - writeOffset);
+                        writeOffset = dataOffset + ar->getStreamCompressBytes();
+                        m.codec();
+                    } else {
+                        zpack_trace_span writeSpan(tracer, ZPackTraceKind::WRITE, &itemname, writeOffset,
+                                                   (ullint) stream.gcount());
+                        file.write(ibuf, stream.gcount());
+                        writeSpan.end((ullint) stream.gcount());
+                        writeOffset += stream.gcount();
+                        m.io();
+                        crc32.process_bytes(ibuf, (size_t) stream.gcount());
+                        m.codec();
+                    }
                 }
-                crc32.process_bytes(ibuf, (size_t) stream.gcount());
             }
 
-            if (compress_method != CompressNone) ar->streamCompressEnd(file);
-
-            crc32_result = crc32.checksum();
-
-            assignInt<uint>(crc32_result, loc_hd.crc32);
-            assignInt<ullint>(fileSize, loc_hd.uncompressedSize);
             if (compress_method != CompressNone) {
-                assignInt<ullint>(ar->getStreamCompressBytes(), loc_hd.compressedSize);
-            } else {
-                assignInt<ullint>(fileSize, loc_hd.compressedSize);
+                zpack_trace_span compressSpan(tracer, ZPackTraceKind::COMPRESS, &itemname, writeOffset, 0);
+                ar->streamCompressEnd(file);
+                compressSpan.end(dataOffset + ar->getStreamCompressBytes() - writeOffset);
+                writeOffset = dataOffset + ar->getStreamCompressBytes();
             }
 
-            ullint rewind = (ullint) file.tellp();
+            m.codec();
+
+            sealLocalHeader(loc_hd, Streamed, compress_method, crc32.checksum(),
+                            compress_method != CompressNone ? ar->getStreamCompressBytes() : fileSize, fileSize);
+
+            // the only seek left for an item, sizes of a streamed payload are known at its end
+            zpack_trace_span patchSpan(tracer, ZPackTraceKind::WRITE, &itemname, offset_start, sizeof(loc_hd));
             file.seekp(offset_start);
             loc_hd.write(file);
-            file.seekp(rewind);
-        }
-
-        offset_end = (ullint) file.tellp();
-
-        DirectoryFileHeaderRecord dfhr{};
-        assignInt<uint>(DirectoryEntry, dfhr.signature);
-        assignInt<usint>(version, dfhr.versionBy);
-        assignInt<usint>(versionMin, dfhr.versionMin);
-        assignInt<usint>(general_flag, dfhr.general);
-        assignInt<usint>(compress_method, dfhr.compressMethod);
-        assignInt<llint>(modificationTime, dfhr.mtime);
-        assignInt<uint>(crc32_result, dfhr.crc32);
-        assignInt<ullint>(readInt<ullint>(loc_hd.compressedSize), dfhr.compressedSize);
-        assignInt<ullint>(fileSize, dfhr.uncompressedSize);
-        assignInt<usint>((usint) itemname.size(), dfhr.filenameLen);
-        assignInt<usint>(sizeof(extra_perms), dfhr.extraLen);
-        assignInt<usint>((usint) comment.size(), dfhr.commentLen);
-        assignInt<usint>(0, dfhr.attrsInternal);
-        assignInt<uint>(0, dfhr.attrsExternal);
-        assignInt<ullint>((ullint) fileOffset, dfhr.offsetFile);
-        assignInt<ullint>(offset_start, dfhr.offsetRecord);
-
-        list[itemname] = DirectoryFileQueue{
-            dfhr,
-            {extra_perms},
-            itemname,
-            comment
-        };
+            file.seekp(writeOffset);
+            writeCursor = writeOffset;
+            patchSpan.end(sizeof(loc_hd));
+            m.io();
+        }
+
+        offset_end = writeCursor;
+        if (directIO) {
+            // written pages are of no use to anyone, they leave the cache once written back
+            file.flush();
+            ioHint(hintFd, offset_start, offset_end - offset_start, IoHint::DONTNEED);
+        }
+        m.bytesIn = fileSize;
+        m.bytesOut = readInt<ullint>(loc_hd.compressedSize);
+        packSpan.end(offset_end - offset_start);
 
-        delete[] ibuf;
-        delete[] obuf;
+        list[itemname] = directoryEntry(loc_hd, extra_perms, itemname, comment, offset_start);
+        if (compress_method != CompressNone) {
+            replaceExtra(list[itemname], CompressionLevel, levelExtra(codecLevel(compress_method)));
+        }
+        nameIndexDirty = true;
 
         assignInt<ullint>(offset_end, dir_end.dirRecordOffset);
 
@@ -465,98 +931,930 @@ bool ZPack::packData(
         }
     }
 
+    m.failed = true;
+
     return false;
 }
 
-bool ZPack::remove(std::string const &name) {
-    auto res = list.erase(name) == 1;
-    #if ZPACK_DEBUG
-    std::cout << "Remove file from archive " << name << " result: " << res << std::endl;
-    #endif
-    return res;
+DirectoryFileQueue ZPack::directoryEntry(LocalFileHeaderRecord const &header, LocalFileExtraField const &extra,
+                                         std::string const &itemname, std::string const &comment,
+                                         ullint offsetRecord) {
+    DirectoryFileHeaderRecord dfhr{};
+    assignInt<uint>(DirectoryEntry, dfhr.signature);
+    assignInt<usint>(version, dfhr.versionBy);
+    assignInt<usint>(versionMin, dfhr.versionMin);
+    assignInt<usint>(readInt<usint>(header.general), dfhr.general);
+    assignInt<usint>(readInt<usint>(header.compression), dfhr.compressMethod);
+    assignInt<llint>(readInt<llint>(header.mtime), dfhr.mtime);
+    assignInt<uint>(readInt<uint>(header.crc32), dfhr.crc32);
+    assignInt<ullint>(readInt<ullint>(header.compressedSize), dfhr.compressedSize);
+    assignInt<ullint>(readInt<ullint>(header.uncompressedSize), dfhr.uncompressedSize);
+    assignInt<usint>((usint) itemname.size(), dfhr.filenameLen);
+    assignInt<usint>(sizeof(extra), dfhr.extraLen);
+    assignInt<usint>((usint) comment.size(), dfhr.commentLen);
+    assignInt<usint>(0, dfhr.attrsInternal);
+    assignInt<uint>(0, dfhr.attrsExternal);
+    assignInt<ullint>(offsetRecord + sizeof(header) + itemname.size() + sizeof(extra), dfhr.offsetFile);
+    assignInt<ullint>(offsetRecord, dfhr.offsetRecord);
+
+    return DirectoryFileQueue{
+        dfhr,
+        {extra},
+        itemname,
+        comment
+    };
 }
 
-bool ZPack::extract(DirectoryFileQueue &sitem, std::ostream &stream) {
-    uint crc32_result = 0;
-    uint ibufSize = blockSizeBytes;
-    if (ibufSize > blockSizeMax) ibufSize = blockSizeMax;
-    if (ibufSize > sitem.record.getCompressedSize()) ibufSize = (uint) sitem.record.getCompressedSize();
-    char *ibuf = new char[ibufSize];
-    char *obuf = nullptr;
+void ZPack::setConcurrentWriters(bool enable) {
+    if (enable && !concurrentWriters) {
+        flushSolid();
+    }
 
-    try {
-        boost::crc_32_type crc32;
-        ullint readed = 0;
-        auto crc32_callback = [&crc32](const char *buf, size_t size) {
-            crc32.process_bytes(buf, size);
-        };
+    concurrentWriters = enable;
+    pioClose(writeFd);
+    if (enable && file.is_open()) {
+        // buffered stream output has to land before descriptor writes go around it
+        file.flush();
+        writeFd = pioOpen(archive_name.c_str(), true);
+    }
 
-        file.seekg(sitem.record.getOffsetFile());
-        Compression compress_method = (Compression) sitem.record.getCompressMethod();
-        GeneralFlags general_flags = (GeneralFlags) sitem.record.getGeneral();
+    appendOffset = dir_end.getRecordOffset();
+}
 
-        auto ar = createCompression(compress_method);
-        auto compressedFileSize = sitem.record.getCompressedSize();
+void ZPack::packError(Errors code) {
+    std::lock_guard<std::mutex> guard(directoryLock);
+    error_code = code;
+}
 
-        if (general_flags & Streamed) {
-            ar->streamDecompressSetup();
-        }
+void ZPack::setSnapshots(bool enable) {
+    snapshotsEnabled = enable;
+    publish();
+}
 
-        while (readed < compressedFileSize) {
-            ullint readed_left = compressedFileSize - readed;
-            file.read(ibuf, (uint) (readed_left > ibufSize ? ibufSize : readed_left));
+void ZPack::publish() {
+    if (file.is_open()) {
+        flushSolid();
+        // snapshots read through their own descriptor, around the stream buffer
+        file.flush();
+    }
 
-            readed += file.gcount();
+    publishSnapshot();
+}
 
-            ullint d_size = 0;
-            if (compress_method != CompressNone && !(general_flags & Streamed)) {
-                auto d_predictSize = ar->getDecompressedSize(ibuf, (size_t) file.gcount());
-                obuf = new char[d_predictSize];
+void ZPack::publishSnapshot() {
+    std::shared_ptr<const zpack_snapshot> next;
+    if (snapshotsEnabled && file.is_open()) {
+        int fd = pioOpen(archive_name.c_str(), false);
+        if (fd >= 0) {
+            next.reset(new zpack_snapshot(fd, ++snapshotGeneration, list));
+        }
+    }
 
-                d_size = ar->decompressBlock(ibuf, (size_t) file.gcount(), obuf, d_predictSize);
+    std::atomic_store(&published, next);
+}
 
-                stream.write(obuf, (std::streamsize) d_size);
-                crc32.process_bytes(obuf, (size_t) d_size);
+std::shared_ptr<const zpack_snapshot> ZPack::snapshot() const {
+    return std::atomic_load(&published);
+}
 
-                delete[] obuf;
-            } else if (compress_method != CompressNone && general_flags & Streamed) {
-                ar->streamDecompressConsume(stream, ibuf, (size_t) file.gcount(), crc32_callback);
-                d_size = ar->getStreamDecompressLastBytes();
-            } else {
-                stream.write(ibuf, file.gcount());
-                crc32.process_bytes(ibuf, (size_t) file.gcount());
-            }
+bool ZPack::packShared(std::istream &stream, std::string const &itemname, fs::perms &perms, ullint fileSize,
+                       llint modificationTime, std::string const &comment, Compression compress_method) {
+    zpack_metrics_scope m(metrics, ZPackOperation::PACK);
 
-            #if ZPACK_DEBUG
-            std::cout << "EXTRACTING: " << sitem.filename << " " << d_size << " from readed " << readed << std::endl;
-            #endif
+    {
+        std::lock_guard<std::mutex> guard(directoryLock);
+        auto existed = list.find(itemname);
+        if (
+            existed != list.end() &&
+            existed->second.record.getUncompressedSize() == fileSize &&
+            existed->second.record.getMtime() == modificationTime
+            ) {
+            return true;
         }
 
-        if (general_flags & Streamed) {
-            ar->streamDecompressEnd();
+        if (writeFd < 0 || !stream.good()) {
+            error_code = writeFd < 0 ? Errors::ERR_OPENING_ARCHIVE_FILE : Errors::ERR_PACK_FILE_OPEN;
+            m.failed = true;
+            return false;
         }
+    }
 
-        crc32_result = crc32.checksum();
-    } catch (std::runtime_error &e) {
-        std::cerr << "zpack::extract: Error with filesystem operation: " << e.what() << std::endl;
-        error_code = Errors::ERR_EXTRACT_GENERAL;
-    } catch (...) {
-        std::cerr << "zpack::extract: Error general" << std::endl;
+    zpack_trace_span packSpan(tracer, ZPackTraceKind::PACK, &itemname, 0, fileSize);
+
+    uint ibufSize = blockSizeBytes;
+    if (ibufSize > blockSizeMax) ibufSize = blockSizeMax;
+    zpack_buffer ibufHolder = bufferPool.acquire(ibufSize);
+    char *ibuf = ibufHolder.data();
+
+    zpack_checksum crc32(checksumType);
+
+    LocalFileExtraField extra_perms{};
+    LocalFileHeaderRecord loc_hd = localHeader(itemname, extra_perms, perms, modificationTime, checksumType);
+
+    size_t headSize = sizeof(loc_hd) + itemname.size() + sizeof(extra_perms);
+    ullint compressedSize = 0;
+    ullint offset_start = 0;
+    bool written = false;
+
+    if (fileSize <= ibufSize) {
+        // sizes are known once the block is compressed, the record is reserved and written at once
+        stream.read(ibuf, ibufSize);
+        m.io();
+
+        zpack_buffer record;
+        size_t recordSize = packRecord(record, loc_hd, itemname, extra_perms, ibuf, (size_t) stream.gcount(),
+                                       compress_method, [this](Compression &method) {
+                                           return createCompression(method);
+                                       }, crc32, bufferPool);
+        compressedSize = loc_hd.getCompressedSize();
+        m.codec();
+
+        offset_start = appendOffset.fetch_add(recordSize);
+        written = pioWriteAt(writeFd, record.data(), recordSize, offset_start);
+        m.io();
+    } else if (compress_method == CompressNone) {
+        // a stored payload has its size up front, the range is reserved before reading the source
+        compressedSize = fileSize;
+        offset_start = appendOffset.fetch_add(headSize + fileSize);
+
+        ullint writeOffset = offset_start + headSize;
+        written = true;
+        while (written && stream.good() && writeOffset < offset_start + headSize + fileSize) {
+            stream.read(ibuf, ibufSize);
+            auto readSize = (size_t) stream.gcount();
+            if (readSize > offset_start + headSize + fileSize - writeOffset) {
+                readSize = (size_t) (offset_start + headSize + fileSize - writeOffset);
+            }
+            m.io();
+            crc32.process_bytes(ibuf, readSize);
+            written = pioWriteAt(writeFd, ibuf, readSize, writeOffset);
+            writeOffset += readSize;
+            m.io();
+        }
+        written = written && writeOffset == offset_start + headSize + fileSize;
+    } else {
+        // the compressed size is known only at the end, the payload goes to a private staging file
+        fs::path stagingName = fs::unique_path(archive_name + ".%%%%-%%%%-%%%%.stage");
+        std::fstream staging(stagingName.string(),
+                             std::ios_base::binary | std::ios_base::in | std::ios_base::out | std::ios_base::trunc);
+
+        auto ar = createCompression(compress_method);
+        ar->streamCompressSetup();
+        while (stream.good() && staging.good()) {
+            stream.read(ibuf, ibufSize);
+            m.io();
+            ar->streamCompressConsume(staging, ibuf, (size_t) stream.gcount());
+            crc32.process_bytes(ibuf, (size_t) stream.gcount());
+            m.codec();
+        }
+        ar->streamCompressEnd(staging);
+        compressedSize = ar->getStreamCompressBytes();
+        m.codec();
+
+        staging.seekg(0);
+        written = staging.good();
+        if (written) {
+            offset_start = appendOffset.fetch_add(headSize + compressedSize);
+        }
+
+        ullint copied = 0;
+        while (written && copied < compressedSize) {
+            auto chunk = (std::streamsize) std::min<ullint>(ibufSize, compressedSize - copied);
+            staging.read(ibuf, chunk);
+            written = staging.gcount() == chunk &&
+                      pioWriteAt(writeFd, ibuf, (size_t) chunk, offset_start + headSize + copied);
+            copied += (ullint) chunk;
+        }
+        m.io();
+
+        staging.close();
+        boost::system::error_code ec;
+        fs::remove(stagingName, ec);
+    }
+
+    if (written && fileSize > ibufSize) {
+        sealLocalHeader(loc_hd, Streamed, compress_method, crc32.checksum(), compressedSize, fileSize);
+
+        zpack_buffer head = bufferPool.acquire(headSize);
+        fillLocalHeader(head.data(), loc_hd, itemname, {extra_perms});
+        written = pioWriteAt(writeFd, head.data(), headSize, offset_start);
+        m.io();
+    }
+
+    m.bytesIn = fileSize;
+    m.bytesOut = compressedSize;
+    packSpan.end(headSize + compressedSize);
+
+    short int level = codecLevel(compress_method);
+    std::lock_guard<std::mutex> guard(directoryLock);
+    if (!written) {
+        // the reserved range stays unused until the next repack
+        error_code = Errors::ERR_OPENING_ARCHIVE_FILE;
+        m.failed = true;
+        return false;
+    }
+
+    list[itemname] = directoryEntry(loc_hd, extra_perms, itemname, comment, offset_start);
+    if (compress_method != CompressNone) {
+        replaceExtra(list[itemname], CompressionLevel, levelExtra(level));
+    }
+    nameIndexDirty = true;
+    // covers ranges of writers still in flight, write() runs only after all of them are done
+    assignInt<ullint>(appendOffset.load(), dir_end.dirRecordOffset);
+
+    return true;
+}
+
+bool ZPack::packSolid(std::istream &stream, std::string const &itemname, fs::perms &perms, ullint fileSize,
+                      llint modificationTime, std::string const &comment) {
+    zpack_trace_span packSpan(tracer, ZPackTraceKind::PACK, &itemname, solidPending.size(), fileSize);
+
+    usint general_flag = Solid;
+    if (checksumType == ZPackChecksum::XXHASH64) {
+        general_flag |= ChecksumXXH64;
+    }
+
+    LocalFileExtraField extra_perms{};
+    assignInt<usint>(Permissions, extra_perms.id);
+    assignInt<usint>(perms, extra_perms.value);
+
+    // inside the block every item keeps its own local record, so a block is a small archive of its own
+    size_t headerPos = solidPending.size();
+    size_t namePos = headerPos + sizeof(LocalFileHeaderRecord);
+    size_t dataPos = namePos + itemname.size() + sizeof(extra_perms);
+    solidPending.resize(dataPos + fileSize);
+
+    stream.read(&solidPending[dataPos], (std::streamsize) fileSize);
+    if ((ullint) stream.gcount() != fileSize) {
+        solidPending.resize(headerPos);
+        error_code = Errors::ERR_PACK_FILE_OPEN;
+        return false;
+    }
+
+    zpack_checksum crc32(checksumType);
+    crc32.process_bytes(&solidPending[dataPos], (size_t) fileSize);
+    uint crc32_result = crc32.checksum();
+
+    LocalFileHeaderRecord loc_hd{};
+    assignInt<uint>(LocalHeader, loc_hd.signature);
+    assignInt<usint>(version, loc_hd.version);
+    assignInt<usint>(general_flag, loc_hd.general);
+    assignInt<usint>(CompressNone, loc_hd.compression);
+    assignInt<llint>(modificationTime, loc_hd.mtime);
+    assignInt<uint>(crc32_result, loc_hd.crc32);
+    assignInt<ullint>(fileSize, loc_hd.compressedSize);
+    assignInt<ullint>(fileSize, loc_hd.uncompressedSize);
+    assignInt<usint>((usint) itemname.size(), loc_hd.filenameLen);
+    assignInt<usint>(sizeof(extra_perms), loc_hd.extraLen);
+    assignInt<ullint>(0, loc_hd.offsetGap);
+
+    std::memcpy(&solidPending[headerPos], &loc_hd, sizeof(loc_hd));
+    std::memcpy(&solidPending[namePos], itemname.data(), itemname.size());
+    std::memcpy(&solidPending[namePos + itemname.size()], &extra_perms, sizeof(extra_perms));
+
+    // offsets are known only when the block is flushed
+    DirectoryFileHeaderRecord dfhr{};
+    assignInt<uint>(DirectoryEntry, dfhr.signature);
+    assignInt<usint>(version, dfhr.versionBy);
+    assignInt<usint>(2, dfhr.versionMin);
+    assignInt<usint>(general_flag, dfhr.general);
+    assignInt<usint>(compressionMethod, dfhr.compressMethod);
+    assignInt<llint>(modificationTime, dfhr.mtime);
+    assignInt<uint>(crc32_result, dfhr.crc32);
+    assignInt<ullint>(0, dfhr.compressedSize);
+    assignInt<ullint>(fileSize, dfhr.uncompressedSize);
+    assignInt<usint>((usint) itemname.size(), dfhr.filenameLen);
+    assignInt<usint>(sizeof(extra_perms), dfhr.extraLen);
+    assignInt<usint>((usint) comment.size(), dfhr.commentLen);
+    assignInt<usint>(0, dfhr.attrsInternal);
+    assignInt<uint>((uint) dataPos, dfhr.attrsExternal);
+    assignInt<ullint>(solidPendingOffset, dfhr.offsetFile);
+    assignInt<ullint>(solidPendingOffset, dfhr.offsetRecord);
+
+    list[itemname] = DirectoryFileQueue{
+        dfhr,
+        {extra_perms},
+        itemname,
+        comment
+    };
+    nameIndexDirty = true;
+    solidPendingNames.push_back(itemname);
+    packSpan.end(fileSize);
+
+    if (solidPending.size() >= solidBlockSize) {
+        return flushSolid();
+    }
+
+    return true;
+}
+
+bool ZPack::flushSolid() {
+    if (solidPending.empty())
+        return true;
+
+    // a block of raw records is pointless, solid blocks are compressed even when items are not
+    Compression compress_method = compressionMethod == CompressNone ? CompressZstd : compressionMethod;
+    auto ar = createCompression(compress_method);
+    ullint offset_start = dir_end.getRecordOffset();
+    ullint compressedSize = ar->getCompressedSize(solidPending.size());
+    zpack_buffer obuf = bufferPool.acquire(compressedSize);
+
+    try {
+        zpack_trace_span compressSpan(tracer, ZPackTraceKind::COMPRESS, nullptr, offset_start, solidPending.size());
+        compressedSize = ar->compressBlock(solidPending.data(), solidPending.size(), obuf.data(), compressedSize);
+        compressSpan.end(compressedSize);
+    } catch (std::runtime_error &e) {
+        std::cerr << "zpack::flushSolid: " << e.what() << std::endl;
+        error_code = Errors::ERR_UNKNOWN;
+        return false;
+    }
+
+    zpack_checksum crc32(checksumType);
+    crc32.process_bytes(solidPending.data(), solidPending.size());
+
+    usint general_flag = Solid;
+    if (checksumType == ZPackChecksum::XXHASH64) {
+        general_flag |= ChecksumXXH64;
+    }
+
+    LocalFileHeaderRecord loc_hd{};
+    assignInt<uint>(LocalHeader, loc_hd.signature);
+    assignInt<usint>(version, loc_hd.version);
+    assignInt<usint>(general_flag, loc_hd.general);
+    assignInt<usint>(compress_method, loc_hd.compression);
+    assignInt<llint>(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()), loc_hd.mtime);
+    assignInt<uint>(crc32.checksum(), loc_hd.crc32);
+    assignInt<ullint>(compressedSize, loc_hd.compressedSize);
+    assignInt<ullint>(solidPending.size(), loc_hd.uncompressedSize);
+    assignInt<usint>(0, loc_hd.filenameLen);
+    assignInt<usint>(0, loc_hd.extraLen);
+    assignInt<ullint>(0, loc_hd.offsetGap);
+
+    zpack_trace_span writeSpan(tracer, ZPackTraceKind::WRITE, nullptr, offset_start, sizeof(loc_hd) + compressedSize);
+    seekWrite(offset_start);
+    writeLocalHeader(loc_hd, "", {});
+    file.write(obuf.data(), (std::streamsize) compressedSize);
+    writeCursor += compressedSize;
+    writeSpan.end(sizeof(loc_hd) + compressedSize);
+
+    if (!file.good()) {
+        error_code = Errors::ERR_OPENING_ARCHIVE_FILE;
+        return false;
+    }
+
+    ullint offsetFile = offset_start + sizeof(loc_hd);
+    for (auto const &name : solidPendingNames) {
+        auto item = list.find(name);
+        if (item == list.end()) continue;
+
+        DirectoryFileHeaderRecord &record = item->second.record;
+        if (!(record.getGeneral() & Solid) || record.getOffsetFile() != solidPendingOffset) continue;
+
+        assignInt<ullint>(offset_start, record.offsetRecord);
+        assignInt<ullint>(offsetFile, record.offsetFile);
+        assignInt<usint>(compress_method, record.compressMethod);
+        assignInt<ullint>(compressedSize, record.compressedSize);
+    }
+
+    assignInt<ullint>(writeCursor, dir_end.dirRecordOffset);
+    solidPending.clear();
+    solidPendingNames.clear();
+
+    return true;
+}
+
+const char *ZPack::solidBlock(DirectoryFileQueue &sitem, size_t &blockSize) {
+    if (sitem.record.getOffsetFile() == solidPendingOffset) {
+        blockSize = solidPending.size();
+        return solidPending.data();
+    }
+
+    ullint offset = sitem.record.getOffsetRecord();
+    for (auto it = solidCache.begin(); it != solidCache.end(); ++it) {
+        if (it->first == offset) {
+            solidCache.splice(solidCache.begin(), solidCache, it);
+            blockSize = it->second.size();
+            return it->second.data();
+        }
+    }
+
+    ullint compressedSize = sitem.record.getCompressedSize();
+    zpack_buffer ibuf = bufferPool.acquire(compressedSize);
+    {
+        zpack_trace_span readSpan(tracer, ZPackTraceKind::READ, nullptr, sitem.record.getOffsetFile(), compressedSize);
+        seekRead(sitem.record.getOffsetFile());
+        file.read(ibuf.data(), (std::streamsize) compressedSize);
+        readSpan.end((ullint) file.gcount());
+    }
+    if ((ullint) file.gcount() != compressedSize) {
         error_code = Errors::ERR_EXTRACT_GENERAL;
+        return nullptr;
+    }
+
+    Compression compress_method = (Compression) sitem.record.getCompressMethod();
+    auto ar = createCompression(compress_method);
+    if (!ar) {
+        error_code = Errors::ERR_UNKNOWN_COMPRESSION;
+        return nullptr;
+    }
+
+    zpack_trace_span decompressSpan(tracer, ZPackTraceKind::DECOMPRESS, nullptr, sitem.record.getOffsetFile(),
+                                    compressedSize);
+    auto d_size = ar->getDecompressedSize(ibuf.data(), (size_t) compressedSize);
+    zpack_buffer obuf = bufferPool.acquire(d_size);
+    d_size = ar->decompressBlock(ibuf.data(), (size_t) compressedSize, obuf.data(), d_size);
+    decompressSpan.end(d_size);
+
+    solidCache.emplace_front(offset, std::move(obuf));
+    while (solidCache.size() > solidCacheBlocks) {
+        solidCache.pop_back();
+    }
+
+    blockSize = (size_t) d_size;
+    return solidCache.front().second.data();
+}
+
+ullint ZPack::packPipelined(std::istream &stream, std::string const &itemname, uint blockSize,
+                            zpack_compression *ar, zpack_checksum &crc32, zpack_metrics_scope &m,
+                            ullint dataOffset) {
+    _SerialTraceListener serialTracer(tracer);
+    zpack_trace_listener *stageTracer = serialTracer.get();
+    _BoundedQueue<_PipelineBlock> readQueue(pipelineDepth);
+    _BoundedQueue<_PipelineBlock> writeQueue(pipelineDepth);
+    std::exception_ptr readerError;
+    std::exception_ptr writerError;
+    ullint writeOffset = dataOffset;
+
+    // source reads and the checksum run ahead of the codec
+    std::thread reader([&] {
+        try {
+            ullint sourceOffset = 0;
+            while (stream.good()) {
+                _PipelineBlock block{bufferPool.acquire(blockSize), 0};
+                zpack_trace_span readSpan(stageTracer, ZPackTraceKind::READ, &itemname, sourceOffset, blockSize);
+                stream.read(block.buffer.data(), blockSize);
+                block.size = (size_t) stream.gcount();
+                readSpan.end(block.size);
+                if (block.size == 0) break;
+
+                sourceOffset += block.size;
+                crc32.process_bytes(block.buffer.data(), block.size);
+                if (!readQueue.push(std::move(block))) break;
+            }
+        } catch (...) {
+            readerError = std::current_exception();
+        }
+        readQueue.close();
+    });
+
+    // archive writes trail the codec, the only stage touching file
+    std::thread writer([&] {
+        try {
+            _PipelineBlock block{};
+            while (file.good() && writeQueue.pop(block)) {
+                zpack_trace_span writeSpan(stageTracer, ZPackTraceKind::WRITE, &itemname, writeOffset, block.size);
+                file.write(block.buffer.data(), (std::streamsize) block.size);
+                writeSpan.end(block.size);
+                writeOffset += block.size;
+                block = _PipelineBlock{};
+            }
+        } catch (...) {
+            writerError = std::current_exception();
+        }
+        writeQueue.close();
+        readQueue.close();
+    });
+
+    try {
+        _BlockSink sink(bufferPool, ar ? (size_t) ar->getCompressedSize(blockSize) : 0);
+        std::ostream sinkStream(&sink);
+        _PipelineBlock block{};
+        while (true) {
+            // waiting on a neighbour stage is accounted as io, the codec is what this thread is for
+            m.mark();
+            bool popped = readQueue.pop(block);
+            m.io();
+            if (!popped) break;
+
+            if (ar) {
+                ullint codecOffset = dataOffset + ar->getStreamCompressBytes();
+                zpack_trace_span compressSpan(stageTracer, ZPackTraceKind::COMPRESS, &itemname, codecOffset,
+                                              block.size);
+                ar->streamCompressConsume(sinkStream, block.buffer.data(), block.size);
+                compressSpan.end(dataOffset + ar->getStreamCompressBytes() - codecOffset);
+                block = sink.take();
+                m.codec();
+                if (block.size == 0) continue;
+            }
+
+            bool pushed = writeQueue.push(std::move(block));
+            m.io();
+            if (!pushed) break;
+        }
+    } catch (...) {
+        readQueue.close();
+        writeQueue.close();
+        reader.join();
+        writer.join();
+        throw;
+    }
+
+    writeQueue.close();
+    reader.join();
+    writer.join();
+
+    if (readerError) std::rethrow_exception(readerError);
+    if (writerError) std::rethrow_exception(writerError);
+
+    return writeOffset;
+}
+
+ullint ZPack::extractPipelined(DirectoryFileQueue &sitem, std::ostream &stream, zpack_compression *ar,
+                               zpack_checksum &crc32, zpack_metrics_scope &m, uint blockSize) {
+    _SerialTraceListener serialTracer(tracer);
+    zpack_trace_listener *stageTracer = serialTracer.get();
+    _BoundedQueue<_PipelineBlock> readQueue(pipelineDepth);
+    _BoundedQueue<_PipelineBlock> writeQueue(pipelineDepth);
+    std::exception_ptr readerError;
+    std::exception_ptr writerError;
+    const ullint offsetFile = sitem.record.getOffsetFile();
+    const ullint compressedFileSize = sitem.record.getCompressedSize();
+    ullint readed = 0;
+    ullint written = 0;
+
+    std::thread reader([&] {
+        try {
+            ullint hintWindow = (ullint) blockSize * readAheadBlocks;
+            ullint hinted = hintWindow < compressedFileSize ? hintWindow : compressedFileSize;
+            while (readed < compressedFileSize && file.good()) {
+                ullint readed_left = compressedFileSize - readed;
+                auto readSize = (uint) (readed_left > blockSize ? blockSize : readed_left);
+                _PipelineBlock block{bufferPool.acquire(readSize), 0};
+                zpack_trace_span readSpan(stageTracer, ZPackTraceKind::READ, &sitem.filename, offsetFile + readed,
+                                          readSize);
+                block.size = readArchive(block.buffer.data(), readSize, offsetFile + readed);
+                readSpan.end(block.size);
+                if (block.size == 0) break;
+
+                readed += block.size;
+                if (hinted < compressedFileSize && readed + hintWindow > hinted) {
+                    ullint hintNext = readed + hintWindow < compressedFileSize ? readed + hintWindow : compressedFileSize;
+                    ioHint(hintFd, offsetFile + hinted, hintNext - hinted, IoHint::WILLNEED);
+                    hinted = hintNext;
+                }
+
+                if (!readQueue.push(std::move(block))) break;
+            }
+        } catch (...) {
+            readerError = std::current_exception();
+        }
+        readQueue.close();
+    });
+
+    // output writes and the checksum of the restored data trail the codec
+    std::thread writer([&] {
+        try {
+            _PipelineBlock block{};
+            while (stream.good() && writeQueue.pop(block)) {
+                stream.write(block.buffer.data(), (std::streamsize) block.size);
+                crc32.process_bytes(block.buffer.data(), block.size);
+                written += block.size;
+                block = _PipelineBlock{};
+            }
+        } catch (...) {
+            writerError = std::current_exception();
+        }
+        writeQueue.close();
+        readQueue.close();
+    });
+
+    try {
+        _BlockSink sink(bufferPool, blockSize);
+        std::ostream sinkStream(&sink);
+        _PipelineBlock block{};
+        ullint codecOffset = offsetFile;
+        while (true) {
+            m.mark();
+            bool popped = readQueue.pop(block);
+            m.io();
+            if (!popped) break;
+
+            if (ar) {
+                zpack_trace_span decompressSpan(stageTracer, ZPackTraceKind::DECOMPRESS, &sitem.filename,
+                                                codecOffset, block.size);
+                codecOffset += block.size;
+                ar->streamDecompressConsume(sinkStream, block.buffer.data(), block.size);
+                block = sink.take();
+                decompressSpan.end(block.size);
+                m.codec();
+                if (block.size == 0) continue;
+            }
+
+            bool pushed = writeQueue.push(std::move(block));
+            m.io();
+            if (!pushed) break;
+        }
+    } catch (...) {
+        readQueue.close();
+        writeQueue.close();
+        reader.join();
+        writer.join();
+        throw;
+    }
+
+    writeQueue.close();
+    reader.join();
+    writer.join();
+
+    if (readerError) std::rethrow_exception(readerError);
+    if (writerError) std::rethrow_exception(writerError);
+
+    m.bytesOut = written;
+    return readed;
+}
+
+bool ZPack::contains(std::string const &name) {
+    return list.find(name) != list.end();
+}
+
+void ZPack::ensureNameIndex() {
+    if (!nameIndexDirty)
+        return;
+
+    nameIndex.clear();
+    nameIndex.reserve(list.size());
+    for (auto const &item : list) {
+        nameIndex.push_back(&item.first);
+    }
+    std::sort(nameIndex.begin(), nameIndex.end(), [](const std::string *a, const std::string *b) {
+        return *a < *b;
+    });
+    nameIndexDirty = false;
+}
+
+std::vector<const std::string *>::const_iterator ZPack::nameIndexLowerBound(std::string const &prefix) {
+    ensureNameIndex();
+    return std::lower_bound(nameIndex.cbegin(), nameIndex.cend(), prefix,
+                            [](const std::string *a, std::string const &b) {
+                                return *a < b;
+                            });
+}
+
+ZPackEntry ZPack::entryInfo(DirectoryFileQueue const &item) const {
+    return ZPackEntry{
+        item.filename,
+        item.record.getUncompressedSize(),
+        item.record.getCompressedSize(),
+        item.record.getMtime(),
+        item.record.getCrc32()
     };
+}
 
-    delete[] ibuf;
+void ZPack::forEachEntry(std::string const &prefix, std::function<bool(ZPackEntry const &)> const &fn) {
+    for (auto it = nameIndexLowerBound(prefix); it != nameIndex.cend(); ++it) {
+        const std::string &name = **it;
+        if (name.compare(0, prefix.size(), prefix) != 0) break;
+
+        if (!fn(entryInfo(list.find(name)->second))) break;
+    }
+}
+
+std::vector<std::string> ZPack::listNames(std::string const &prefix) {
+    std::vector<std::string> res;
+    for (auto it = nameIndexLowerBound(prefix); it != nameIndex.cend(); ++it) {
+        if ((*it)->compare(0, prefix.size(), prefix) != 0) break;
+        res.push_back(**it);
+    }
+
+    return res;
+}
+
+std::vector<std::string> ZPack::globNames(std::string const &pattern) {
+    // only names sharing the literal head of the pattern can match, the rest of the index is skipped
+    std::string prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+
+    std::vector<std::string> res;
+    for (auto it = nameIndexLowerBound(prefix); it != nameIndex.cend(); ++it) {
+        if ((*it)->compare(0, prefix.size(), prefix) != 0) break;
+        if (fnmatch(pattern.c_str(), (*it)->c_str(), 0) == 0) {
+            res.push_back(**it);
+        }
+    }
+
+    return res;
+}
+
+ZPackSubtreeStats ZPack::subtreeStats(std::string const &prefix) {
+    ZPackSubtreeStats res{0, 0, 0};
+    std::unordered_set<ullint> solidBlocks;
+    for (auto it = nameIndexLowerBound(prefix); it != nameIndex.cend(); ++it) {
+        if ((*it)->compare(0, prefix.size(), prefix) != 0) break;
+
+        DirectoryFileHeaderRecord const &record = list.find(**it)->second.record;
+        res.items++;
+        res.uncompressedSize += record.getUncompressedSize();
+        if (!(record.getGeneral() & Solid) || solidBlocks.insert(record.getOffsetRecord()).second) {
+            res.compressedSize += record.getCompressedSize();
+        }
+    }
+
+    return res;
+}
+
+bool ZPack::remove(std::string const &name) {
+    auto res = list.erase(name) == 1;
+    if (res) nameIndexDirty = true;
+    return res;
+}
+
+bool ZPack::extract(DirectoryFileQueue &sitem, std::ostream &stream) {
+    zpack_metrics_scope m(metrics, ZPackOperation::EXTRACT);
+
+    usint method = sitem.record.getCompressMethod();
+    if (method != CompressNone && !zpack_codec_registry::has(method)) {
+        error_code = Errors::ERR_UNKNOWN_COMPRESSION;
+        m.failed = true;
+        return false;
+    }
+
+    uint crc32_result = 0;
+    uint ibufSize = blockSizeBytes;
+    if (ibufSize > blockSizeMax) ibufSize = blockSizeMax;
+    // a single compressed block is decoded whole, whatever block size it was packed with
+    if (!(sitem.record.getGeneral() & Streamed) && sitem.record.getCompressMethod() != CompressNone &&
+        sitem.record.getCompressedSize() <= 0xffffffffULL) {
+        ibufSize = (uint) sitem.record.getCompressedSize();
+    }
+    if (ibufSize > sitem.record.getCompressedSize()) ibufSize = (uint) sitem.record.getCompressedSize();
+    zpack_buffer ibufHolder;
+    zpack_buffer obufHolder;
+    if (!(sitem.record.getGeneral() & Solid)) {
+        ibufHolder = bufferPool.acquire(ibufSize);
+    }
+    char *ibuf = ibufHolder.data();
+
+    zpack_trace_span extractSpan(tracer, ZPackTraceKind::EXTRACT, &sitem.filename, sitem.record.getOffsetFile(),
+                                 sitem.record.getUncompressedSize());
+
+    try {
+        zpack_checksum crc32(
+            sitem.record.getGeneral() & ChecksumXXH64 ? ZPackChecksum::XXHASH64 : ZPackChecksum::CRC32
+        );
+
+        if (sitem.record.getGeneral() & Solid) {
+            size_t blockSize = 0;
+            const char *block = solidBlock(sitem, blockSize);
+            ullint itemOffset = sitem.record.getAttrsExternal();
+            ullint itemSize = sitem.record.getUncompressedSize();
+            if (block == nullptr || itemOffset + itemSize > blockSize) {
+                throw std::runtime_error("solid block is damaged");
+            }
+            m.codec();
+
+            stream.write(block + itemOffset, (std::streamsize) itemSize);
+            m.io();
+            crc32.process_bytes(block + itemOffset, (size_t) itemSize);
+            crc32_result = crc32.checksum();
+            m.bytesOut = itemSize;
+            extractSpan.end(itemSize);
+        } else {
+            ullint readed = 0;
+            auto crc32_callback = [&crc32](const char *buf, size_t size) {
+                crc32.process_bytes(buf, size);
+            };
+
+            seekRead(sitem.record.getOffsetFile());
+            Compression compress_method = (Compression) sitem.record.getCompressMethod();
+            GeneralFlags general_flags = (GeneralFlags) sitem.record.getGeneral();
+
+            auto ar = createCompression(compress_method);
+            auto compressedFileSize = sitem.record.getCompressedSize();
+
+            // prefetch a window of blocks ahead of the reader instead of relying on kernel readahead
+            // heuristics, which are wrong both for single random items and for long sequential ones
+            ullint hintWindow = (ullint) ibufSize * readAheadBlocks;
+            ullint hinted = hintWindow < compressedFileSize ? hintWindow : compressedFileSize;
+            ioHint(hintFd, sitem.record.getOffsetFile(), hinted, IoHint::WILLNEED);
+
+            // stored items spanning several blocks are flagged as streamed too, but have no codec
+            if (ar && general_flags & Streamed) {
+                ar->streamDecompressSetup();
+            }
+
+            if (pipelineDepth > 1 && compressedFileSize > ibufSize &&
+                (general_flags & Streamed || compress_method == CompressNone)) {
+                readed = extractPipelined(sitem, stream, compress_method != CompressNone ? ar.get() : nullptr,
+                                          crc32, m, ibufSize);
+            } else {
+                while (readed < compressedFileSize) {
+                    ullint readed_left = compressedFileSize - readed;
+                    m.mark();
+                    size_t got = 0;
+                    {
+                        uint readSize = (uint) (readed_left > ibufSize ? ibufSize : readed_left);
+                        zpack_trace_span readSpan(tracer, ZPackTraceKind::READ, &sitem.filename,
+                                                  sitem.record.getOffsetFile() + readed, readSize);
+                        got = readArchive(ibuf, readSize, sitem.record.getOffsetFile() + readed);
+                        readSpan.end(got);
+                    }
+                    m.io();
+
+                    if (got == 0) break;
+                    readed += got;
+
+                    if (hinted < compressedFileSize && readed + hintWindow > hinted) {
+                        ullint hintNext = readed + hintWindow < compressedFileSize ? readed + hintWindow : compressedFileSize;
+                        ioHint(hintFd, sitem.record.getOffsetFile() + hinted, hintNext - hinted, IoHint::WILLNEED);
+                        hinted = hintNext;
+                    }
+
+                    ullint d_size = 0;
+                    if (compress_method != CompressNone && !(general_flags & Streamed)) {
+                        zpack_trace_span decompressSpan(tracer, ZPackTraceKind::DECOMPRESS, &sitem.filename,
+                                                        sitem.record.getOffsetFile() + readed - got,
+                                                        (ullint) got);
+                        auto d_predictSize = ar->getDecompressedSize(ibuf, got);
+                        if (obufHolder.size() < d_predictSize) {
+                            obufHolder = bufferPool.acquire(d_predictSize);
+                        }
+                        char *obuf = obufHolder.data();
+
+                        d_size = ar->decompressBlock(ibuf, got, obuf, d_predictSize);
+                        crc32.process_bytes(obuf, (size_t) d_size);
+                        decompressSpan.end(d_size);
+                        m.codec();
+
+                        stream.write(obuf, (std::streamsize) d_size);
+                        m.io();
+                    } else if (compress_method != CompressNone && general_flags & Streamed) {
+                        zpack_trace_span decompressSpan(tracer, ZPackTraceKind::DECOMPRESS, &sitem.filename,
+                                                        sitem.record.getOffsetFile() + readed - got,
+                                                        (ullint) got);
+                        ar->streamDecompressConsume(stream, ibuf, got, crc32_callback);
+                        d_size = ar->getStreamDecompressLastBytes();
+                        decompressSpan.end(d_size);
+                        m.codec();
+                    } else {
+                        stream.write(ibuf, got);
+                        m.io();
+                        crc32.process_bytes(ibuf, got);
+                        m.codec();
+                        d_size = (ullint) got;
+                    }
+
+                    m.bytesOut += d_size;
+                }
+            }
+
+            if (ar && general_flags & Streamed) {
+                ar->streamDecompressEnd();
+            }
+
+            crc32_result = crc32.checksum();
+            m.bytesIn = readed;
+            extractSpan.end(m.bytesOut);
+        }
+    } catch (std::runtime_error &e) {
+        std::cerr << "zpack::extract: Error with filesystem operation: " << e.what() << std::endl;
+        error_code = Errors::ERR_EXTRACT_GENERAL;
+        m.failed = true;
+    } catch (...) {
+        std::cerr << "zpack::extract: Error general" << std::endl;
+        error_code = Errors::ERR_EXTRACT_GENERAL;
+        m.failed = true;
+    };
 
-    #if ZPACK_DEBUG
-    std::cout << "CHECK CRC32 " << crc32_result << " against " << sitem.record.getCrc32() << std::endl;
-    #endif
     if (crc32_result != sitem.record.getCrc32()) {
         #if ZPACK_DEBUG
         std::cout << "WRONG CRC32 " << crc32_result << " against " << sitem.record.getCrc32() << std::endl;
         #endif
+        error_code = Errors::ERR_EXTRACT_GENERAL;
+        m.failed = true;
+        return false;
     }
 
-    return true;
+    return !m.failed;
+}
+
+// output of verify goes nowhere, only the checksum is of interest
+class _DiscardSink : public std::streambuf {
+protected:
+    std::streamsize xsputn(const char *, std::streamsize n) override {
+        return n;
+    }
+
+    int_type overflow(int_type c) override {
+        return traits_type::not_eof(c);
+    }
+};
+
+bool ZPack::verify(std::string const &name) {
+    auto item = list.find(name);
+    if (item == list.end()) return false;
+
+    _DiscardSink sink;
+    std::ostream stream(&sink);
+    return extract(item->second, stream);
 }
 
 std::string ZPack::extractStr(std::string const &name) {
@@ -592,9 +1890,36 @@ bool ZPack::extractFile(std::string const &name, std::string const &dest) try {
         fs::create_directories(doublePath);
     }
 
-    std::ofstream wfile(extractPath.c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    size_t targetBufSize = blockSizeBytes > blockSizeMax ? blockSizeMax : blockSizeBytes;
+    std::unique_ptr<_SparseWriteBuf> sparseTarget;
+    std::vector<_SparseHole> holes = sparseHolesOf(sitem);
+    if (!holes.empty()) {
+        sparseTarget.reset(new _SparseWriteBuf(targetBufSize, holes));
+        if (!sparseTarget->open(extractPath.c_str())) sparseTarget.reset();
+    }
 
-    extract(sitem, wfile);
+    std::unique_ptr<_DirectWriteBuf> directTarget;
+    if (!sparseTarget && directIO) {
+        directTarget.reset(new _DirectWriteBuf(targetBufSize));
+        if (!directTarget->open(extractPath.c_str())) directTarget.reset();
+    }
+
+    if (sparseTarget) {
+        std::ostream wfile(sparseTarget.get());
+        extract(sitem, wfile);
+        if (!sparseTarget->close()) {
+            error_code = Errors::ERR_EXTRACT_GENERAL;
+        }
+    } else if (directTarget) {
+        std::ostream wfile(directTarget.get());
+        extract(sitem, wfile);
+        if (!directTarget->close()) {
+            error_code = Errors::ERR_EXTRACT_GENERAL;
+        }
+    } else {
+        std::ofstream wfile(extractPath.c_str(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        extract(sitem, wfile);
+    }
 
     fs::perms perms = fs::perms::owner_read |
                       fs::perms::owner_write |
@@ -620,8 +1945,17 @@ bool ZPack::extractFile(std::string const &name, std::string const &dest) try {
 }
 
 void ZPack::repack() {
+    zpack_metrics_scope m(metrics, ZPackOperation::REPACK);
+    zpack_trace_span repackSpan(tracer, ZPackTraceKind::REPACK, nullptr, 0, borderOffset);
+
     if (!file.is_open()) {
         error_code = Errors::ERR_OPENING_ARCHIVE_FILE;
+        m.failed = true;
+        return;
+    }
+
+    if (!flushSolid()) {
+        m.failed = true;
         return;
     }
 
@@ -629,67 +1963,126 @@ void ZPack::repack() {
     std::fstream rfile(repack_file, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
     if (!rfile) {
         error_code = Errors::ERR_OPENING_REPACK_FILE;
+        m.failed = true;
         return;
     }
 
+    // copy items in on-disk order so the source is read sequentially
+    std::vector<std::pair<const std::string, DirectoryFileQueue> *> ordered;
+    ordered.reserve(list.size());
     for (auto &item : list) {
-        const std::string &name = item.first;
-        DirectoryFileQueue &data = item.second;
+        ordered.push_back(&item);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](
+        std::pair<const std::string, DirectoryFileQueue> *a,
+        std::pair<const std::string, DirectoryFileQueue> *b
+    ) {
+        return a->second.record.getOffsetRecord() < b->second.record.getOffsetRecord();
+    });
+
+    auto itemSpan = [](DirectoryFileQueue &data) -> ullint {
+        ullint span = data.record.getOffsetFile() - data.record.getOffsetRecord() + data.record.getCompressedSize();
+        if (data.record.getGeneral() & TrailingDescriptor) {
+            span += sizeof(DataDescriptorRecord);
+        }
+        return span;
+    };
 
-        ullint moved = 0;
-        ullint moved_max =
-            data.record.getCompressedSize() + sizeof(LocalFileHeaderRecord) + data.record.getFilenameLen() +
-            data.record.getExtraLen();
+    // items of one solid block share the record, the block is copied once for the first of them
+    ullint solidSource = solidPendingOffset;
+    ullint solidTarget = 0;
 
-        #if ZPACK_DEBUG
-        std::cout << "Repack file " << name << " with struct size " << sizeof(data.record) << " ("
-                  << sizeof(DirectoryFileHeaderRecord)
-                  << ")" << " align " << alignof(data.record) << std::endl
-                  << "filesize: " << data.record.getCompressedSize()
-                  << std::endl;
-        #endif
+    if (!ordered.empty()) {
+        ioHint(hintFd, ordered[0]->second.record.getOffsetRecord(), itemSpan(ordered[0]->second), IoHint::WILLNEED);
+    }
+
+    for (size_t i = 0; i < ordered.size(); i++) {
+        const std::string &name = ordered[i]->first;
+        DirectoryFileQueue &data = ordered[i]->second;
+        ullint sourceOffset = data.record.getOffsetRecord();
+        ullint dataShift = data.record.getOffsetFile() - sourceOffset;
+
+        if (data.record.getGeneral() & Solid && sourceOffset == solidSource) {
+            assignInt<ullint>(solidTarget, data.record.offsetRecord);
+            assignInt<ullint>(solidTarget + dataShift, data.record.offsetFile);
+            continue;
+        }
+
+        if (i + 1 < ordered.size()) {
+            DirectoryFileQueue &next = ordered[i + 1]->second;
+            ioHint(hintFd, next.record.getOffsetRecord(), itemSpan(next), IoHint::WILLNEED);
+        }
+
+        ullint moved = 0;
+        ullint moved_max = itemSpan(data);
 
         uint bufSize = blockSizeBytes;
         if (bufSize > blockSizeMax) bufSize = blockSizeMax;
         if (bufSize > moved_max) bufSize = (uint) moved_max;
-        char *buf = new char[bufSize];
+        zpack_buffer bufHolder = bufferPool.acquire(bufSize);
+        char *buf = bufHolder.data();
 
         try {
-            file.seekg(data.record.getOffsetRecord());
+            seekRead(data.record.getOffsetRecord());
 
             DirectoryFileHeaderRecord check_rec{};
             check_rec.read(file);
             if (check_rec.getSignature() != LocalHeader) {
                 error_code = Errors::ERR_READ_LOCAL_HEADER;
+                m.failed = true;
                 return;
             }
 
-            file.seekg(data.record.getOffsetRecord());
-            assignInt<ullint>((ullint) rfile.tellp(), data.record.offsetRecord);
-            assignInt<ullint>((ullint) rfile.tellp() + sizeof(LocalFileHeaderRecord) + data.record.getFilenameLen() +
-                              data.record.getExtraLen(), data.record.offsetFile);
+            seekRead(data.record.getOffsetRecord());
+            auto targetOffset = (ullint) rfile.tellp();
+            assignInt<ullint>(targetOffset, data.record.offsetRecord);
+            assignInt<ullint>(targetOffset + dataShift, data.record.offsetFile);
+            if (data.record.getGeneral() & Solid) {
+                solidSource = sourceOffset;
+                solidTarget = targetOffset;
+            }
             while (rfile && file && moved < moved_max) {
                 ullint moved_left = moved_max - moved;
-                file.read(buf, (uint) (moved_left > bufSize ? bufSize : moved_left));
-                moved += file.gcount();
-                rfile.write(buf, file.gcount());
+                uint readSize = (uint) (moved_left > bufSize ? bufSize : moved_left);
+                size_t got = 0;
+                {
+                    zpack_trace_span readSpan(tracer, ZPackTraceKind::READ, &name, sourceOffset + moved, readSize);
+                    got = readArchive(buf, readSize, sourceOffset + moved);
+                    readSpan.end(got);
+                }
+                if (got == 0) break;
+                {
+                    zpack_trace_span writeSpan(tracer, ZPackTraceKind::WRITE, &name,
+                                               data.record.getOffsetRecord() + moved, got);
+                    rfile.write(buf, (std::streamsize) got);
+                    writeSpan.end(got);
+                }
+                moved += got;
             }
+            m.bytesIn += moved;
+            m.bytesOut += moved;
         } catch (...) {
             error_code = Errors::ERR_UNKNOWN;
+            m.failed = true;
             std::cerr << "REPACK ERROR..." << std::endl
                       << "file:  " << file.good() << std::endl
                       << "rfile: " << rfile.good() << std::endl
                       << std::endl;
         }
 
-        #if ZPACK_DEBUG
-        std::cout << "Repack file " << name << " moved " << moved << std::endl << std::endl;
-        #endif
-
-        delete[] buf;
+        // the source archive is replaced after repack, no reason to keep its pages cached
+        ioHint(hintFd, sourceOffset, moved, IoHint::DONTNEED);
     }
 
-    this->writeDirectory(rfile);
+    if (this->writeDirectory(rfile) == directoryRefused) {
+        // the source archive stays in place
+        rfile.close();
+        boost::system::error_code ec;
+        fs::remove(repack_file, ec);
+        m.failed = true;
+        return;
+    }
+    repackSpan.end(stats.lastOffset);
 
     rfile.flush();
     rfile.close();
@@ -701,49 +2094,112 @@ void ZPack::repack() {
     open(archive_name.c_str());
 }
 
+size_t ZPack::rebuildDirectory() {
+    if (!file.is_open()) {
+        error_code = Errors::ERR_OPENING_ARCHIVE_FILE;
+        return 0;
+    }
+
+    flushSolid();
+    file.clear();
+    file.flush();
+
+    std::ifstream source(archive_name, std::ios_base::binary | std::ios_base::in);
+    zpack_scanner scanner(source);
+    std::unordered_map<std::string, DirectoryFileQueue> found;
+    ullint scannedEnd = 0;
+    // later records of a name replaced earlier ones when they were packed
+    while (scanner.next() && scanner.skip()) {
+        found[scanner.entry().filename] = scanner.entry();
+        scannedEnd = scanner.offset();
+    }
+
+    list = std::move(found);
+    nameIndexDirty = true;
+    solidCache.clear();
+
+    assignInt<ullint>(scannedEnd, dir_end.dirRecordOffset);
+    appendOffset = scannedEnd;
+    writeCursor = noWriteCursor;
+    error_code = Errors::OK;
+
+    return list.size();
+}
+
+ullint ZPack::warm(std::vector<std::string> const &names) {
+    std::vector<std::pair<ullint, ullint>> ranges;
+    for (auto const &name : names) {
+        auto item = list.find(name);
+        if (item == list.end() || item->second.record.getOffsetFile() == solidPendingOffset) continue;
+
+        ranges.emplace_back(item->second.record.getOffsetFile(), item->second.record.getCompressedSize());
+    }
+
+    std::sort(ranges.begin(), ranges.end());
+
+    // merge neighbours separated by small gaps into one request
+    const ullint gapMax = 64 * 1024;
+    ullint scheduled = 0;
+    size_t i = 0;
+    while (i < ranges.size()) {
+        ullint start = ranges[i].first;
+        ullint end = ranges[i].first + ranges[i].second;
+        for (i++; i < ranges.size() && ranges[i].first <= end + gapMax; i++) {
+            if (ranges[i].first + ranges[i].second > end) end = ranges[i].first + ranges[i].second;
+        }
+
+        if (ioHint(hintFd, start, end - start, IoHint::WILLNEED)) {
+            scheduled += end - start;
+        }
+    }
+
+    return scheduled;
+}
+
 ullint ZPack::writeDirectory(std::fstream &stream) {
     if (&stream == &file) {
         // that's mean that is not a "repack" operation
-        stream.seekp(dir_end.getRecordOffset());
+        seekWrite(dir_end.getRecordOffset());
     }
 
-    #if ZPACK_DEBUG
-    std::cout << "WRITE DIRECTIRY END. tellp: " << stream.tellp() << " tellg: " << stream.tellg() << std::endl;
-    #endif
-
     if (stream.tellp() == -1) {
         error_code = Errors::ERR_WRITE_WRONG_SEEK;
         return 0;
     }
 
+    zpack_trace_span dirSpan(tracer, ZPackTraceKind::DIRECTORY_WRITE, nullptr, (ullint) stream.tellp(), 0);
+
     stats = {0, 0, 0, 0, 0, 0};
-    uint dirSize = 0;
+    ullint dirSize = 0;
     ullint localsSize = 0;
     auto dirOffset = (ullint) stream.tellp();
+    std::unordered_set<ullint> solidBlocks;
+
+    // the whole directory is serialised first and leaves in a single write
+    std::string dirBuf;
+    dirBuf.reserve(list.size() * (sizeof(DirectoryFileHeaderRecord) + 64) + sizeof(EndOfDirectoryRecord));
     for (auto &item : list) {
         const std::string &name = item.first;
         DirectoryFileQueue &data = item.second;
 
-        stats.filesSizeCompressed += data.record.getCompressedSize();
+        bool solid = (data.record.getGeneral() & Solid) != 0;
+        if (!solid || solidBlocks.insert(data.record.getOffsetRecord()).second) {
+            stats.filesSizeCompressed += data.record.getCompressedSize();
+        }
         stats.filesSizeUncompressed += data.record.getUncompressedSize();
 
-        data.record.write(stream);
-        stream.write(name.c_str(), name.size());
+        if (!compressedDirectory) {
+            dirBuf.append((const char *) &data.record, sizeof(data.record));
+            dirBuf.append(name);
+        }
 
         for (LocalFileExtraField const &exItem : data.extra) {
-            exItem.write(stream);
+            if (!compressedDirectory) dirBuf.append((const char *) &exItem, sizeof(exItem));
             dirSize += sizeof(exItem);
             localsSize += sizeof(exItem);
         }
 
-        stream.write(data.comment.c_str(), data.comment.size());
-
-        #if ZPACK_DEBUG
-        std::cout << "pass: " << data.filename << std::endl
-                  << data.comment << " ^ " << data.comment.size() << std::endl
-                  << data.record.commentLen
-                  << std::endl << std::endl;
-        #endif
+        if (!compressedDirectory) dirBuf.append(data.comment);
 
         dirSize += sizeof(data.record);
         dirSize += data.filename.size();
@@ -754,22 +2210,44 @@ ullint ZPack::writeDirectory(std::fstream &stream) {
         localsSize += sizeof(LocalFileHeaderRecord);
     }
 
+    if (compressedDirectory) {
+        std::vector<DirectoryFileQueue const *> entries;
+        entries.reserve(list.size());
+        for (auto const &item : list) entries.push_back(&item.second);
+        dirBuf = packDirectory(std::move(entries));
+        dirSize = dirBuf.size();
+    }
+
+    if (dirSize > 0xFFFFFFFFULL) {
+        // a truncated size would make the archive unreadable, nothing is written
+        error_code = Errors::ERR_DIRECTORY_SIZE;
+        return directoryRefused;
+    }
+
     EndOfDirectoryRecord eodr{};
-    assignInt<uint>(DirectoryRecord, eodr.signature);
-    assignInt<usint>((usint) list.size(), eodr.recordsNumber);
-    assignInt<uint>(dirSize, eodr.dirRecordSize);
+    assignInt<uint>(compressedDirectory ? CompressedDirectoryRecord : DirectoryRecord, eodr.signature);
+    assignInt<usint>((usint) (list.size() > 0xFFFF ? 0xFFFF : list.size()), eodr.recordsNumber);
+    assignInt<uint>((uint) dirSize, eodr.dirRecordSize);
     assignInt<ullint>(dirOffset, eodr.dirRecordOffset);
     assignInt<usint>(0, eodr.commentLen);
 
-    eodr.write(stream);
+    dirBuf.append((const char *) &eodr, sizeof(eodr));
+    stream.write(dirBuf.data(), (std::streamsize) dirBuf.size());
     dir_end = eodr;
+    dirSpan.end(dirSize + sizeof(eodr));
 
     stats.archiveSize = stats.filesSizeCompressed + dirSize + sizeof(eodr) + localsSize;
     stats.records = (uint) list.size();
-    auto lastOffset = (ullint) stream.tellp();
+    ullint lastOffset = dirOffset + dirBuf.size();
+    if (&stream == &file) {
+        writeCursor = lastOffset;
+    }
     stats.lastOffset = lastOffset;
     stats.directoryOffset = eodr.getRecordOffset();
 
+    accountDirectory();
+    if (memoryBudget != 0) applyMemoryBudget();
+
     #if ZPACK_DEBUG
     std::cout << "Close #2 directory record with: " << std::endl
               << "dir size: " << eodr.getRecordSize() << std::endl
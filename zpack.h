@@ -8,14 +8,23 @@ typedef unsigned long long ullint;
 typedef long long llint;
 typedef unsigned char uchar;
 
+#include <atomic>
 #include <fstream>
 #include <iostream>
 #include <unordered_map>
+#include <list>
+#include <memory>
+#include <mutex>
 #include "boost/filesystem.hpp"
-#include "boost/crc.hpp"
 #include "_prepare_int.h"
 #include "zpack_compression.h"
 #include "zpack_zstd.h"
+#include "zpack_codec_registry.h"
+#include "zpack_metrics.h"
+#include "zpack_buffer_pool.h"
+#include "zpack_memory.h"
+#include "zpack_trace.h"
+#include "zpack_checksum.h"
 
 namespace fs = boost::filesystem;
 
@@ -85,6 +94,33 @@ struct LocalFileHeaderRecord {
     }
 };
 
+/*
+ * Trails the payload of items written by a forward-only writer, which cannot go back to patch the
+ * sizes and checksum of the local header. They are left zero in the header then.
+ */
+struct DataDescriptorRecord {
+    uchar signature[4];
+    uchar crc32[4];
+    uchar compressedSize[8];
+    uchar uncompressedSize[8];
+
+    uint getSignature() const {
+        return readInt<uint>(signature);
+    }
+
+    uint getCrc32() const {
+        return readInt<uint>(crc32);
+    }
+
+    ullint getCompressedSize() const {
+        return readInt<ullint>(compressedSize);
+    }
+
+    ullint getUncompressedSize() const {
+        return readInt<ullint>(uncompressedSize);
+    }
+};
+
 struct LocalFileExtraField {
     uchar id[2];
     uchar value[2];
@@ -240,6 +276,21 @@ struct EndOfDirectoryRecord {
     }
 };
 
+struct ZPackEntry {
+    std::string name;
+    ullint uncompressedSize;
+    ullint compressedSize;
+    llint mtime;
+    uint crc32;
+};
+
+struct ZPackSubtreeStats {
+    ullint items;
+    ullint uncompressedSize;
+    // solid blocks shared by several items of the subtree are counted once
+    ullint compressedSize;
+};
+
 struct ZPackStats {
     ullint filesSizeUncompressed;
     ullint filesSizeCompressed;
@@ -249,43 +300,132 @@ struct ZPackStats {
     ullint directoryOffset;
 };
 
+class zpack_snapshot;
+
+class _AlignedBuffer;
+
+struct _SparseHole;
+
 class ZPack {
     ullint borderOffset = 0;
+    // bigger than the default filebuf so small items and the directory leave in few large writes
+    static const uint fileBufferSize = 1024 * 1024;
+    std::unique_ptr<char[]> fileBuffer;
     std::fstream file;
+    // put position of file when known, lets sequential appends skip seekp and the flush it forces
+    static const ullint noWriteCursor = ~0ULL;
+    ullint writeCursor = noWriteCursor;
     std::string archive_name;
     std::unordered_map<std::string, DirectoryFileQueue> list;
+    // sorted view of list keys, rebuilt on the first ordered query after the names changed
+    std::vector<const std::string *> nameIndex;
+    bool nameIndexDirty = true;
     ZPackStats stats{0, 0, 0, 0, 0, 0};
 
     fs::path rootPath;
 
+    int hintFd = -1;
+    uint readAheadBlocks = 4;
+    // blocks in flight between the read, codec and write stages of large items, 1 runs them in turn
+    uint pipelineDepth = 3;
+
     uint blockSizeMax = 1024 * 1024 * 6;
     uint blockSizeBytes = blockSizeMax;
+    short int compressionLevel = 19;
+    // codecs keep their own default level until one is set
+    bool compressionLevelSet = false;
+    uint compressionWorkers = 0;
+    uint compressionJobSize = 0;
+    int compressionOverlapLog = 0;
+    ZPackChecksum checksumType = ZPackChecksum::CRC32;
+
+    // solid mode, small items are collected into one shared compressed block
+    uint solidBlockSize = 0;
+    uint solidItemMax = 0;
+    uint solidCacheBlocks = 4;
+    std::string solidPending;
+    std::vector<std::string> solidPendingNames;
+    std::list<std::pair<ullint, zpack_buffer>> solidCache;
+    static const ullint solidPendingOffset = ~0ULL;
+    // a block is flushed once it reaches its size, the last item adds at most one more block
+    static const ullint solidBlockMax = 2ULL * 1024 * 1024 * 6 + 1024 * 1024;
+
+    // concurrent writers append through writeFd at offsets reserved from appendOffset
+    bool concurrentWriters = false;
+    int writeFd = -1;
+    std::atomic<ullint> appendOffset{0};
+    // guards the directory and error_code while concurrent writers run
+    std::mutex directoryLock;
+
+    // bulk payload I/O around the page cache, directFd reads the archive with O_DIRECT
+    bool directIO = false;
+    int directFd = -1;
+    std::unique_ptr<_AlignedBuffer> directBounce;
+
+    // directory written front coded and zstd compressed, set from the archive on open
+    bool compressedDirectory = false;
+
+    // settings as configured, with a memory budget the ones in use are derived from them
+    ullint memoryBudget = 0;
+    size_t poolCachedConfigured = 0;
+    int compressionWindowLog = 0;
+    struct {
+        uint blockSize = 1024 * 1024 * 6;
+        uint pipelineDepth = 3;
+        uint workers = 0;
+        uint solidCacheBlocks = 4;
+    } configured;
+
+    // generation readers get from snapshot(), replaced atomically on every publish
+    bool snapshotsEnabled = false;
+    ullint snapshotGeneration = 0;
+    std::shared_ptr<const zpack_snapshot> published;
 
     bool shouldRepack = false;
 
     enum Signatures {
         LocalHeader = 0x0201534e,
         DirectoryEntry = 0x0605534e,
-        DirectoryRecord = 0x0807534e
+        DirectoryRecord = 0x0807534e,
+        DataDescriptor = 0x0a09534e,
+        // head of a compressed directory and the end record pointing at one, see _directory_codec.h
+        CompressedDirectory = 0x0c0b534e,
+        CompressedDirectoryRecord = 0x0e0d534e
     };
     enum ExtraFlags {
-        Permissions = 1
+        Permissions = 1,
+        // directory only, the hole map of a sparse file two bytes per field, see _sparse_io.h
+        SparseHoles = 2,
+        // directory only, level the payload was compressed with
+        CompressionLevel = 3
     };
     enum GeneralFlags {
-        Streamed = 1
-    };
-    enum Compression {
-        CompressNone = 0,
-        CompressZstd,
-        CompressZstdStream
+        Streamed = 1,
+        ChecksumXXH64 = 2,
+        Solid = 4,
+        // sizes and checksum follow the payload in a DataDescriptorRecord
+        TrailingDescriptor = 8
     };
-
     EndOfDirectoryRecord dir_end{};
 
+    // outlives the pool, which reports its allocations to it
+    zpack_memory memory;
+    zpack_buffer_pool bufferPool;
+    zpack_metrics metrics;
+    zpack_trace_listener *tracer = nullptr;
+
 public:
     static const short version = 1;
     static const short versionMin = 1;
 
+    // on-disk codec ids, see zpack_codec_registry
+    enum Compression {
+        CompressNone = 0,
+        CompressZstd,
+        CompressZstdStream,
+        CompressLz4
+    };
+
     enum class Errors {
         OK,
         ERR_READ_DIRECTORY_END,
@@ -301,11 +441,14 @@ public:
         ERR_PACK_ITEM_SIZE,
         ERR_EXTRACT_GENERAL,
         ERR_WRITE_WRONG_SEEK,
+        ERR_UNKNOWN_COMPRESSION,
+        ERR_READ_MANIFEST,
+        ERR_DIRECTORY_SIZE,
         ERR_UNKNOWN
     };
     Errors error_code = Errors::OK;
 
-    ZPack() = default;
+    ZPack();
 
     ~ZPack();
 
@@ -324,14 +467,148 @@ public:
 
     bool remove(std::string const &name);
 
+    bool contains(std::string const &name);
+
+    /*
+     * Entries with names starting with prefix in sorted order, fn returning false stops the walk.
+     */
+    void forEachEntry(std::string const &prefix, std::function<bool(ZPackEntry const &)> const &fn);
+
+    std::vector<std::string> listNames(std::string const &prefix = "");
+
+    /*
+     * fnmatch(3) pattern over the full item name, '*' also matches '/'.
+     */
+    std::vector<std::string> globNames(std::string const &pattern);
+
+    ZPackSubtreeStats subtreeStats(std::string const &prefix);
+
     bool extractFile(std::string const &name, std::string const &dest);
 
     std::string extractStr(std::string const &name);
 
+    /*
+     * Decompresses the item without writing it anywhere and checks its checksum. False for missing
+     * items, unreadable payload and checksum mismatches.
+     */
+    bool verify(std::string const &name);
+
     void repack();
 
+    /*
+     * Replaces the directory with one rebuilt by scanning the local records from the start of the
+     * archive, for archives whose directory is missing or damaged. The scan stops at the first record
+     * cut off by the end of file. Removed items come back and comments are lost, write() stores the
+     * result. Returns the number of items found.
+     */
+    size_t rebuildDirectory();
+
+    ullint warm(std::vector<std::string> const &names);
+
     ZPackStats getStats();
 
+    /*
+     * Parses a plain directory blob straight into entries, nothing of the blob is referenced after.
+     */
+    static Errors decodeDirectory(const uchar *blob, size_t size,
+                                  std::unordered_map<std::string, DirectoryFileQueue> &entries);
+
+    ZPackMetrics getMetrics() const;
+
+    void resetMetrics();
+
+    void setTraceListener(zpack_trace_listener *listener);
+
+    void setCompressionLevel(short int level);
+
+    /*
+     * Codec for items packed from now on, any id known to zpack_codec_registry. Items keep the codec
+     * they were packed with, extract picks it from the record.
+     */
+    bool setCompressionMethod(Compression method);
+
+    /*
+     * Compress streamed items with zstd worker threads, the produced frames stay the same format.
+     * jobSize and overlapLog of 0 keep the zstd defaults.
+     */
+    void setCompressionWorkers(uint workers, uint jobSize = 0, int overlapLog = 0);
+
+    void setBlockSize(uint size);
+
+    /*
+     * Items spanning several blocks are read, compressed and written by overlapping stages with depth
+     * blocks queued between them. 0 or 1 processes the blocks one after another on the calling thread.
+     */
+    void setPipelineDepth(uint depth);
+
+    void setChecksum(ZPackChecksum type);
+
+    /*
+     * Payload of packed and extracted files and archive reads of extract and repack bypass the page
+     * cache with O_DIRECT, unaligned heads and tails are handled internally. Archive writes stay
+     * buffered, their pages are dropped after every item. Without O_DIRECT support buffered I/O is used.
+     */
+    void setDirectIO(bool enable);
+
+    /*
+     * Write the directory compressed: names front coded in name order, fields as varints, the whole of
+     * it in one zstd frame. Large archives of similar paths get a directory several times smaller and
+     * faster to load. Archives are read in either format and keep theirs until this is called.
+     */
+    void setCompressedDirectory(bool enable);
+
+    /*
+     * Items up to itemSizeMax bytes (a quarter of the block by default, at most the block) are packed
+     * together into compressed blocks of blockSize bytes. Zero block size disables solid mode.
+     */
+    void setSolid(uint blockSize, uint itemSizeMax = 0);
+
+    void setSolidCacheBlocks(uint blocks);
+
+    /*
+     * packFile and packItem may be called from many threads at once. Every item reserves its own
+     * range at the end of the archive and is written there through a separate descriptor, items whose
+     * compressed size is not known up front are staged in a temporary file next to the archive first.
+     * Only the directory update is serialized. Other calls must not overlap with packing, solid
+     * collection is not used and trace listeners are called from the packing threads.
+     */
+    void setConcurrentWriters(bool enable);
+
+    /*
+     * Keep a published directory generation for snapshot(). A generation is published on every open,
+     * write and repack and on publish(), each one copies the directory.
+     */
+    void setSnapshots(bool enable);
+
+    /*
+     * Makes items packed so far visible to new snapshots without writing the directory.
+     */
+    void publish();
+
+    /*
+     * Current generation, safe to call from any thread while the owner keeps writing. nullptr when
+     * snapshots are off or the archive is closed.
+     */
+    std::shared_ptr<const zpack_snapshot> snapshot() const;
+
+    /*
+     * Keeps packing and extraction within about bytes of memory, 0 removes the limit. What the
+     * directory holds is taken off first, the rest is split between codec contexts and buffers:
+     * the compression window and its match tables, then worker threads are lowered until the codec
+     * fits its half, the pool cache, solid block cache, block size and pipeline depth until the
+     * buffers fit theirs. Configured values are kept and come back when the budget allows them.
+     * Decompression needs the window items were packed with and is not limited. Concurrent writers
+     * each hold a codec context and buffers, give every one of them its share of the budget.
+     */
+    void setMemoryBudget(ullint bytes);
+
+    // current and peak bytes per component, the directory figure is refreshed by the call
+    ZPackMemoryStats getMemoryStats();
+
+    void resetMemoryPeaks();
+
+    zpack_buffer_pool &getBufferPool();
+
     bool good();
 
     bool fail();
@@ -339,18 +616,118 @@ public:
     bool bad();
 
 private:
+    Compression compressionMethod = CompressZstd;
 
     bool packData(std::istream &stream, std::string const &itemname, fs::perms &perms, ullint fileSize = 0,
                   llint modificationTime = 0, std::string const &comment = "",
                   Compression compress_method = CompressZstd);
 
+    bool packSolid(std::istream &stream, std::string const &itemname, fs::perms &perms, ullint fileSize,
+                   llint modificationTime, std::string const &comment);
+
+    bool flushSolid();
+
+    void publishSnapshot();
+
+    bool packShared(std::istream &stream, std::string const &itemname, fs::perms &perms, ullint fileSize,
+                    llint modificationTime, std::string const &comment, Compression compress_method);
+
+    // error_code of a pack call, concurrent writers may report at the same time
+    void packError(Errors code);
+
+    static DirectoryFileQueue directoryEntry(LocalFileHeaderRecord const &header, LocalFileExtraField const &extra,
+                                             std::string const &itemname, std::string const &comment,
+                                             ullint offsetRecord);
+
+    static size_t directoryEntriesHint(EndOfDirectoryRecord &dirEnd, size_t blobSize);
+
+    void ensureNameIndex();
+
+    std::vector<const std::string *>::const_iterator nameIndexLowerBound(std::string const &prefix);
+
+    ZPackEntry entryInfo(DirectoryFileQueue const &item) const;
+
+    ullint packPipelined(std::istream &stream, std::string const &itemname, uint blockSize, zpack_compression *ar,
+                         zpack_checksum &crc32, zpack_metrics_scope &m, ullint dataOffset);
+
+    ullint extractPipelined(DirectoryFileQueue &sitem, std::ostream &stream, zpack_compression *ar,
+                            zpack_checksum &crc32, zpack_metrics_scope &m, uint blockSize);
+
+    const char *solidBlock(DirectoryFileQueue &sitem, size_t &blockSize);
+
+    void seekWrite(ullint offset);
+
+    void seekRead(ullint offset);
+
+    // payload read at offset, after seekRead to it when direct I/O is off
+    size_t readArchive(char *dest, size_t size, ullint offset);
+
+    void writeLocalHeader(LocalFileHeaderRecord const &header, std::string const &name,
+                          std::vector<LocalFileExtraField> const &extra);
+
+    static size_t fillLocalHeader(char *dest, LocalFileHeaderRecord const &header, std::string const &name,
+                                  std::vector<LocalFileExtraField> const &extra);
+
+    typedef std::function<std::unique_ptr<zpack_compression>(Compression &)> codec_factory;
+
+    // local header with the method, checksum and sizes left for sealLocalHeader
+    static LocalFileHeaderRecord localHeader(std::string const &name, LocalFileExtraField &extra, fs::perms perms,
+                                             llint modificationTime, ZPackChecksum checksum);
+
+    static void sealLocalHeader(LocalFileHeaderRecord &header, usint flags, Compression method, uint crc,
+                                ullint compressedSize, ullint uncompressedSize);
+
+    /*
+     * Complete record of an item held in one block: local header, name, extra and payload, the block
+     * is stored when it is too small to gain anything. Writers differ only in how the record reaches
+     * the archive.
+     */
+    static size_t packRecord(zpack_buffer &record, LocalFileHeaderRecord &header, std::string const &name,
+                             LocalFileExtraField const &extra, const char *block, size_t size, Compression &method,
+                             codec_factory const &codec, zpack_checksum &checksum, zpack_buffer_pool &pool);
+
     bool extract(DirectoryFileQueue &sitem, std::ostream &stream);
 
+    // replaces the directory only fields with the id, bytes are stored two per field. Leaves the entry
+    // as it is and returns false when the fields would not fit the 16 bit extraLen
+    static bool replaceExtra(DirectoryFileQueue &entry, usint id, std::string const &bytes);
+
+    // map bytes the entry has room for next to its other extra fields
+    static size_t extraCapacity(DirectoryFileQueue const &entry, usint id);
+
+    static std::string extraBytes(DirectoryFileQueue const &entry, usint id);
+
+    void recordSparseHoles(std::string const &itemname, std::vector<_SparseHole> const &holes);
+
+    static std::vector<_SparseHole> sparseHolesOf(DirectoryFileQueue const &sitem);
+
     usint readDirectory();
 
+    // returned by writeDirectory when the directory does not fit the 32 bit size of its end record
+    static const ullint directoryRefused = ~0ULL;
+
     ullint writeDirectory(std::fstream &stream);
 
     std::unique_ptr<zpack_compression> createCompression(Compression &method);
+
+    // level the codec of method compresses with, recorded in the CompressionLevel extra
+    short int codecLevel(Compression method);
+
+    void applyMemoryBudget();
+
+    void accountDirectory();
+
+    friend class zpack_snapshot;
+
+    friend class zpack_stream_writer;
+
+    friend class zpack_scanner;
+
+    friend class zpack_recompressor;
+
+    friend std::string packDirectory(std::vector<DirectoryFileQueue const *> entries);
+
+    friend bool unpackDirectory(const uchar *data, size_t size, std::vector<uchar> &blob);
 };
 
 #endif
\ No newline at end of file
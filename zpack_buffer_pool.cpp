@@ -0,0 +1,210 @@
+#include "zpack_buffer_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <sys/mman.h>
+
+static const size_t hugePageSize = 2u << 20;
+
+// size classes: powers of two from 4KB up to the huge page size, multiples of it above
+static size_t capacityFor(size_t size) {
+    if (size >= hugePageSize) {
+        return (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+    }
+
+    size_t capacity = 4096;
+    while (capacity < size) capacity <<= 1;
+    return capacity;
+}
+
+zpack_buffer::zpack_buffer(zpack_buffer_pool *pool, char *ptr, size_t capacity, size_t length)
+    : pool(pool), ptr(ptr), capacity(capacity), length(length) {}
+
+zpack_buffer::zpack_buffer(zpack_buffer &&other) noexcept
+    : pool(other.pool), ptr(other.ptr), capacity(other.capacity), length(other.length) {
+    other.pool = nullptr;
+    other.ptr = nullptr;
+    other.capacity = 0;
+    other.length = 0;
+}
+
+zpack_buffer &zpack_buffer::operator=(zpack_buffer &&other) noexcept {
+    if (this != &other) {
+        release();
+        pool = other.pool;
+        ptr = other.ptr;
+        capacity = other.capacity;
+        length = other.length;
+        other.pool = nullptr;
+        other.ptr = nullptr;
+        other.capacity = 0;
+        other.length = 0;
+    }
+    return *this;
+}
+
+zpack_buffer::~zpack_buffer() {
+    release();
+}
+
+void zpack_buffer::release() {
+    if (ptr != nullptr) {
+        if (pool != nullptr) {
+            pool->giveBack(ptr, capacity);
+        } else {
+            std::free(ptr);
+        }
+    }
+
+    pool = nullptr;
+    ptr = nullptr;
+    capacity = 0;
+    length = 0;
+}
+
+zpack_buffer_pool::zpack_buffer_pool(size_t maxCachedBytes) : maxCachedBytes(maxCachedBytes) {}
+
+zpack_buffer_pool::~zpack_buffer_pool() {
+    trim();
+}
+
+void zpack_buffer_pool::setHugePages(bool enable) {
+    std::lock_guard<std::mutex> guard(lock);
+    hugePages = enable;
+}
+
+void zpack_buffer_pool::setMaxCachedBytes(size_t bytes) {
+    std::vector<entry> dropped;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        maxCachedBytes = bytes;
+
+        // drop the biggest buffers first, small ones are the cheap and frequent ones
+        std::sort(cached.begin(), cached.end(), [](entry const &a, entry const &b) {
+            return a.capacity < b.capacity;
+        });
+        while (cachedBytes > maxCachedBytes && !cached.empty()) {
+            cachedBytes -= cached.back().capacity;
+            dropped.push_back(cached.back());
+            cached.pop_back();
+        }
+    }
+
+    for (auto &e : dropped) {
+        deallocate(e.ptr, e.capacity);
+    }
+}
+
+size_t zpack_buffer_pool::getMaxCachedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return maxCachedBytes;
+}
+
+void zpack_buffer_pool::setMemory(zpack_memory *accounting) {
+    std::lock_guard<std::mutex> guard(lock);
+    memory = accounting;
+}
+
+char *zpack_buffer_pool::allocate(size_t capacity) {
+    void *ptr = nullptr;
+    if (hugePages && capacity >= hugePageSize) {
+        if (posix_memalign(&ptr, hugePageSize, capacity) != 0) {
+            throw std::bad_alloc();
+        }
+        #if defined(MADV_HUGEPAGE)
+        madvise(ptr, capacity, MADV_HUGEPAGE);
+        #endif
+    } else {
+        ptr = std::malloc(capacity);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+    if (memory != nullptr) memory->hold(ZPackMemoryComponent::BUFFERS, capacity);
+
+    return (char *) ptr;
+}
+
+void zpack_buffer_pool::deallocate(char *ptr, size_t capacity) {
+    std::free(ptr);
+    if (memory != nullptr) memory->release(ZPackMemoryComponent::BUFFERS, capacity);
+}
+
+zpack_buffer zpack_buffer_pool::acquire(size_t size) {
+    if (size == 0) size = 1;
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stats.acquired++;
+
+        // best fit, never hand out a buffer more than 4 times the size class of the asked one
+        size_t limit = capacityFor(size) * 4;
+        auto best = cached.end();
+        for (auto it = cached.begin(); it != cached.end(); ++it) {
+            if (it->capacity >= size && it->capacity <= limit &&
+                (best == cached.end() || it->capacity < best->capacity)) {
+                best = it;
+            }
+        }
+
+        if (best != cached.end()) {
+            entry e = *best;
+            *best = cached.back();
+            cached.pop_back();
+            cachedBytes -= e.capacity;
+            stats.reused++;
+            return zpack_buffer(this, e.ptr, e.capacity, size);
+        }
+
+        stats.allocated++;
+    }
+
+    size_t capacity = capacityFor(size);
+    return zpack_buffer(this, allocate(capacity), capacity, size);
+}
+
+zpack_buffer zpack_buffer_pool::acquire(zpack_buffer_pool *pool, size_t size) {
+    if (pool != nullptr) {
+        return pool->acquire(size);
+    }
+
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return zpack_buffer(nullptr, (char *) ptr, size, size);
+}
+
+void zpack_buffer_pool::giveBack(char *ptr, size_t capacity) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (cachedBytes + capacity <= maxCachedBytes) {
+            cached.push_back({ptr, capacity});
+            cachedBytes += capacity;
+            return;
+        }
+    }
+
+    deallocate(ptr, capacity);
+}
+
+void zpack_buffer_pool::trim() {
+    std::vector<entry> dropped;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        dropped.swap(cached);
+        cachedBytes = 0;
+    }
+
+    for (auto &e : dropped) {
+        deallocate(e.ptr, e.capacity);
+    }
+}
+
+ZPackBufferPoolStats zpack_buffer_pool::getStats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    ZPackBufferPoolStats res = stats;
+    res.cachedBuffers = cached.size();
+    res.cachedBytes = cachedBytes;
+    return res;
+}
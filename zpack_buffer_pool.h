@@ -0,0 +1,110 @@
+#ifndef ZPACK_BUFFER_POOL_H
+#define ZPACK_BUFFER_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+#include "zpack_memory.h"
+
+class zpack_buffer_pool;
+
+/*
+ * Borrowed buffer, returns its memory to the pool when destroyed. A buffer acquired without a pool
+ * owns its memory and frees it instead.
+ */
+class zpack_buffer {
+    friend class zpack_buffer_pool;
+
+    zpack_buffer_pool *pool = nullptr;
+    char *ptr = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+
+    zpack_buffer(zpack_buffer_pool *pool, char *ptr, size_t capacity, size_t length);
+
+public:
+    zpack_buffer() = default;
+
+    zpack_buffer(zpack_buffer const &) = delete;
+
+    zpack_buffer &operator=(zpack_buffer const &) = delete;
+
+    zpack_buffer(zpack_buffer &&other) noexcept;
+
+    zpack_buffer &operator=(zpack_buffer &&other) noexcept;
+
+    ~zpack_buffer();
+
+    char *data() const {
+        return ptr;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    void release();
+};
+
+struct ZPackBufferPoolStats {
+    unsigned long long acquired = 0;
+    unsigned long long reused = 0;
+    unsigned long long allocated = 0;
+    unsigned long long cachedBuffers = 0;
+    unsigned long long cachedBytes = 0;
+};
+
+class zpack_buffer_pool {
+    struct entry {
+        char *ptr;
+        size_t capacity;
+    };
+
+    mutable std::mutex lock;
+    std::vector<entry> cached;
+    size_t cachedBytes = 0;
+    size_t maxCachedBytes;
+    bool hugePages = false;
+    zpack_memory *memory = nullptr;
+    ZPackBufferPoolStats stats{};
+
+    char *allocate(size_t capacity);
+
+    void deallocate(char *ptr, size_t capacity);
+
+    void giveBack(char *ptr, size_t capacity);
+
+public:
+    explicit zpack_buffer_pool(size_t maxCachedBytes = 64u << 20);
+
+    zpack_buffer_pool(zpack_buffer_pool const &) = delete;
+
+    zpack_buffer_pool &operator=(zpack_buffer_pool const &) = delete;
+
+    ~zpack_buffer_pool();
+
+    /*
+     * Back buffers of 2MB and more with transparent huge pages. Affects only buffers allocated after
+     * the call.
+     */
+    void setHugePages(bool enable);
+
+    void setMaxCachedBytes(size_t bytes);
+
+    size_t getMaxCachedBytes() const;
+
+    // allocated buffers, cached ones included, are counted as BUFFERS. Set before the first acquire
+    void setMemory(zpack_memory *accounting);
+
+    zpack_buffer acquire(size_t size);
+
+    static zpack_buffer acquire(zpack_buffer_pool *pool, size_t size);
+
+    void trim();
+
+    ZPackBufferPoolStats getStats() const;
+
+    friend class zpack_buffer;
+};
+
+#endif //ZPACK_BUFFER_POOL_H
@@ -0,0 +1,307 @@
+#include "zpack_checksum.h"
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ZPACK_CRC32_CLMUL 1
+#include <immintrin.h>
+#endif
+
+namespace {
+    struct Crc32Tables {
+        uint32_t table[8][256];
+
+        Crc32Tables() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) {
+                    c = c & 1 ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+                }
+                table[0][i] = c;
+            }
+
+            for (uint32_t i = 0; i < 256; i++) {
+                for (int t = 1; t < 8; t++) {
+                    table[t][i] = (table[t - 1][i] >> 8) ^ table[0][table[t - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+
+    const Crc32Tables &crc32Tables() {
+        static const Crc32Tables tables;
+        return tables;
+    }
+
+    inline uint32_t load32(const unsigned char *p) {
+        return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+    }
+
+    inline uint64_t load64(const unsigned char *p) {
+        return (uint64_t) load32(p) | ((uint64_t) load32(p + 4) << 32);
+    }
+
+    // operates on the inverted register, as every function below
+    uint32_t crc32Slicing8(uint32_t crc, const unsigned char *buf, size_t size) {
+        auto const &t = crc32Tables().table;
+
+        while (size >= 8) {
+            uint32_t lo = load32(buf) ^ crc;
+            uint32_t hi = load32(buf + 4);
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                  t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+            buf += 8;
+            size -= 8;
+        }
+
+        while (size-- > 0) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *buf++) & 0xFF];
+        }
+
+        return crc;
+    }
+
+    #if ZPACK_CRC32_CLMUL
+
+    /*
+     * Folding with PCLMULQDQ as described in Intel's "Fast CRC Computation for Generic Polynomials
+     * Using PCLMULQDQ Instruction", bit-reflected constants for the IEEE polynomial.
+     * Requires size >= 64 and a multiple of 16.
+     */
+    __attribute__((target("pclmul,sse4.1")))
+    uint32_t crc32Clmul(uint32_t crc, const unsigned char *buf, size_t size) {
+        alignas(16) static const uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+        alignas(16) static const uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+        alignas(16) static const uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+        alignas(16) static const uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+        x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+        x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+        x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+        x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+        x0 = _mm_load_si128((const __m128i *) k1k2);
+
+        buf += 64;
+        size -= 64;
+
+        while (size >= 64) {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+            y5 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+            y6 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+            y7 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+            y8 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+
+            buf += 64;
+            size -= 64;
+        }
+
+        // fold the four lanes into one
+        x0 = _mm_load_si128((const __m128i *) k3k4);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        while (size >= 16) {
+            x2 = _mm_loadu_si128((const __m128i *) buf);
+
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+            buf += 16;
+            size -= 16;
+        }
+
+        // 128 -> 64 bits
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_srli_si128(x1, 8);
+        x1 = _mm_xor_si128(x1, x2);
+
+        x0 = _mm_loadl_epi64((const __m128i *) k5k0);
+
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduction to 32 bits
+        x0 = _mm_load_si128((const __m128i *) poly);
+
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        return (uint32_t) _mm_extract_epi32(x1, 1);
+    }
+
+    bool crc32ClmulSupported() {
+        static const bool supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+        return supported;
+    }
+
+    #endif
+
+    const uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+    const uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+    inline uint64_t rotl64(uint64_t x, int r) {
+        return (x << r) | (x >> (64 - r));
+    }
+
+    inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+        acc += input * XXH_PRIME64_2;
+        acc = rotl64(acc, 31);
+        return acc * XXH_PRIME64_1;
+    }
+
+    inline uint64_t xxhMerge(uint64_t acc, uint64_t val) {
+        acc ^= xxhRound(0, val);
+        return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+}
+
+uint32_t checksumCrc32(uint32_t crc, const void *buf, size_t size) {
+    auto p = (const unsigned char *) buf;
+    crc = ~crc;
+
+    #if ZPACK_CRC32_CLMUL
+    if (size >= 64 && crc32ClmulSupported()) {
+        size_t chunk = size & ~(size_t) 15;
+        crc = crc32Clmul(crc, p, chunk);
+        p += chunk;
+        size -= chunk;
+    }
+    #endif
+
+    return ~crc32Slicing8(crc, p, size);
+}
+
+zpack_checksum::zpack_checksum(ZPackChecksum type) : type(type) {
+    acc[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    acc[1] = XXH_PRIME64_2;
+    acc[2] = 0;
+    acc[3] = 0 - XXH_PRIME64_1;
+}
+
+void zpack_checksum::process_bytes(const void *buf, size_t size) {
+    if (type == ZPackChecksum::XXHASH64) {
+        xxhUpdate((const unsigned char *) buf, size);
+    } else {
+        crc = checksumCrc32(crc, buf, size);
+    }
+}
+
+uint32_t zpack_checksum::checksum() const {
+    if (type == ZPackChecksum::XXHASH64) {
+        return (uint32_t) xxhDigest();
+    }
+
+    return crc;
+}
+
+void zpack_checksum::xxhUpdate(const unsigned char *buf, size_t size) {
+    total += size;
+
+    if (tailSize + size < 32) {
+        std::memcpy(tail + tailSize, buf, size);
+        tailSize += size;
+        return;
+    }
+
+    if (tailSize > 0) {
+        size_t fill = 32 - tailSize;
+        std::memcpy(tail + tailSize, buf, fill);
+        for (int i = 0; i < 4; i++) {
+            acc[i] = xxhRound(acc[i], load64(tail + i * 8));
+        }
+        buf += fill;
+        size -= fill;
+        tailSize = 0;
+    }
+
+    while (size >= 32) {
+        acc[0] = xxhRound(acc[0], load64(buf));
+        acc[1] = xxhRound(acc[1], load64(buf + 8));
+        acc[2] = xxhRound(acc[2], load64(buf + 16));
+        acc[3] = xxhRound(acc[3], load64(buf + 24));
+        buf += 32;
+        size -= 32;
+    }
+
+    std::memcpy(tail, buf, size);
+    tailSize = size;
+}
+
+uint64_t zpack_checksum::xxhDigest() const {
+    uint64_t h;
+    if (total >= 32) {
+        h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = xxhMerge(h, acc[i]);
+        }
+    } else {
+        h = acc[2] + XXH_PRIME64_5;
+    }
+
+    h += total;
+
+    const unsigned char *p = tail;
+    size_t left = tailSize;
+    while (left >= 8) {
+        h ^= xxhRound(0, load64(p));
+        h = rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+        left -= 8;
+    }
+
+    if (left >= 4) {
+        h ^= (uint64_t) load32(p) * XXH_PRIME64_1;
+        h = rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+        left -= 4;
+    }
+
+    while (left-- > 0) {
+        h ^= (*p++) * XXH_PRIME64_5;
+        h = rotl64(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
@@ -0,0 +1,41 @@
+#ifndef ZPACK_CHECKSUM_H
+#define ZPACK_CHECKSUM_H
+
+#include <cstddef>
+#include <cstdint>
+
+enum class ZPackChecksum {
+    CRC32,
+    XXHASH64
+};
+
+uint32_t checksumCrc32(uint32_t crc, const void *buf, size_t size);
+
+/*
+ * Running checksum with the boost::crc_32_type interface. CRC32 is the IEEE polynomial used by
+ * archives written so far (carry-less multiply folding when the CPU has it, slicing-by-8 otherwise),
+ * XXH64 is stored truncated to its low 32 bits to fit the crc32 header field.
+ */
+class zpack_checksum {
+    ZPackChecksum type;
+
+    uint32_t crc = 0;
+
+    uint64_t acc[4];
+    unsigned char tail[32];
+    size_t tailSize = 0;
+    uint64_t total = 0;
+
+    void xxhUpdate(const unsigned char *buf, size_t size);
+
+    uint64_t xxhDigest() const;
+
+public:
+    explicit zpack_checksum(ZPackChecksum type = ZPackChecksum::CRC32);
+
+    void process_bytes(const void *buf, size_t size);
+
+    uint32_t checksum() const;
+};
+
+#endif //ZPACK_CHECKSUM_H
@@ -0,0 +1,50 @@
+#include "zpack_codec_registry.h"
+#include <map>
+#include <mutex>
+#include "zpack_zstd.h"
+#include "zpack_lz4.h"
+
+namespace {
+    struct registry {
+        std::mutex lock;
+        std::map<unsigned short, zpack_codec_registry::factory> codecs;
+
+        registry() {
+            auto zstd = [] { return std::unique_ptr<zpack_compression>(new zpack_zstd()); };
+            codecs[1] = zstd;
+            codecs[2] = zstd;
+            codecs[3] = [] { return std::unique_ptr<zpack_compression>(new zpack_lz4()); };
+        }
+    };
+
+    registry &instance() {
+        static registry codecs;
+        return codecs;
+    }
+}
+
+void zpack_codec_registry::add(unsigned short id, factory create) {
+    registry &reg = instance();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    reg.codecs[id] = std::move(create);
+}
+
+bool zpack_codec_registry::has(unsigned short id) {
+    registry &reg = instance();
+    std::lock_guard<std::mutex> guard(reg.lock);
+    return reg.codecs.count(id) > 0;
+}
+
+std::unique_ptr<zpack_compression> zpack_codec_registry::create(unsigned short id) {
+    registry &reg = instance();
+    factory create;
+    {
+        std::lock_guard<std::mutex> guard(reg.lock);
+        auto codec = reg.codecs.find(id);
+        if (codec == reg.codecs.end())
+            return nullptr;
+        create = codec->second;
+    }
+
+    return create();
+}
@@ -0,0 +1,24 @@
+#ifndef ZPACK_CODEC_REGISTRY_H
+#define ZPACK_CODEC_REGISTRY_H
+
+#include <functional>
+#include <memory>
+#include "zpack_compression.h"
+
+/*
+ * Codecs keyed by the compression id stored in item headers. zstd (ids 1 and 2) and LZ4 (id 3) are
+ * registered by default, applications may add their own ids.
+ */
+class zpack_codec_registry {
+public:
+    typedef std::function<std::unique_ptr<zpack_compression>()> factory;
+
+    static void add(unsigned short id, factory create);
+
+    static bool has(unsigned short id);
+
+    // nullptr for an unknown id
+    static std::unique_ptr<zpack_compression> create(unsigned short id);
+};
+
+#endif //ZPACK_CODEC_REGISTRY_H
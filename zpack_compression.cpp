@@ -4,6 +4,48 @@
 
 #include "zpack_compression.h"
 
+zpack_compression::~zpack_compression() {
+    holdContext(0);
+}
+
+void zpack_compression::setCompressionLevel(short int level) {
+    compressionLevel = level;
+}
+
+short int zpack_compression::getCompressionLevel() const {
+    return compressionLevel;
+}
+
+void zpack_compression::setBufferPool(zpack_buffer_pool *pool) {
+    bufferPool = pool;
+}
+
+void zpack_compression::setWorkers(unsigned int count, unsigned int job, int overlap) {
+    workers = count;
+    jobSize = job;
+    overlapLog = overlap;
+}
+
+void zpack_compression::setWindowLog(int log) {
+    windowLog = log;
+}
+
+void zpack_compression::setMemory(zpack_memory *accounting) {
+    memory = accounting;
+}
+
+unsigned long long zpack_compression::getContextSize() {
+    return 0;
+}
+
+void zpack_compression::holdContext(unsigned long long bytes) {
+    if (memory != nullptr) {
+        if (bytes > contextBytes) memory->hold(ZPackMemoryComponent::CODEC, bytes - contextBytes);
+        else memory->release(ZPackMemoryComponent::CODEC, contextBytes - bytes);
+    }
+    contextBytes = bytes;
+}
+
 unsigned long long zpack_compression::getStreamCompressBytes() {
     return streamCompressed;
 }
@@ -13,25 +13,65 @@
 #include <cstdlib>
 #include <boost/crc.hpp>
 #include <functional>
+#include "zpack_buffer_pool.h"
+#include "zpack_memory.h"
 
 class zpack_compression {
 protected:
     short int compressionLevel = 19;
+    unsigned int workers = 0;
+    unsigned int jobSize = 0;
+    int overlapLog = 0;
+    int windowLog = 0;
 
     char streamType = 'n';
     size_t streamBufSize = 0;
     void *streamBuf = nullptr;
+    zpack_buffer_pool *bufferPool = nullptr;
+    zpack_memory *memory = nullptr;
+    unsigned long long contextBytes = 0;
+    zpack_buffer streamBuffer;
     ZSTD_CStream *zstd_cStream = nullptr;
     ZSTD_DStream *zstd_dStream = nullptr;
     unsigned long long streamCompressed = 0;
     unsigned long long streamDecompressed = 0;
 
+    // codec context currently allocated, reported to memory as CODEC
+    void holdContext(unsigned long long bytes);
+
 public:
     size_t streamDecompressLastConsume = 0;
 
     zpack_compression() = default;
 
-    virtual ~zpack_compression() = default;
+    virtual ~zpack_compression();
+
+    void setCompressionLevel(short int level);
+
+    // level used when none was set, codecs with their own scale start from their own default
+    short int getCompressionLevel() const;
+
+    void setBufferPool(zpack_buffer_pool *pool);
+
+    /*
+     * Worker threads for stream compression, 0 compresses on the calling thread. Job size and overlap
+     * are passed to the codec as is, 0 leaves its defaults.
+     */
+    void setWorkers(unsigned int count, unsigned int job = 0, int overlap = 0);
+
+    /*
+     * Upper bound of the compression window as a power of two, match tables shrink along with it.
+     * Only lowers what the level would use, 0 leaves the level defaults.
+     */
+    void setWindowLog(int log);
+
+    void setMemory(zpack_memory *accounting);
+
+    /*
+     * Estimated bytes of a compression context with the current level, window and workers, 0 when
+     * the codec does not know.
+     */
+    virtual unsigned long long getContextSize();
 
     unsigned long long getStreamCompressBytes();
 
@@ -0,0 +1,231 @@
+#include "zpack_lz4.h"
+
+static const size_t lz4StreamOutSize = 256 * 1024;
+
+const short int zpack_lz4::defaultLevel;
+
+zpack_lz4::zpack_lz4() {
+    compressionLevel = defaultLevel;
+}
+
+zpack_lz4::~zpack_lz4() {
+    LZ4F_freeCompressionContext(lz4_cStream);
+    LZ4F_freeDecompressionContext(lz4_dStream);
+}
+
+LZ4F_preferences_t zpack_lz4::preferences(unsigned long long contentSize) const {
+    LZ4F_preferences_t prefs;
+    std::memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs.frameInfo.contentSize = contentSize;
+    prefs.compressionLevel = compressionLevel > 12 ? 12 : compressionLevel;
+    return prefs;
+}
+
+unsigned long long zpack_lz4::getCompressedSize(size_t size) {
+    LZ4F_preferences_t prefs = preferences(size);
+    return LZ4F_compressFrameBound(size, &prefs);
+}
+
+unsigned long long zpack_lz4::compressBlock(const char *ibuf, size_t isize, char *obuf, size_t osize) {
+    LZ4F_preferences_t prefs = preferences(isize);
+    size_t compressed_len = LZ4F_compressFrame(obuf, osize, ibuf, isize, &prefs);
+    if (LZ4F_isError(compressed_len)) {
+        throw std::runtime_error(std::string("zpack_lz4::compressBlock error: ") + LZ4F_getErrorName(compressed_len));
+    }
+
+    return compressed_len;
+}
+
+unsigned long long zpack_lz4::getDecompressedSize(const char *ibuf, size_t isize) {
+    LZ4F_dctx *dctx = nullptr;
+    size_t res = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    if (LZ4F_isError(res)) {
+        throw std::runtime_error(std::string("zpack_lz4::getDecompressedSize: ") + LZ4F_getErrorName(res));
+    }
+
+    LZ4F_frameInfo_t info;
+    size_t consumed = isize;
+    res = LZ4F_getFrameInfo(dctx, &info, ibuf, &consumed);
+    LZ4F_freeDecompressionContext(dctx);
+    if (LZ4F_isError(res)) {
+        throw std::runtime_error(std::string("zpack_lz4::getDecompressedSize: ") + LZ4F_getErrorName(res));
+    }
+
+    if (info.contentSize == 0) {
+        throw std::runtime_error("zpack_lz4::getDecompressedSize: The size cannot be determined");
+    }
+
+    return info.contentSize;
+}
+
+unsigned long long zpack_lz4::decompressBlock(const char *ibuf, size_t isize, char *obuf, size_t osize) {
+    LZ4F_dctx *dctx = nullptr;
+    size_t res = LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+    if (LZ4F_isError(res)) {
+        throw std::runtime_error(std::string("zpack_lz4::decompressBlock: ") + LZ4F_getErrorName(res));
+    }
+
+    size_t consumed = 0;
+    size_t produced = 0;
+    do {
+        size_t src = isize - consumed;
+        size_t dst = osize - produced;
+        res = LZ4F_decompress(dctx, obuf + produced, &dst, ibuf + consumed, &src, nullptr);
+        consumed += src;
+        produced += dst;
+    } while (!LZ4F_isError(res) && res != 0 && consumed < isize && produced < osize);
+    LZ4F_freeDecompressionContext(dctx);
+
+    if (LZ4F_isError(res)) {
+        throw std::runtime_error(std::string("zpack_lz4::decompressBlock: ") + LZ4F_getErrorName(res));
+    }
+
+    if (res != 0) {
+        throw std::runtime_error("zpack_lz4::decompressBlock: frame is not complete");
+    }
+
+    return produced;
+}
+
+void zpack_lz4::streamReserve(size_t size) {
+    if (streamBuffer.size() < size) {
+        streamBuffer = zpack_buffer_pool::acquire(bufferPool, size);
+        streamBuf = streamBuffer.data();
+        streamBufSize = streamBuffer.size();
+    }
+}
+
+bool zpack_lz4::streamCompressSetup() {
+    if (streamType == 'D')
+        return false;
+
+    streamType = 'C';
+    streamBegun = false;
+
+    size_t res = LZ4F_createCompressionContext(&lz4_cStream, LZ4F_VERSION);
+    if (LZ4F_isError(res)) {
+        throw std::runtime_error(std::string("LZ4F_createCompressionContext error: ") + LZ4F_getErrorName(res));
+    }
+
+    streamReserve(LZ4F_HEADER_SIZE_MAX);
+
+    return true;
+}
+
+void zpack_lz4::streamCompressConsume(std::ostream &write, const char *buf, size_t size) {
+    LZ4F_preferences_t prefs = preferences(0);
+
+    if (!streamBegun) {
+        size_t header = LZ4F_compressBegin(lz4_cStream, streamBuf, streamBufSize, &prefs);
+        if (LZ4F_isError(header)) {
+            throw std::runtime_error(
+                std::string("zpack_lz4::streamCompressConsume error: ") + LZ4F_getErrorName(header));
+        }
+
+        write.write((char *) streamBuf, header);
+        streamCompressed += header;
+        streamBegun = true;
+    }
+
+    // bound the output of every call, the compressor keeps up to a block of input between calls
+    size_t chunkMax = lz4StreamOutSize;
+    size_t consumed = 0;
+    while (consumed < size) {
+        size_t chunk = size - consumed > chunkMax ? chunkMax : size - consumed;
+        streamReserve(LZ4F_compressBound(chunk, &prefs));
+
+        size_t written = LZ4F_compressUpdate(lz4_cStream, streamBuf, streamBufSize, buf + consumed, chunk, nullptr);
+        if (LZ4F_isError(written)) {
+            throw std::runtime_error(
+                std::string("zpack_lz4::streamCompressConsume error: ") + LZ4F_getErrorName(written));
+        }
+
+        write.write((char *) streamBuf, written);
+        streamCompressed += written;
+        consumed += chunk;
+    }
+}
+
+void zpack_lz4::streamCompressEnd(std::ostream &write) {
+    if (!streamBegun) {
+        streamCompressConsume(write, nullptr, 0);
+    }
+
+    LZ4F_preferences_t prefs = preferences(0);
+    streamReserve(LZ4F_compressBound(0, &prefs));
+
+    size_t written = LZ4F_compressEnd(lz4_cStream, streamBuf, streamBufSize, nullptr);
+    if (LZ4F_isError(written)) {
+        throw std::runtime_error(std::string("zpack_lz4::streamCompressEnd error: ") + LZ4F_getErrorName(written));
+    }
+
+    write.write((char *) streamBuf, written);
+    streamCompressed += written;
+
+    streamBuffer.release();
+    streamBuf = nullptr;
+    LZ4F_freeCompressionContext(lz4_cStream);
+    lz4_cStream = nullptr;
+}
+
+bool zpack_lz4::streamDecompressSetup() {
+    if (streamType == 'C')
+        return false;
+
+    streamType = 'D';
+
+    size_t res = LZ4F_createDecompressionContext(&lz4_dStream, LZ4F_VERSION);
+    if (LZ4F_isError(res)) {
+        std::cerr << "LZ4F_createDecompressionContext error: " << LZ4F_getErrorName(res) << std::endl;
+        return false;
+    }
+
+    streamReserve(lz4StreamOutSize);
+
+    return true;
+}
+
+void zpack_lz4::streamDecompressConsume(std::ostream &write, const char *buf, size_t size) {
+    streamDecompressConsume(write, buf, size, nullptr);
+}
+
+void zpack_lz4::streamDecompressConsume(std::ostream &write, const char *buf, size_t size,
+                                        std::function<void(const char *, size_t)> fn) {
+    size_t consumed = 0;
+    size_t session_size = 0;
+
+    // loop also when the input is used up, the decoder may still hold output of the last block
+    while (true) {
+        size_t src = size - consumed;
+        size_t dst = streamBufSize;
+        size_t res = LZ4F_decompress(lz4_dStream, streamBuf, &dst, buf + consumed, &src, nullptr);
+        if (LZ4F_isError(res)) {
+            throw std::runtime_error(
+                std::string("zpack_lz4::streamDecompressConsume error: ") + LZ4F_getErrorName(res));
+        }
+        consumed += src;
+
+        write.write((char *) streamBuf, dst);
+        if (fn != nullptr) {
+            fn((const char *) streamBuf, dst);
+        }
+
+        session_size += dst;
+        streamDecompressed += dst;
+
+        if (dst == 0 && (consumed >= size || src == 0))
+            break;
+    }
+
+    streamDecompressLastConsume = session_size;
+}
+
+bool zpack_lz4::streamDecompressEnd() {
+    streamBuffer.release();
+    streamBuf = nullptr;
+    LZ4F_freeDecompressionContext(lz4_dStream);
+    lz4_dStream = nullptr;
+
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef PACKER_ZPACK_LZ4_H
+#define PACKER_ZPACK_LZ4_H
+
+#include <string>
+#include <cstring>
+#include <lz4frame.h>
+#include <iostream>
+#include <functional>
+#include "zpack_compression.h"
+
+/*
+ * LZ4 frame codec for items that are read far more often than written. Levels below 3 use the fast
+ * compressor, 3 and above LZ4-HC (capped at its maximum of 12), decoding speed is the same for both.
+ * Without an explicit level the codec runs the fast compressor at defaultLevel, the zstd oriented
+ * default of ZPack is not carried over.
+ */
+class zpack_lz4 : public zpack_compression {
+    LZ4F_cctx *lz4_cStream = nullptr;
+    LZ4F_dctx *lz4_dStream = nullptr;
+    bool streamBegun = false;
+
+    LZ4F_preferences_t preferences(unsigned long long contentSize) const;
+
+    void streamReserve(size_t size);
+
+public:
+    static const short int defaultLevel = 0;
+
+    zpack_lz4();
+
+    ~zpack_lz4() override;
+
+    unsigned long long
+    getCompressedSize(size_t size) override;
+
+    unsigned long long
+    compressBlock(const char *ibuf, size_t isize, char *obuf, size_t osize) override;
+
+    unsigned long long
+    getDecompressedSize(const char *ibuf, size_t isize) override;
+
+    unsigned long long
+    decompressBlock(const char *ibuf, size_t isize, char *obuf, size_t osize) override;
+
+    bool streamCompressSetup() override;
+
+    void streamCompressConsume(std::ostream &write, const char *buf, size_t size) override;
+
+    void streamCompressEnd(std::ostream &write) override;
+
+    bool streamDecompressSetup() override;
+
+    void streamDecompressConsume(std::ostream &write, const char *buf, size_t size) override;
+
+    void streamDecompressConsume(std::ostream &write, const char *buf, size_t size,
+                                 std::function<void(const char *, size_t)> fn) override;
+
+    bool streamDecompressEnd() override;
+};
+
+#endif //PACKER_ZPACK_LZ4_H
@@ -0,0 +1,60 @@
+#include "zpack_memory.h"
+
+zpack_memory::zpack_memory() {
+    for (int i = 0; i < (int) ZPackMemoryComponent::COUNT; i++) {
+        current[i].store(0, std::memory_order_relaxed);
+        peak[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void zpack_memory::raise(std::atomic<unsigned long long> &peak, unsigned long long value) {
+    unsigned long long seen = peak.load(std::memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {}
+}
+
+void zpack_memory::hold(ZPackMemoryComponent component, unsigned long long bytes) {
+    if (bytes == 0) return;
+
+    raise(peak[(int) component], current[(int) component].fetch_add(bytes, std::memory_order_relaxed) + bytes);
+    raise(totalPeak, total.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void zpack_memory::release(ZPackMemoryComponent component, unsigned long long bytes) {
+    if (bytes == 0) return;
+
+    current[(int) component].fetch_sub(bytes, std::memory_order_relaxed);
+    total.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+void zpack_memory::assign(ZPackMemoryComponent component, unsigned long long bytes) {
+    unsigned long long previous = current[(int) component].exchange(bytes, std::memory_order_relaxed);
+    raise(peak[(int) component], bytes);
+    if (bytes >= previous) {
+        raise(totalPeak, total.fetch_add(bytes - previous, std::memory_order_relaxed) + bytes - previous);
+    } else {
+        total.fetch_sub(previous - bytes, std::memory_order_relaxed);
+    }
+}
+
+unsigned long long zpack_memory::held(ZPackMemoryComponent component) const {
+    return current[(int) component].load(std::memory_order_relaxed);
+}
+
+ZPackMemoryStats zpack_memory::snapshot() const {
+    ZPackMemoryStats res{};
+    for (int i = 0; i < (int) ZPackMemoryComponent::COUNT; i++) {
+        res.components[i].current = current[i].load(std::memory_order_relaxed);
+        res.components[i].peak = peak[i].load(std::memory_order_relaxed);
+    }
+    res.total.current = total.load(std::memory_order_relaxed);
+    res.total.peak = totalPeak.load(std::memory_order_relaxed);
+
+    return res;
+}
+
+void zpack_memory::resetPeaks() {
+    for (int i = 0; i < (int) ZPackMemoryComponent::COUNT; i++) {
+        peak[i].store(current[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    totalPeak.store(total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
@@ -0,0 +1,63 @@
+#ifndef ZPACK_MEMORY_H
+#define ZPACK_MEMORY_H
+
+#include <atomic>
+
+enum class ZPackMemoryComponent {
+    // compression and decompression contexts, including the ones of worker threads
+    CODEC,
+    // blocks borrowed from and cached by the buffer pool, the archive file buffer
+    BUFFERS,
+    // the in memory directory and its sorted name index
+    DIRECTORY,
+    COUNT
+};
+
+struct ZPackMemoryUsage {
+    unsigned long long current;
+    unsigned long long peak;
+};
+
+struct ZPackMemoryStats {
+    ZPackMemoryUsage components[(int) ZPackMemoryComponent::COUNT];
+    // peak of the sum, not the sum of the component peaks
+    ZPackMemoryUsage total;
+    // 0 when no budget is set
+    unsigned long long budget;
+
+    ZPackMemoryUsage const &operator[](ZPackMemoryComponent component) const {
+        return components[(int) component];
+    }
+};
+
+/*
+ * Bytes held per component with the highest value seen since the last reset. Holders report what
+ * they allocate and free, the counters may be updated from any thread.
+ */
+class zpack_memory {
+    std::atomic<unsigned long long> current[(int) ZPackMemoryComponent::COUNT];
+    std::atomic<unsigned long long> peak[(int) ZPackMemoryComponent::COUNT];
+    std::atomic<unsigned long long> total{0};
+    std::atomic<unsigned long long> totalPeak{0};
+
+    static void raise(std::atomic<unsigned long long> &peak, unsigned long long value);
+
+public:
+    zpack_memory();
+
+    void hold(ZPackMemoryComponent component, unsigned long long bytes);
+
+    void release(ZPackMemoryComponent component, unsigned long long bytes);
+
+    // replaces the figure of a component measured as a whole
+    void assign(ZPackMemoryComponent component, unsigned long long bytes);
+
+    unsigned long long held(ZPackMemoryComponent component) const;
+
+    ZPackMemoryStats snapshot() const;
+
+    // peaks restart from the current values
+    void resetPeaks();
+};
+
+#endif //ZPACK_MEMORY_H
@@ -0,0 +1,126 @@
+#include "zpack_metrics.h"
+
+double ZPackOperationStats::compressionRatio() const {
+    if (bytesIn == 0 || bytesOut == 0)
+        return 0;
+
+    // extract consumes compressed bytes and produces raw ones, the other operations the other way around
+    if (operation == ZPackOperation::EXTRACT)
+        return (double) bytesOut / bytesIn;
+    return (double) bytesIn / bytesOut;
+}
+
+unsigned long long ZPackOperationStats::latencyPercentileMicros(double p) const {
+    unsigned long long total = 0;
+    for (unsigned int i = 0; i < ZPACK_LATENCY_BUCKETS; i++) {
+        total += latency[i];
+    }
+
+    if (total == 0)
+        return 0;
+
+    auto rank = (unsigned long long) (p * total + 0.5);
+    if (rank == 0) rank = 1;
+
+    unsigned long long seen = 0;
+    for (unsigned int i = 0; i < ZPACK_LATENCY_BUCKETS; i++) {
+        seen += latency[i];
+        if (seen >= rank) {
+            return 1ULL << i;
+        }
+    }
+
+    return 1ULL << (ZPACK_LATENCY_BUCKETS - 1);
+}
+
+zpack_metrics::zpack_metrics() {
+    reset();
+}
+
+void zpack_metrics::record(ZPackOperation op, unsigned long long bytesIn, unsigned long long bytesOut,
+                           unsigned long long ioNanos, unsigned long long codecNanos,
+                           unsigned long long totalNanos, bool failed) {
+    counters &c = ops[(int) op];
+
+    c.calls.fetch_add(1, std::memory_order_relaxed);
+    if (failed) c.errors.fetch_add(1, std::memory_order_relaxed);
+    c.bytesIn.fetch_add(bytesIn, std::memory_order_relaxed);
+    c.bytesOut.fetch_add(bytesOut, std::memory_order_relaxed);
+    c.ioNanos.fetch_add(ioNanos, std::memory_order_relaxed);
+    c.codecNanos.fetch_add(codecNanos, std::memory_order_relaxed);
+    c.totalNanos.fetch_add(totalNanos, std::memory_order_relaxed);
+
+    unsigned long long micros = totalNanos / 1000;
+    unsigned int bucket = 0;
+    while (micros > 0 && bucket < ZPACK_LATENCY_BUCKETS - 1) {
+        micros >>= 1;
+        bucket++;
+    }
+    c.latency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+ZPackMetrics zpack_metrics::snapshot() const {
+    ZPackMetrics res{};
+    for (int i = 0; i < (int) ZPackOperation::COUNT; i++) {
+        counters const &c = ops[i];
+        ZPackOperationStats &s = res.operations[i];
+        s.operation = (ZPackOperation) i;
+
+        s.calls = c.calls.load(std::memory_order_relaxed);
+        s.errors = c.errors.load(std::memory_order_relaxed);
+        s.bytesIn = c.bytesIn.load(std::memory_order_relaxed);
+        s.bytesOut = c.bytesOut.load(std::memory_order_relaxed);
+        s.ioNanos = c.ioNanos.load(std::memory_order_relaxed);
+        s.codecNanos = c.codecNanos.load(std::memory_order_relaxed);
+        s.totalNanos = c.totalNanos.load(std::memory_order_relaxed);
+        for (unsigned int b = 0; b < ZPACK_LATENCY_BUCKETS; b++) {
+            s.latency[b] = c.latency[b].load(std::memory_order_relaxed);
+        }
+    }
+
+    return res;
+}
+
+void zpack_metrics::reset() {
+    for (auto &c : ops) {
+        c.calls = 0;
+        c.errors = 0;
+        c.bytesIn = 0;
+        c.bytesOut = 0;
+        c.ioNanos = 0;
+        c.codecNanos = 0;
+        c.totalNanos = 0;
+        for (auto &b : c.latency) {
+            b = 0;
+        }
+    }
+}
+
+zpack_metrics_scope::zpack_metrics_scope(zpack_metrics &metrics, ZPackOperation op) :
+    metrics(metrics), op(op), start(clock::now()), last(start) {
+}
+
+zpack_metrics_scope::~zpack_metrics_scope() {
+    auto total = (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        clock::now() - start).count();
+    metrics.record(op, bytesIn, bytesOut, ioNanos, codecNanos, total, failed);
+}
+
+unsigned long long zpack_metrics_scope::lap() {
+    auto now = clock::now();
+    auto res = (unsigned long long) std::chrono::duration_cast<std::chrono::nanoseconds>(now - last).count();
+    last = now;
+    return res;
+}
+
+void zpack_metrics_scope::mark() {
+    last = clock::now();
+}
+
+void zpack_metrics_scope::io() {
+    ioNanos += lap();
+}
+
+void zpack_metrics_scope::codec() {
+    codecNanos += lap();
+}
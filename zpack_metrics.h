@@ -0,0 +1,102 @@
+#ifndef ZPACK_METRICS_H
+#define ZPACK_METRICS_H
+
+#include <atomic>
+#include <chrono>
+
+enum class ZPackOperation {
+    PACK,
+    EXTRACT,
+    WRITE,
+    REPACK,
+    OPEN,
+    COUNT
+};
+
+// bucket 0 counts calls under 1us, bucket i calls in [2^(i-1), 2^i) us, the last one everything above
+static const unsigned int ZPACK_LATENCY_BUCKETS = 32;
+
+struct ZPackOperationStats {
+    ZPackOperation operation;
+    unsigned long long calls;
+    unsigned long long errors;
+    unsigned long long bytesIn;
+    unsigned long long bytesOut;
+    unsigned long long ioNanos;
+    unsigned long long codecNanos;
+    unsigned long long totalNanos;
+    unsigned long long latency[ZPACK_LATENCY_BUCKETS];
+
+    // uncompressed over compressed bytes, below 1 when the data grew
+    double compressionRatio() const;
+
+    unsigned long long latencyPercentileMicros(double p) const;
+};
+
+struct ZPackMetrics {
+    ZPackOperationStats operations[(int) ZPackOperation::COUNT];
+
+    ZPackOperationStats const &operator[](ZPackOperation op) const {
+        return operations[(int) op];
+    }
+};
+
+class zpack_metrics {
+    struct counters {
+        std::atomic<unsigned long long> calls{0};
+        std::atomic<unsigned long long> errors{0};
+        std::atomic<unsigned long long> bytesIn{0};
+        std::atomic<unsigned long long> bytesOut{0};
+        std::atomic<unsigned long long> ioNanos{0};
+        std::atomic<unsigned long long> codecNanos{0};
+        std::atomic<unsigned long long> totalNanos{0};
+        std::atomic<unsigned long long> latency[ZPACK_LATENCY_BUCKETS];
+    };
+
+    counters ops[(int) ZPackOperation::COUNT];
+
+public:
+    zpack_metrics();
+
+    void record(ZPackOperation op, unsigned long long bytesIn, unsigned long long bytesOut,
+                unsigned long long ioNanos, unsigned long long codecNanos, unsigned long long totalNanos,
+                bool failed);
+
+    ZPackMetrics snapshot() const;
+
+    void reset();
+};
+
+/*
+ * Collects one operation call and records it into zpack_metrics on destruction.
+ * io() and codec() attribute the time passed since the previous mark to I/O or codec work.
+ */
+class zpack_metrics_scope {
+    typedef std::chrono::steady_clock clock;
+
+    zpack_metrics &metrics;
+    ZPackOperation op;
+    clock::time_point start;
+    clock::time_point last;
+
+    unsigned long long lap();
+
+public:
+    unsigned long long bytesIn = 0;
+    unsigned long long bytesOut = 0;
+    unsigned long long ioNanos = 0;
+    unsigned long long codecNanos = 0;
+    bool failed = false;
+
+    zpack_metrics_scope(zpack_metrics &metrics, ZPackOperation op);
+
+    ~zpack_metrics_scope();
+
+    void mark();
+
+    void io();
+
+    void codec();
+};
+
+#endif //ZPACK_METRICS_H
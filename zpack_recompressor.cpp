@@ -0,0 +1,201 @@
+#include "zpack_recompressor.h"
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+typedef std::chrono::steady_clock recompress_clock;
+
+zpack_recompressor::zpack_recompressor(ZPack &pack, ZPackRecompressPolicy policy)
+    : pack(pack), policy(std::move(policy)) {}
+
+short int zpack_recompressor::levelOf(DirectoryFileQueue const &item) {
+    std::string bytes = ZPack::extraBytes(item, ZPack::CompressionLevel);
+    if (bytes.size() < 2) return 0;
+
+    return (short int) (usint) ((uchar) bytes[0] | (uchar) bytes[1] << 8);
+}
+
+bool zpack_recompressor::wanted(DirectoryFileQueue const &item) const {
+    if (item.record.getGeneral() & ZPack::Solid) return false;
+    if (item.filename.compare(0, policy.prefix.size(), policy.prefix) != 0) return false;
+    if (policy.olderThan != 0 && item.record.getMtime() >= policy.olderThan) return false;
+    short int level = levelOf(item);
+    // stored items recorded at the target level have been tried already, they did not get smaller
+    if (item.record.getCompressMethod() == ZPack::CompressNone) {
+        if (level != 0 && level >= policy.level) return false;
+    } else if (policy.belowLevel != 0 && level >= policy.belowLevel) {
+        return false;
+    }
+
+    return true;
+}
+
+void zpack_recompressor::select() {
+    queue.clear();
+    position = 0;
+    for (auto const &item : pack.list) {
+        if (wanted(item.second)) queue.push_back(item.first);
+    }
+    // archive order, reads of the old copies go forward through the file
+    std::sort(queue.begin(), queue.end(), [this](std::string const &a, std::string const &b) {
+        return pack.list[a].record.getOffsetRecord() < pack.list[b].record.getOffsetRecord();
+    });
+    selected = true;
+}
+
+size_t zpack_recompressor::pending() {
+    if (!selected) select();
+    return queue.size() - position;
+}
+
+bool zpack_recompressor::recompressItem(std::string const &name, ZPackRecompressResult &result) {
+    auto item = pack.list.find(name);
+    // removed or replaced by a solid item since the selection
+    if (item == pack.list.end() || !wanted(item->second)) return true;
+
+    DirectoryFileQueue previous = item->second;
+    ullint size = previous.record.getUncompressedSize();
+    if (size == 0) return true;
+
+    // a block sized item is kept in memory, bigger ones go through a staging file next to the archive
+    std::stringstream memory;
+    std::fstream stagingFile;
+    fs::path stagingName;
+    std::iostream *payload = &memory;
+    if (size > pack.blockSizeMax) {
+        stagingName = fs::unique_path(pack.archive_name + ".%%%%-%%%%-%%%%.recompress");
+        stagingFile.open(stagingName.string(),
+                         std::ios_base::binary | std::ios_base::in | std::ios_base::out | std::ios_base::trunc);
+        payload = &stagingFile;
+    }
+
+    auto cleanup = [&] {
+        if (stagingFile.is_open()) stagingFile.close();
+        if (!stagingName.empty()) {
+            boost::system::error_code ec;
+            fs::remove(stagingName, ec);
+        }
+    };
+
+    if (!payload->good() || !pack.extract(item->second, *payload)) {
+        cleanup();
+        return false;
+    }
+    payload->flush();
+    payload->seekg(0);
+
+    fs::perms perms = fs::perms::owner_read | fs::perms::owner_write | fs::perms::others_read;
+    for (LocalFileExtraField const &field : previous.extra) {
+        if (field.getId() == ZPack::Permissions) {
+            perms = (fs::perms) field.getValue();
+        }
+    }
+
+    short int level = pack.compressionLevel;
+    bool levelSet = pack.compressionLevelSet;
+    uint solidBlockSize = pack.solidBlockSize;
+    pack.compressionLevel = policy.level;
+    pack.compressionLevelSet = true;
+    pack.solidBlockSize = 0;
+    // the budget window depends on the level
+    pack.applyMemoryBudget();
+
+    // without the entry packData does not take the item for unchanged
+    pack.list.erase(item);
+    bool packed = false;
+    try {
+        packed = pack.packData(*payload, name, perms, size, previous.record.getMtime(), previous.comment,
+                               policy.method);
+    } catch (std::exception &) {
+        packed = false;
+    }
+
+    pack.compressionLevel = level;
+    pack.compressionLevelSet = levelSet;
+    pack.solidBlockSize = solidBlockSize;
+    pack.applyMemoryBudget();
+    cleanup();
+
+    if (!packed) {
+        pack.list[name] = previous;
+        pack.nameIndexDirty = true;
+        return false;
+    }
+
+    DirectoryFileQueue &entry = pack.list[name];
+    result.compressedBefore += previous.record.getCompressedSize();
+    if (entry.record.getCompressedSize() >= previous.record.getCompressedSize()) {
+        // the new copy is dead space, the original is marked so it is not selected again
+        entry = previous;
+        std::string levelBytes{(char) ((usint) policy.level & 0xff), (char) ((usint) policy.level >> 8)};
+        ZPack::replaceExtra(entry, ZPack::CompressionLevel, levelBytes);
+        result.compressedAfter += previous.record.getCompressedSize();
+        result.kept++;
+    } else {
+        std::string holes = ZPack::extraBytes(previous, ZPack::SparseHoles);
+        if (!holes.empty()) ZPack::replaceExtra(entry, ZPack::SparseHoles, holes);
+        result.compressedAfter += entry.record.getCompressedSize();
+        result.items++;
+    }
+
+    return true;
+}
+
+void zpack_recompressor::appendAfterDirectory() {
+    // copies go behind the committed directory, which stays the one readers find until the next write()
+    ullint end = std::max(pack.borderOffset, pack.dir_end.getRecordOffset());
+    assignInt<ullint>(end, pack.dir_end.dirRecordOffset);
+    pack.appendOffset = end;
+}
+
+ZPackRecompressResult zpack_recompressor::run() {
+    ZPackRecompressResult result{0, 0, 0, 0, 0, false};
+    if (!selected) select();
+
+    auto start = recompress_clock::now();
+    bool committed = true;
+    ullint batchStart = 0;
+    while (position < queue.size()) {
+        ullint spent = result.compressedBefore + result.compressedAfter;
+        if (policy.maxBytes != 0 && spent >= policy.maxBytes) break;
+
+        if (committed) {
+            appendAfterDirectory();
+            batchStart = pack.dir_end.getRecordOffset();
+            committed = false;
+        }
+
+        auto itemStart = recompress_clock::now();
+        if (!recompressItem(queue[position++], result)) {
+            result.failed++;
+            pack.clear();
+        }
+
+        auto now = recompress_clock::now();
+        recompress_clock::duration pause(0);
+        if (policy.dutyCycle > 0 && policy.dutyCycle < 1) {
+            pause = std::chrono::duration_cast<recompress_clock::duration>(
+                (now - itemStart) * ((1 - policy.dutyCycle) / policy.dutyCycle));
+        }
+        if (policy.bytesPerSecond != 0) {
+            spent = result.compressedBefore + result.compressedAfter;
+            auto due = std::chrono::duration_cast<recompress_clock::duration>(
+                std::chrono::duration<double>((double) spent / (double) policy.bytesPerSecond));
+            if (start + due - now > pause) pause = start + due - now;
+        }
+
+        // every commit leaves the previous directory behind as dead space, batches keep it a small share
+        ullint batchBytes = pack.dir_end.getRecordOffset() - batchStart;
+        if (pause.count() > 0 || batchBytes >= (ullint) commitRatio * pack.dir_end.getRecordSize()) {
+            pack.write();
+            committed = true;
+        }
+        if (pause.count() > 0) std::this_thread::sleep_for(pause);
+    }
+
+    result.finished = position >= queue.size();
+    if (!committed) pack.write();
+
+    return result;
+}
@@ -0,0 +1,73 @@
+#ifndef ZPACK_RECOMPRESSOR_H
+#define ZPACK_RECOMPRESSOR_H
+
+#include <string>
+#include <vector>
+#include "zpack.h"
+
+struct ZPackRecompressPolicy {
+    short int level = 19;
+    ZPack::Compression method = ZPack::CompressZstd;
+    // items recorded below this level, items packed without a recorded level count as 0, 0 takes any level
+    short int belowLevel = 0;
+    // items modified before this time, 0 takes any age
+    llint olderThan = 0;
+    std::string prefix;
+
+    // budget of one run(), 0 is unlimited. Bytes are archive bytes read plus written
+    ullint maxBytes = 0;
+    ullint bytesPerSecond = 0;
+    // share of the run spent working, the rest is slept between items
+    double dutyCycle = 1.0;
+};
+
+struct ZPackRecompressResult {
+    ullint items;
+    // recompressed copies not smaller than the original, the original stays
+    ullint kept;
+    ullint failed;
+    ullint compressedBefore;
+    ullint compressedAfter;
+    // no selected item is left
+    bool finished;
+};
+
+/*
+ * Rewrites selected items at another level or codec, so ingest can pack at a fast level and cold
+ * items shrink later. Every item is decompressed, packed again at the end of the archive and its
+ * directory entry is replaced in one step, the old copy is left for repack(). Items in solid blocks
+ * are not touched. The job works through its selection in runs, each limited by the policy budget.
+ * Copies are appended behind the committed directory and a new one is written before every pause
+ * and after small batches, so the archive is left with a valid directory while the job sleeps. The
+ * archive must not be written by anything else during a run.
+ */
+class zpack_recompressor {
+    ZPack &pack;
+    ZPackRecompressPolicy policy;
+    std::vector<std::string> queue;
+    size_t position = 0;
+    bool selected = false;
+
+    // copies written between two directory commits, in sizes of the directory
+    static const uint commitRatio = 8;
+
+    bool wanted(DirectoryFileQueue const &item) const;
+
+    void select();
+
+    bool recompressItem(std::string const &name, ZPackRecompressResult &result);
+
+    void appendAfterDirectory();
+
+public:
+    zpack_recompressor(ZPack &pack, ZPackRecompressPolicy policy);
+
+    // items are selected from the directory at the first run
+    ZPackRecompressResult run();
+
+    size_t pending();
+
+    static short int levelOf(DirectoryFileQueue const &item);
+};
+
+#endif //ZPACK_RECOMPRESSOR_H
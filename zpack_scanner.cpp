@@ -0,0 +1,363 @@
+#include "zpack_scanner.h"
+#include <algorithm>
+#include <cstring>
+
+static const size_t scanChunk = 256 * 1024;
+
+// extras of a local record are a handful of small fields, anything bigger is not a record
+static const usint scanExtraMax = 64 * sizeof(LocalFileExtraField);
+
+zpack_scanner::zpack_scanner(std::istream &in) : in(in) {}
+
+bool zpack_scanner::ensure(size_t size) {
+    if (windowEnd - windowPos >= size)
+        return true;
+
+    if (windowPos > 0) {
+        std::memmove(window.data(), window.data() + windowPos, windowEnd - windowPos);
+        windowOffset += windowPos;
+        windowEnd -= windowPos;
+        windowPos = 0;
+    }
+    if (window.size() < size) {
+        window.resize(std::max(size, scanChunk));
+    }
+
+    // only what is asked for, input still arriving through a pipe must not be waited for in advance
+    while (windowEnd < size && in.good()) {
+        in.read(window.data() + windowEnd, (std::streamsize) (size - windowEnd));
+        windowEnd += (size_t) in.gcount();
+    }
+
+    return windowEnd >= size;
+}
+
+void zpack_scanner::consume(size_t size) {
+    windowPos += size;
+}
+
+ullint zpack_scanner::offset() const {
+    return windowOffset + windowPos;
+}
+
+ullint zpack_scanner::skippedBytes() const {
+    return skipped;
+}
+
+bool zpack_scanner::complete() const {
+    return directoryReached;
+}
+
+DirectoryFileQueue const &zpack_scanner::entry() const {
+    return current;
+}
+
+bool zpack_scanner::resync() {
+    uchar signature[4];
+    assignInt<uint>(ZPack::LocalHeader, signature);
+
+    while (ensure(sizeof(signature))) {
+        const char *begin = window.data() + windowPos;
+        size_t available = windowEnd - windowPos;
+        for (size_t i = 0; i + sizeof(signature) <= available; i++) {
+            if (std::memcmp(begin + i, signature, sizeof(signature)) == 0) {
+                skipped += i;
+                consume(i);
+                return true;
+            }
+        }
+
+        size_t drop = available - sizeof(signature) + 1;
+        skipped += drop;
+        consume(drop);
+        ensure(scanChunk);
+    }
+
+    skipped += windowEnd - windowPos;
+    consume(windowEnd - windowPos);
+    return false;
+}
+
+void zpack_scanner::updateEntry(std::string const &name, std::vector<LocalFileExtraField> const &extras) {
+    LocalFileExtraField first = extras.empty() ? LocalFileExtraField{} : extras[0];
+    current = ZPack::directoryEntry(header, first, name, "", recordOffset);
+    current.extra = extras;
+
+    auto extraLen = (usint) (extras.size() * sizeof(LocalFileExtraField));
+    assignInt<usint>(extraLen, current.record.extraLen);
+    assignInt<ullint>(recordOffset + sizeof(header) + name.size() + extraLen, current.record.offsetFile);
+}
+
+bool zpack_scanner::readHeader() {
+    if (!ensure(sizeof(header)))
+        return false;
+
+    std::memcpy(&header, window.data() + windowPos, sizeof(header));
+    usint extraLen = header.getExtraLen();
+    if (extraLen > scanExtraMax || extraLen % sizeof(LocalFileExtraField) != 0)
+        return false;
+
+    size_t headSize = sizeof(header) + header.getFilenameLen() + extraLen;
+    if (!ensure(headSize))
+        return false;
+
+    const char *pos = window.data() + windowPos + sizeof(header);
+    std::string name(pos, header.getFilenameLen());
+    std::vector<LocalFileExtraField> extras(extraLen / sizeof(LocalFileExtraField));
+    if (!extras.empty()) {
+        std::memcpy(extras.data(), pos + name.size(), extraLen);
+    }
+
+    consume(headSize);
+    updateEntry(name, extras);
+    payloadPending = true;
+
+    return true;
+}
+
+bool zpack_scanner::loadSolid() {
+    solidHeader = header;
+    solidOffset = recordOffset;
+    payloadPending = false;
+
+    // sizes of a signature found inside other data are anything, nothing bigger than a block is loaded
+    if (header.getCompressedSize() > ZPack::solidBlockMax || header.getUncompressedSize() > ZPack::solidBlockMax)
+        return false;
+
+    auto compressedSize = (size_t) header.getCompressedSize();
+    if (!ensure(compressedSize))
+        return false;
+
+    const char *payload = window.data() + windowPos;
+    auto ar = zpack_codec_registry::create(header.getCompression());
+    bool good = ar != nullptr;
+    if (good) {
+        try {
+            solidBlock.resize((size_t) header.getUncompressedSize());
+            auto d_size = ar->decompressBlock(payload, compressedSize, &solidBlock[0], solidBlock.size());
+            good = d_size == solidBlock.size();
+        } catch (std::exception &) {
+            good = false;
+        }
+    }
+    consume(compressedSize);
+
+    zpack_checksum crc32(header.getGeneral() & ZPack::ChecksumXXH64 ? ZPackChecksum::XXHASH64 : ZPackChecksum::CRC32);
+    if (good) {
+        crc32.process_bytes(solidBlock.data(), solidBlock.size());
+    }
+    if (!good || crc32.checksum() != header.getCrc32()) {
+        solidBlock.clear();
+        return false;
+    }
+
+    solidPos = 0;
+    return true;
+}
+
+bool zpack_scanner::nextSolidRecord() {
+    LocalFileHeaderRecord inner{};
+    if (solidPos + sizeof(inner) > solidBlock.size()) {
+        solidBlock.clear();
+        return false;
+    }
+
+    std::memcpy(&inner, &solidBlock[solidPos], sizeof(inner));
+    size_t dataPos = solidPos + sizeof(inner) + inner.getFilenameLen() + inner.getExtraLen();
+    if (inner.getSignature() != ZPack::LocalHeader || dataPos + inner.getUncompressedSize() > solidBlock.size()) {
+        solidBlock.clear();
+        return false;
+    }
+
+    std::string name(&solidBlock[solidPos + sizeof(inner)], inner.getFilenameLen());
+    std::vector<LocalFileExtraField> extras(inner.getExtraLen() / sizeof(LocalFileExtraField));
+    if (!extras.empty()) {
+        std::memcpy(extras.data(), &solidBlock[solidPos + sizeof(inner) + name.size()],
+                    extras.size() * sizeof(LocalFileExtraField));
+    }
+
+    // the entry points at the block as the directory of a solid archive does
+    header = inner;
+    recordOffset = solidOffset;
+    updateEntry(name, extras);
+    assignInt<usint>(2, current.record.versionMin);
+    assignInt<usint>(solidHeader.getCompression(), current.record.compressMethod);
+    assignInt<ullint>(solidHeader.getCompressedSize(), current.record.compressedSize);
+    assignInt<ullint>(solidOffset + sizeof(solidHeader), current.record.offsetFile);
+    assignInt<uint>((uint) dataPos, current.record.attrsExternal);
+
+    solidData = &solidBlock[dataPos];
+    solidPos = dataPos + (size_t) inner.getUncompressedSize();
+    return true;
+}
+
+bool zpack_scanner::next() {
+    if (finished)
+        return false;
+
+    if (payloadPending && !skip()) {
+        finished = true;
+        return false;
+    }
+    solidData = nullptr;
+
+    if (!solidBlock.empty() && nextSolidRecord())
+        return true;
+
+    while (ensure(sizeof(uint))) {
+        auto signature = readInt<uint>((const uchar *) window.data() + windowPos);
+        if (signature == ZPack::DirectoryEntry || signature == ZPack::DirectoryRecord ||
+            signature == ZPack::CompressedDirectory || signature == ZPack::CompressedDirectoryRecord) {
+            directoryReached = true;
+            break;
+        }
+
+        if (signature != ZPack::LocalHeader) {
+            if (!resync()) break;
+            continue;
+        }
+
+        recordOffset = offset();
+        if (!readHeader()) {
+            // a signature that happens to be inside other data, look further
+            consume(1);
+            skipped++;
+            continue;
+        }
+
+        if (header.getGeneral() & ZPack::Solid && header.getFilenameLen() == 0) {
+            if (loadSolid() && nextSolidRecord())
+                return true;
+            continue;
+        }
+
+        return true;
+    }
+
+    finished = true;
+    return false;
+}
+
+bool zpack_scanner::payload(std::function<void(const char *, size_t)> const &sink) {
+    if (!payloadPending)
+        return false;
+    payloadPending = false;
+
+    ullint dataStart = offset();
+    if (!(header.getGeneral() & ZPack::TrailingDescriptor)) {
+        ullint left = header.getCompressedSize();
+        while (left > 0) {
+            auto chunk = (size_t) std::min<ullint>(left, scanChunk);
+            if (!ensure(chunk))
+                return false;
+
+            sink(window.data() + windowPos, chunk);
+            consume(chunk);
+            left -= chunk;
+        }
+        return true;
+    }
+
+    // the payload ends where a descriptor signature is followed by the size of what came before it
+    uchar signature[4];
+    assignInt<uint>(ZPack::DataDescriptor, signature);
+    const size_t descriptorSize = sizeof(DataDescriptorRecord);
+
+    while (true) {
+        ensure(scanChunk + descriptorSize);
+        size_t available = windowEnd - windowPos;
+        if (available < descriptorSize)
+            return false;
+
+        const char *begin = window.data() + windowPos;
+        for (size_t i = 0; i + descriptorSize <= available; i++) {
+            if (std::memcmp(begin + i, signature, sizeof(signature)) != 0) continue;
+
+            DataDescriptorRecord descriptor{};
+            std::memcpy(&descriptor, begin + i, descriptorSize);
+            if (descriptor.getCompressedSize() != offset() + i - dataStart) continue;
+
+            if (i > 0) sink(begin, i);
+            consume(i + descriptorSize);
+
+            std::memcpy(header.crc32, descriptor.crc32, sizeof(header.crc32));
+            std::memcpy(header.compressedSize, descriptor.compressedSize, sizeof(header.compressedSize));
+            std::memcpy(header.uncompressedSize, descriptor.uncompressedSize, sizeof(header.uncompressedSize));
+            updateEntry(current.filename, current.extra);
+            return true;
+        }
+
+        size_t pass = available - descriptorSize + 1;
+        sink(begin, pass);
+        consume(pass);
+    }
+}
+
+bool zpack_scanner::skip() {
+    if (solidData != nullptr)
+        return true;
+
+    return payload([](const char *, size_t) {});
+}
+
+bool zpack_scanner::extract(std::ostream &stream) {
+    zpack_checksum crc32(
+        current.record.getGeneral() & ZPack::ChecksumXXH64 ? ZPackChecksum::XXHASH64 : ZPackChecksum::CRC32
+    );
+
+    if (solidData != nullptr) {
+        auto size = (size_t) current.record.getUncompressedSize();
+        crc32.process_bytes(solidData, size);
+        stream.write(solidData, (std::streamsize) size);
+        return stream.good() && crc32.checksum() == current.record.getCrc32();
+    }
+
+    if (!payloadPending)
+        return false;
+
+    auto compress_method = (ZPack::Compression) header.getCompression();
+    std::unique_ptr<zpack_compression> ar;
+    if (compress_method != ZPack::CompressNone) {
+        ar = zpack_codec_registry::create(compress_method);
+        if (!ar) {
+            skip();
+            return false;
+        }
+    }
+
+    bool streamed = (header.getGeneral() & ZPack::Streamed) != 0;
+    auto crc32_callback = [&crc32](const char *buf, size_t size) {
+        crc32.process_bytes(buf, size);
+    };
+
+    std::string whole;
+    bool good;
+    try {
+        if (ar && streamed) ar->streamDecompressSetup();
+
+        good = payload([&](const char *buf, size_t size) {
+            if (!ar) {
+                crc32.process_bytes(buf, size);
+                stream.write(buf, (std::streamsize) size);
+            } else if (streamed) {
+                ar->streamDecompressConsume(stream, buf, size, crc32_callback);
+            } else {
+                whole.append(buf, size);
+            }
+        });
+
+        if (ar && streamed) ar->streamDecompressEnd();
+
+        if (good && ar && !streamed) {
+            auto d_size = ar->getDecompressedSize(whole.data(), whole.size());
+            zpack_buffer obuf = zpack_buffer_pool::acquire(nullptr, d_size);
+            d_size = ar->decompressBlock(whole.data(), whole.size(), obuf.data(), d_size);
+            crc32.process_bytes(obuf.data(), (size_t) d_size);
+            stream.write(obuf.data(), (std::streamsize) d_size);
+        }
+    } catch (std::exception &) {
+        good = false;
+    }
+
+    return good && stream.good() && crc32.checksum() == current.record.getCrc32();
+}
@@ -0,0 +1,87 @@
+#ifndef ZPACK_SCANNER_H
+#define ZPACK_SCANNER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "zpack.h"
+
+/*
+ * Forward reader walking the local records from the start of an archive, for input that cannot seek
+ * (a pipe, an archive still arriving) or has no usable directory. Items of solid blocks are yielded
+ * one by one, trailing data descriptors are found by their signature and payload size. Bytes that do
+ * not parse are skipped up to the next local header signature.
+ */
+class zpack_scanner {
+    std::istream &in;
+
+    std::vector<char> window;
+    size_t windowPos = 0;
+    size_t windowEnd = 0;
+    ullint windowOffset = 0;
+
+    LocalFileHeaderRecord header{};
+    LocalFileExtraField extra{};
+    DirectoryFileQueue current{};
+    ullint recordOffset = 0;
+    bool payloadPending = false;
+    bool finished = false;
+    bool directoryReached = false;
+    ullint skipped = 0;
+
+    // decompressed solid block whose records are being yielded
+    std::string solidBlock;
+    size_t solidPos = 0;
+    LocalFileHeaderRecord solidHeader{};
+    ullint solidOffset = 0;
+    const char *solidData = nullptr;
+
+    bool ensure(size_t size);
+
+    void consume(size_t size);
+
+    bool resync();
+
+    bool readHeader();
+
+    bool loadSolid();
+
+    void updateEntry(std::string const &name, std::vector<LocalFileExtraField> const &extras);
+
+    bool nextSolidRecord();
+
+    bool payload(std::function<void(const char *, size_t)> const &sink);
+
+public:
+    explicit zpack_scanner(std::istream &in);
+
+    /*
+     * Moves to the next item, skipping what is left of the current one. False at the directory or at
+     * the end of input.
+     */
+    bool next();
+
+    /*
+     * Directory entry of the current item as the archive directory would hold it. Sizes and checksum of
+     * an item with a trailing descriptor are known once its payload was extracted or skipped.
+     */
+    DirectoryFileQueue const &entry() const;
+
+    /*
+     * Writes the current item to stream, false when its payload is cut off or fails the checksum.
+     */
+    bool extract(std::ostream &stream);
+
+    bool skip();
+
+    // input bytes consumed so far
+    ullint offset() const;
+
+    // bytes passed over while looking for the next record
+    ullint skippedBytes() const;
+
+    // the directory was reached, all items before it were seen
+    bool complete() const;
+};
+
+#endif //ZPACK_SCANNER_H
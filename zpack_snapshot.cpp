@@ -0,0 +1,164 @@
+#include "zpack_snapshot.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <sys/stat.h>
+#include "_directory_codec.h"
+#include "_positional_io.h"
+
+zpack_snapshot::zpack_snapshot(int fd, ullint generation, std::unordered_map<std::string, DirectoryFileQueue> list)
+    : fd(fd), generationId(generation), list(std::move(list)) {}
+
+zpack_snapshot::~zpack_snapshot() {
+    pioClose(fd);
+}
+
+std::shared_ptr<const zpack_snapshot> zpack_snapshot::open(std::string const &filename) {
+    int fd = pioOpen(filename.c_str(), false);
+    if (fd < 0) return nullptr;
+
+    struct stat st{};
+    EndOfDirectoryRecord dir_end{};
+    if (fstat(fd, &st) != 0 || (ullint) st.st_size < sizeof(dir_end) ||
+        pioReadAt(fd, (char *) &dir_end, sizeof(dir_end), (ullint) st.st_size - sizeof(dir_end)) !=
+        (long long) sizeof(dir_end) ||
+        (dir_end.getSignature() != ZPack::DirectoryRecord &&
+         dir_end.getSignature() != ZPack::CompressedDirectoryRecord)) {
+        pioClose(fd);
+        return nullptr;
+    }
+
+    std::unordered_map<std::string, DirectoryFileQueue> list;
+    if (dir_end.getRecordsNumber() > 0) {
+        std::vector<uchar> blob(dir_end.getRecordSize());
+        if (pioReadAt(fd, (char *) blob.data(), blob.size(), dir_end.getRecordOffset()) != (long long) blob.size()) {
+            pioClose(fd);
+            return nullptr;
+        }
+        if (dir_end.getSignature() == ZPack::CompressedDirectoryRecord) {
+            std::vector<uchar> packed;
+            packed.swap(blob);
+            if (!unpackDirectory(packed.data(), packed.size(), blob)) {
+                pioClose(fd);
+                return nullptr;
+            }
+        }
+
+        list.reserve(ZPack::directoryEntriesHint(dir_end, blob.size()));
+        if (ZPack::decodeDirectory(blob.data(), blob.size(), list) != ZPack::Errors::OK) {
+            pioClose(fd);
+            return nullptr;
+        }
+    }
+
+    return std::shared_ptr<const zpack_snapshot>(new zpack_snapshot(fd, 0, std::move(list)));
+}
+
+ullint zpack_snapshot::generation() const {
+    return generationId;
+}
+
+size_t zpack_snapshot::size() const {
+    return list.size();
+}
+
+bool zpack_snapshot::contains(std::string const &name) const {
+    return list.find(name) != list.end();
+}
+
+std::vector<std::string> zpack_snapshot::listNames(std::string const &prefix) const {
+    std::vector<std::string> res;
+    for (auto const &item : list) {
+        if (item.first.compare(0, prefix.size(), prefix) == 0) {
+            res.push_back(item.first);
+        }
+    }
+    std::sort(res.begin(), res.end());
+
+    return res;
+}
+
+bool zpack_snapshot::readPayload(DirectoryFileQueue const &item, zpack_buffer &buffer) const {
+    auto size = (size_t) item.record.getCompressedSize();
+    buffer = zpack_buffer_pool::acquire(nullptr, size);
+    return pioReadAt(fd, buffer.data(), size, item.record.getOffsetFile()) == (long long) size;
+}
+
+bool zpack_snapshot::extract(std::string const &name, std::ostream &stream) const {
+    auto found = list.find(name);
+    if (found == list.end()) return false;
+
+    DirectoryFileQueue const &item = found->second;
+    auto compress_method = (ZPack::Compression) item.record.getCompressMethod();
+    usint general_flags = item.record.getGeneral();
+    zpack_checksum crc32(general_flags & ZPack::ChecksumXXH64 ? ZPackChecksum::XXHASH64 : ZPackChecksum::CRC32);
+
+    std::unique_ptr<zpack_compression> ar;
+    if (compress_method != ZPack::CompressNone) {
+        ar = zpack_codec_registry::create(compress_method);
+        if (!ar) return false;
+    }
+
+    if (general_flags & ZPack::Solid) {
+        // no block cache here, a shared snapshot would have to lock it on every read
+        zpack_buffer compressed;
+        if (!readPayload(item, compressed)) return false;
+
+        auto d_size = ar->getDecompressedSize(compressed.data(), compressed.size());
+        zpack_buffer block = zpack_buffer_pool::acquire(nullptr, d_size);
+        d_size = ar->decompressBlock(compressed.data(), compressed.size(), block.data(), d_size);
+
+        ullint itemOffset = item.record.getAttrsExternal();
+        ullint itemSize = item.record.getUncompressedSize();
+        if (itemOffset + itemSize > d_size) return false;
+
+        crc32.process_bytes(block.data() + itemOffset, (size_t) itemSize);
+        stream.write(block.data() + itemOffset, (std::streamsize) itemSize);
+    } else if (ar && !(general_flags & ZPack::Streamed)) {
+        zpack_buffer compressed;
+        if (!readPayload(item, compressed)) return false;
+
+        auto d_size = ar->getDecompressedSize(compressed.data(), compressed.size());
+        zpack_buffer obuf = zpack_buffer_pool::acquire(nullptr, d_size);
+        d_size = ar->decompressBlock(compressed.data(), compressed.size(), obuf.data(), d_size);
+
+        crc32.process_bytes(obuf.data(), (size_t) d_size);
+        stream.write(obuf.data(), (std::streamsize) d_size);
+    } else {
+        const size_t chunkSize = 1024 * 1024;
+        zpack_buffer chunk = zpack_buffer_pool::acquire(nullptr, chunkSize);
+        auto crc32_callback = [&crc32](const char *buf, size_t size) {
+            crc32.process_bytes(buf, size);
+        };
+
+        if (ar) ar->streamDecompressSetup();
+
+        ullint compressedSize = item.record.getCompressedSize();
+        ullint readed = 0;
+        while (readed < compressedSize) {
+            auto want = (size_t) std::min<ullint>(chunkSize, compressedSize - readed);
+            if (pioReadAt(fd, chunk.data(), want, item.record.getOffsetFile() + readed) != (long long) want) {
+                return false;
+            }
+            readed += want;
+
+            if (ar) {
+                ar->streamDecompressConsume(stream, chunk.data(), want, crc32_callback);
+            } else {
+                crc32.process_bytes(chunk.data(), want);
+                stream.write(chunk.data(), (std::streamsize) want);
+            }
+        }
+
+        if (ar) ar->streamDecompressEnd();
+    }
+
+    return stream.good() && crc32.checksum() == item.record.getCrc32();
+}
+
+std::string zpack_snapshot::extractStr(std::string const &name) const {
+    std::ostringstream stream;
+    if (!extract(name, stream)) return "";
+
+    return stream.str();
+}
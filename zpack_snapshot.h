@@ -0,0 +1,58 @@
+#ifndef ZPACK_SNAPSHOT_H
+#define ZPACK_SNAPSHOT_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "zpack.h"
+
+/*
+ * Read-only view of one directory generation. The directory is held in memory and item data is read
+ * with pread through a descriptor opened when the generation was taken. Items are only ever appended
+ * and repack renames a new file over the archive, so the view stays consistent while the writer
+ * appends, rewrites the directory or compacts. A snapshot never changes and can be shared between
+ * threads, its descriptor (and a file already replaced by repack) is released with the last reference.
+ */
+class zpack_snapshot {
+    int fd = -1;
+    ullint generationId = 0;
+    std::unordered_map<std::string, DirectoryFileQueue> list;
+
+    zpack_snapshot(int fd, ullint generation, std::unordered_map<std::string, DirectoryFileQueue> list);
+
+    bool readPayload(DirectoryFileQueue const &item, zpack_buffer &buffer) const;
+
+    friend class ZPack;
+
+public:
+    ~zpack_snapshot();
+
+    zpack_snapshot(zpack_snapshot const &) = delete;
+
+    zpack_snapshot &operator=(zpack_snapshot const &) = delete;
+
+    /*
+     * Snapshot of the directory last written to the file, for readers outside the writing process.
+     * Returns nullptr when the archive has no valid directory.
+     */
+    static std::shared_ptr<const zpack_snapshot> open(std::string const &filename);
+
+    // increases with every generation published by the owning ZPack, 0 for snapshots opened from a file
+    ullint generation() const;
+
+    size_t size() const;
+
+    bool contains(std::string const &name) const;
+
+    std::vector<std::string> listNames(std::string const &prefix = "") const;
+
+    /*
+     * Writes the item to stream, false when it is missing, damaged or fails its checksum.
+     */
+    bool extract(std::string const &name, std::ostream &stream) const;
+
+    std::string extractStr(std::string const &name) const;
+};
+
+#endif //ZPACK_SNAPSHOT_H
@@ -0,0 +1,218 @@
+#include "zpack_stream_writer.h"
+#include <chrono>
+#include <sstream>
+
+static const fs::perms streamItemPerms = fs::perms::owner_read | fs::perms::owner_write | fs::perms::others_read;
+
+zpack_stream_writer::zpack_stream_writer(std::ostream &out) : out(out) {}
+
+void zpack_stream_writer::setCompressionLevel(short int level) {
+    compressionLevel = level;
+    compressionLevelSet = true;
+}
+
+bool zpack_stream_writer::setCompressionMethod(ZPack::Compression method) {
+    if (method != ZPack::CompressNone && !zpack_codec_registry::has(method)) {
+        error_code = ZPack::Errors::ERR_UNKNOWN_COMPRESSION;
+        return false;
+    }
+
+    compressionMethod = method;
+    return true;
+}
+
+void zpack_stream_writer::setBlockSize(uint size) {
+    blockSizeBytes = size > 0 ? size : blockSizeMax;
+}
+
+void zpack_stream_writer::setChecksum(ZPackChecksum type) {
+    checksumType = type;
+}
+
+ullint zpack_stream_writer::bytesWritten() const {
+    return offset;
+}
+
+std::unique_ptr<zpack_compression> zpack_stream_writer::createCompression(ZPack::Compression method) {
+    std::unique_ptr<zpack_compression> ar = zpack_codec_registry::create(method);
+    if (ar) {
+        if (compressionLevelSet) ar->setCompressionLevel(compressionLevel);
+        ar->setBufferPool(&bufferPool);
+    }
+
+    return ar;
+}
+
+void zpack_stream_writer::emit(const char *data, size_t size) {
+    out.write(data, (std::streamsize) size);
+    offset += size;
+}
+
+bool zpack_stream_writer::packFile(std::string const &filename, std::string const &directory,
+                                   std::string const &comment) {
+    std::ifstream sfile(filename, std::ios_base::binary | std::ios_base::in);
+    if (!sfile.is_open()) {
+        error_code = ZPack::Errors::ERR_PACK_FILE_OPEN;
+        return false;
+    }
+
+    std::string itemname =
+        directory + (!directory.empty() && directory.back() != '/' ? "/" : "") + fs::path(filename).filename().string();
+
+    return pack(sfile, itemname, fs::status(filename).permissions(), (llint) fs::last_write_time(filename), comment);
+}
+
+bool zpack_stream_writer::packItem(std::string const &itemname, std::string const &data, std::string const &directory,
+                                   std::string const &comment) {
+    if (data.empty()) {
+        error_code = ZPack::Errors::ERR_PACK_ITEM_SIZE;
+        return false;
+    }
+
+    std::istringstream sfile(data);
+    std::string itemname_normalized = directory + (!directory.empty() && directory.back() != '/' ? "/" : "") + itemname;
+    llint mtime = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+    return pack(sfile, itemname_normalized, streamItemPerms, mtime, comment);
+}
+
+bool zpack_stream_writer::packStream(std::istream &stream, std::string const &itemname, llint modificationTime,
+                                     std::string const &comment) {
+    return pack(stream, itemname, streamItemPerms, modificationTime, comment);
+}
+
+bool zpack_stream_writer::pack(std::istream &stream, std::string const &itemname, fs::perms perms,
+                               llint modificationTime, std::string const &comment) {
+    if (finished || !out.good() || !stream.good()) {
+        error_code = finished || !out.good() ? ZPack::Errors::ERR_OPENING_ARCHIVE_FILE
+                                             : ZPack::Errors::ERR_PACK_FILE_OPEN;
+        return false;
+    }
+
+    ZPack::Compression compress_method = compressionMethod;
+    ullint offset_start = offset;
+
+    uint ibufSize = blockSizeBytes > blockSizeMax ? blockSizeMax : blockSizeBytes;
+    zpack_buffer ibufHolder = bufferPool.acquire(ibufSize);
+    char *ibuf = ibufHolder.data();
+
+    zpack_checksum crc32(checksumType);
+
+    LocalFileExtraField extra_perms{};
+    LocalFileHeaderRecord loc_hd = ZPack::localHeader(itemname, extra_perms, perms, modificationTime, checksumType);
+
+    stream.read(ibuf, ibufSize);
+    auto readSize = (size_t) stream.gcount();
+
+    if (stream.eof() || stream.peek() == std::char_traits<char>::eof()) {
+        // the whole item fits one block, its sizes are known before the header goes out
+        zpack_buffer record;
+        size_t recordSize = ZPack::packRecord(record, loc_hd, itemname, extra_perms, ibuf, readSize, compress_method,
+                                              [this](ZPack::Compression &method) {
+                                                  return createCompression(method);
+                                              }, crc32, bufferPool);
+        emit(record.data(), recordSize);
+    } else {
+        ZPack::sealLocalHeader(loc_hd, ZPack::Streamed | ZPack::TrailingDescriptor, compress_method, 0, 0, 0);
+
+        size_t headSize = sizeof(loc_hd) + itemname.size() + sizeof(extra_perms);
+        zpack_buffer head = bufferPool.acquire(headSize);
+        ZPack::fillLocalHeader(head.data(), loc_hd, itemname, {extra_perms});
+        emit(head.data(), headSize);
+
+        std::unique_ptr<zpack_compression> ar;
+        if (compress_method != ZPack::CompressNone) {
+            ar = createCompression(compress_method);
+            ar->streamCompressSetup();
+        }
+
+        ullint uncompressedSize = 0;
+        ullint compressedSize = 0;
+        while (readSize > 0) {
+            crc32.process_bytes(ibuf, readSize);
+            uncompressedSize += readSize;
+            if (ar) {
+                ar->streamCompressConsume(out, ibuf, readSize);
+            } else {
+                emit(ibuf, readSize);
+                compressedSize += readSize;
+            }
+
+            if (!stream.good() || !out.good()) break;
+            stream.read(ibuf, ibufSize);
+            readSize = (size_t) stream.gcount();
+        }
+
+        if (ar) {
+            ar->streamCompressEnd(out);
+            compressedSize = ar->getStreamCompressBytes();
+            offset += compressedSize;
+        }
+
+        DataDescriptorRecord descriptor{};
+        assignInt<uint>(ZPack::DataDescriptor, descriptor.signature);
+        assignInt<uint>(crc32.checksum(), descriptor.crc32);
+        assignInt<ullint>(compressedSize, descriptor.compressedSize);
+        assignInt<ullint>(uncompressedSize, descriptor.uncompressedSize);
+        emit((const char *) &descriptor, sizeof(descriptor));
+
+        // the directory carries the real values, readers going through it never look at the descriptor
+        ZPack::sealLocalHeader(loc_hd, 0, compress_method, crc32.checksum(), compressedSize, uncompressedSize);
+    }
+
+    if (!out.good()) {
+        error_code = ZPack::Errors::ERR_OPENING_ARCHIVE_FILE;
+        return false;
+    }
+
+    DirectoryFileQueue entry = ZPack::directoryEntry(loc_hd, extra_perms, itemname, comment, offset_start);
+    auto existed = entryIndex.find(itemname);
+    if (existed != entryIndex.end()) {
+        entries[existed->second] = std::move(entry);
+    } else {
+        entryIndex.emplace(itemname, entries.size());
+        entries.push_back(std::move(entry));
+    }
+
+    return true;
+}
+
+bool zpack_stream_writer::finish() {
+    if (finished) return out.good();
+    finished = true;
+
+    std::string dirBuf;
+    dirBuf.reserve(entries.size() * (sizeof(DirectoryFileHeaderRecord) + 64) + sizeof(EndOfDirectoryRecord));
+    for (auto const &entry : entries) {
+        dirBuf.append((const char *) &entry.record, sizeof(entry.record));
+        dirBuf.append(entry.filename);
+        for (LocalFileExtraField const &exItem : entry.extra) {
+            dirBuf.append((const char *) &exItem, sizeof(exItem));
+        }
+        dirBuf.append(entry.comment);
+    }
+
+    if (dirBuf.size() > 0xFFFFFFFFULL) {
+        // the end record could not describe it, an archive without a directory is left unfinished
+        error_code = ZPack::Errors::ERR_DIRECTORY_SIZE;
+        return false;
+    }
+
+    EndOfDirectoryRecord eodr{};
+    assignInt<uint>(ZPack::DirectoryRecord, eodr.signature);
+    assignInt<usint>((usint) (entries.size() > 0xFFFF ? 0xFFFF : entries.size()), eodr.recordsNumber);
+    assignInt<uint>((uint) dirBuf.size(), eodr.dirRecordSize);
+    assignInt<ullint>(offset, eodr.dirRecordOffset);
+    assignInt<usint>(0, eodr.commentLen);
+    dirBuf.append((const char *) &eodr, sizeof(eodr));
+
+    emit(dirBuf.data(), dirBuf.size());
+    out.flush();
+
+    if (!out.good()) {
+        error_code = ZPack::Errors::ERR_OPENING_ARCHIVE_FILE;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef ZPACK_STREAM_WRITER_H
+#define ZPACK_STREAM_WRITER_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "zpack.h"
+
+/*
+ * Forward-only archive writer for outputs that cannot seek, like pipes, sockets or stdout. Nothing
+ * already written is touched again: items spanning several blocks are followed by a data descriptor
+ * instead of a patched local header and finish() appends the directory. The result is a regular
+ * archive.
+ */
+class zpack_stream_writer {
+    std::ostream &out;
+    ullint offset = 0;
+    bool finished = false;
+
+    std::vector<DirectoryFileQueue> entries;
+    std::unordered_map<std::string, size_t> entryIndex;
+
+    uint blockSizeMax = 1024 * 1024 * 6;
+    uint blockSizeBytes = blockSizeMax;
+    short int compressionLevel = 19;
+    bool compressionLevelSet = false;
+    ZPack::Compression compressionMethod = ZPack::CompressZstd;
+    ZPackChecksum checksumType = ZPackChecksum::CRC32;
+
+    zpack_buffer_pool bufferPool;
+
+    bool pack(std::istream &stream, std::string const &itemname, fs::perms perms, llint modificationTime,
+              std::string const &comment);
+
+    void emit(const char *data, size_t size);
+
+    std::unique_ptr<zpack_compression> createCompression(ZPack::Compression method);
+
+public:
+    ZPack::Errors error_code = ZPack::Errors::OK;
+
+    explicit zpack_stream_writer(std::ostream &out);
+
+    bool packFile(std::string const &filename, std::string const &directory = "", std::string const &comment = "");
+
+    bool packItem(std::string const &itemname, std::string const &data, std::string const &directory = "",
+                  std::string const &comment = "");
+
+    /*
+     * Item read from a stream of unknown length until its end.
+     */
+    bool packStream(std::istream &stream, std::string const &itemname, llint modificationTime,
+                    std::string const &comment = "");
+
+    /*
+     * Writes the directory, nothing can be packed afterwards. A name packed twice keeps its last copy.
+     */
+    bool finish();
+
+    ullint bytesWritten() const;
+
+    void setCompressionLevel(short int level);
+
+    bool setCompressionMethod(ZPack::Compression method);
+
+    void setBlockSize(uint size);
+
+    void setChecksum(ZPackChecksum type);
+};
+
+#endif //ZPACK_STREAM_WRITER_H
@@ -0,0 +1,41 @@
+#include "zpack_trace.h"
+
+const char *traceKindName(ZPackTraceKind kind) {
+    switch (kind) {
+        case ZPackTraceKind::PACK:
+            return "pack";
+        case ZPackTraceKind::EXTRACT:
+            return "extract";
+        case ZPackTraceKind::READ:
+            return "read";
+        case ZPackTraceKind::WRITE:
+            return "write";
+        case ZPackTraceKind::COMPRESS:
+            return "compress";
+        case ZPackTraceKind::DECOMPRESS:
+            return "decompress";
+        case ZPackTraceKind::DIRECTORY_READ:
+            return "directory_read";
+        case ZPackTraceKind::DIRECTORY_WRITE:
+            return "directory_write";
+        case ZPackTraceKind::REPACK:
+            return "repack";
+    }
+
+    return "unknown";
+}
+
+zpack_trace_console::zpack_trace_console(std::ostream &out) : out(out) {
+}
+
+void zpack_trace_console::onEvent(ZPackTraceEvent const &event) {
+    auto ts = std::chrono::duration_cast<std::chrono::microseconds>(event.time.time_since_epoch()).count();
+
+    out << ts << " " << (event.phase == ZPackTracePhase::BEGIN ? "B " : "E ") << traceKindName(event.kind)
+        << " offset: " << event.offset
+        << " size: " << event.size;
+    if (event.name) {
+        out << " item: " << *event.name;
+    }
+    out << std::endl;
+}
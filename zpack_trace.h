@@ -0,0 +1,94 @@
+#ifndef ZPACK_TRACE_H
+#define ZPACK_TRACE_H
+
+#include <chrono>
+#include <string>
+#include <ostream>
+
+enum class ZPackTraceKind {
+    PACK,
+    EXTRACT,
+    READ,
+    WRITE,
+    COMPRESS,
+    DECOMPRESS,
+    DIRECTORY_READ,
+    DIRECTORY_WRITE,
+    REPACK
+};
+
+enum class ZPackTracePhase {
+    BEGIN,
+    END
+};
+
+struct ZPackTraceEvent {
+    ZPackTraceKind kind;
+    ZPackTracePhase phase;
+    // item the step belongs to, nullptr for archive level steps
+    const std::string *name;
+    // archive offset the step works at, 0 when it does not touch the archive
+    unsigned long long offset;
+    // requested size on BEGIN, processed size on END
+    unsigned long long size;
+    std::chrono::steady_clock::time_point time;
+};
+
+class zpack_trace_listener {
+public:
+    virtual ~zpack_trace_listener() = default;
+
+    virtual void onEvent(ZPackTraceEvent const &event) = 0;
+};
+
+/*
+ * Prints every event as one line, a drop-in replacement for the old ZPACK_DEBUG output.
+ */
+class zpack_trace_console : public zpack_trace_listener {
+    std::ostream &out;
+
+public:
+    explicit zpack_trace_console(std::ostream &out);
+
+    void onEvent(ZPackTraceEvent const &event) override;
+};
+
+const char *traceKindName(ZPackTraceKind kind);
+
+/*
+ * BEGIN on construction, END on end() or destruction. Without a listener it is a null check only.
+ */
+class zpack_trace_span {
+    zpack_trace_listener *listener;
+    ZPackTraceKind kind;
+    const std::string *name;
+    unsigned long long offset;
+
+    void emit(ZPackTracePhase phase, unsigned long long size) {
+        listener->onEvent(ZPackTraceEvent{kind, phase, name, offset, size, std::chrono::steady_clock::now()});
+    }
+
+public:
+    zpack_trace_span(zpack_trace_listener *listener, ZPackTraceKind kind, const std::string *name,
+                     unsigned long long offset, unsigned long long size) :
+        listener(listener), kind(kind), name(name), offset(offset) {
+        if (listener) emit(ZPackTracePhase::BEGIN, size);
+    }
+
+    zpack_trace_span(zpack_trace_span const &) = delete;
+
+    zpack_trace_span &operator=(zpack_trace_span const &) = delete;
+
+    ~zpack_trace_span() {
+        end(0);
+    }
+
+    void end(unsigned long long size) {
+        if (listener) {
+            emit(ZPackTracePhase::END, size);
+            listener = nullptr;
+        }
+    }
+};
+
+#endif //ZPACK_TRACE_H
@@ -0,0 +1,432 @@
+#include "zpack_volumes.h"
+#include <algorithm>
+#include <thread>
+
+static const char *manifestMagic = "ZPackVolumes";
+static const uint manifestVersion = 1;
+
+// FNV-1a, std::hash is free to differ between builds and placement has to survive them
+static ullint placementHash(std::string const &name) {
+    ullint hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : name) {
+        hash ^= c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+ZPackVolumes::~ZPackVolumes() {
+    close();
+}
+
+template<typename F>
+void ZPackVolumes::eachVolume(std::vector<uint> const &indexes, F fn) {
+    if (indexes.size() == 1) {
+        fn(indexes[0]);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(indexes.size());
+    for (uint index : indexes) {
+        workers.emplace_back([&fn, index] { fn(index); });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+bool ZPackVolumes::create(std::string const &manifest, std::vector<std::string> const &volumeFiles,
+                          Placement placementType) {
+    close();
+
+    if (volumeFiles.empty()) {
+        error_code = ZPack::Errors::ERR_OPENING_ARCHIVE_FILE;
+        return false;
+    }
+
+    manifest_name = manifest;
+    volumePaths = volumeFiles;
+    placement = placementType;
+
+    if (!writeManifest()) {
+        return false;
+    }
+
+    return openVolumes(true);
+}
+
+bool ZPackVolumes::open(std::string const &manifest) {
+    close();
+
+    std::ifstream mfile(manifest);
+    std::string magic;
+    uint version = 0;
+    mfile >> magic >> version;
+    if (!mfile || magic != manifestMagic || version > manifestVersion) {
+        error_code = ZPack::Errors::ERR_READ_MANIFEST;
+        return false;
+    }
+
+    manifest_name = manifest;
+    std::string key;
+    while (mfile >> key) {
+        if (key == "placement") {
+            std::string value;
+            mfile >> value;
+            placement = value == "size" ? Placement::SIZE : Placement::HASH;
+        } else if (key == "volume") {
+            std::string path;
+            mfile >> std::ws;
+            std::getline(mfile, path);
+            volumePaths.push_back(path);
+        } else {
+            std::string skip;
+            std::getline(mfile, skip);
+        }
+    }
+
+    if (volumePaths.empty()) {
+        error_code = ZPack::Errors::ERR_READ_MANIFEST;
+        return false;
+    }
+
+    return openVolumes(false);
+}
+
+bool ZPackVolumes::writeManifest() {
+    std::ofstream mfile(manifest_name, std::ios_base::out | std::ios_base::trunc);
+    mfile << manifestMagic << " " << manifestVersion << std::endl
+          << "placement " << (placement == Placement::SIZE ? "size" : "hash") << std::endl;
+    for (auto const &path : volumePaths) {
+        mfile << "volume " << path << std::endl;
+    }
+
+    if (!mfile) {
+        error_code = ZPack::Errors::ERR_READ_MANIFEST;
+        return false;
+    }
+
+    return true;
+}
+
+fs::path ZPackVolumes::volumePath(uint index) const {
+    fs::path path(volumePaths[index]);
+    if (path.is_relative()) {
+        path = fs::path(manifest_name).parent_path() / path;
+    }
+    return path;
+}
+
+bool ZPackVolumes::openVolumes(bool trunicate) {
+    volumes.clear();
+    volumeBytes.assign(volumePaths.size(), 0);
+    locations.clear();
+
+    std::vector<uint> indexes;
+    for (uint i = 0; i < volumePaths.size(); i++) {
+        volumes.emplace_back(new ZPack());
+        indexes.push_back(i);
+    }
+
+    // volume directories are read concurrently, they usually sit on different disks
+    eachVolume(indexes, [&](uint i) {
+        volumes[i]->open(volumePath(i).c_str(), trunicate);
+    });
+
+    for (uint i = 0; i < volumes.size(); i++) {
+        if (volumes[i]->error_code != ZPack::Errors::OK) {
+            error_code = volumes[i]->error_code;
+            return false;
+        }
+        indexVolume(i);
+    }
+
+    return true;
+}
+
+void ZPackVolumes::indexVolume(uint index) {
+    for (auto it = locations.begin(); it != locations.end();) {
+        if (it->second == index) {
+            it = locations.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    volumeBytes[index] = 0;
+    volumes[index]->forEachEntry("", [&](ZPackEntry const &entry) {
+        locations[entry.name] = index;
+        volumeBytes[index] += entry.uncompressedSize;
+        return true;
+    });
+}
+
+void ZPackVolumes::close() {
+    volumes.clear();
+    volumePaths.clear();
+    volumeBytes.clear();
+    locations.clear();
+}
+
+void ZPackVolumes::write() {
+    std::vector<uint> indexes;
+    for (uint i = 0; i < volumes.size(); i++) {
+        indexes.push_back(i);
+    }
+
+    eachVolume(indexes, [this](uint i) {
+        volumes[i]->write();
+    });
+}
+
+uint ZPackVolumes::placeItem(std::string const &itemname, std::vector<ullint> const &bytes) const {
+    // a replaced item stays where the old copy is, otherwise both would be in the directory
+    auto existed = locations.find(itemname);
+    if (existed != locations.end()) {
+        return existed->second;
+    }
+
+    if (placement == Placement::SIZE) {
+        return (uint) (std::min_element(bytes.begin(), bytes.end()) - bytes.begin());
+    }
+
+    return (uint) (placementHash(itemname) % volumes.size());
+}
+
+ullint ZPackVolumes::itemSize(uint index, std::string const &name) {
+    ullint size = 0;
+    // entries come in name order, the item itself is the first one under its own name
+    volumes[index]->forEachEntry(name, [&](ZPackEntry const &entry) {
+        if (entry.name == name) size = entry.uncompressedSize;
+        return false;
+    });
+    return size;
+}
+
+void ZPackVolumes::bookItem(std::string const &name, uint index, ullint previous, ullint size) {
+    volumeBytes[index] -= std::min(previous, volumeBytes[index]);
+    volumeBytes[index] += size;
+    locations[name] = index;
+}
+
+bool ZPackVolumes::packFile(std::string const &filename, std::string const &directory, std::string const &comment) {
+    if (volumes.empty()) {
+        error_code = ZPack::Errors::ERR_OPENING_ARCHIVE_FILE;
+        return false;
+    }
+
+    std::string name = directory + (!directory.empty() && directory.back() != '/' ? "/" : "") +
+                       fs::path(filename).filename().string();
+    boost::system::error_code ec;
+    auto size = (ullint) fs::file_size(filename, ec);
+    uint index = placeItem(name, volumeBytes);
+    ullint previous = contains(name) ? itemSize(index, name) : 0;
+    if (!volumes[index]->packFile(filename, directory, comment)) {
+        error_code = volumes[index]->error_code;
+        return false;
+    }
+
+    bookItem(name, index, previous, ec ? 0 : size);
+    return true;
+}
+
+bool ZPackVolumes::packItem(std::string const &itemname, std::string const &data, std::string const &directory,
+                            std::string const &comment) {
+    if (volumes.empty()) {
+        error_code = ZPack::Errors::ERR_OPENING_ARCHIVE_FILE;
+        return false;
+    }
+
+    std::string name = directory + (!directory.empty() && directory.back() != '/' ? "/" : "") + itemname;
+    uint index = placeItem(name, volumeBytes);
+    ullint previous = contains(name) ? itemSize(index, name) : 0;
+    if (!volumes[index]->packItem(itemname, data, directory, comment)) {
+        error_code = volumes[index]->error_code;
+        return false;
+    }
+
+    bookItem(name, index, previous, data.size());
+    return true;
+}
+
+size_t ZPackVolumes::packFiles(std::vector<FileSource> const &files) {
+    if (volumes.empty()) {
+        error_code = ZPack::Errors::ERR_OPENING_ARCHIVE_FILE;
+        return 0;
+    }
+
+    struct Job {
+        FileSource const *source;
+        std::string name;
+        ullint size;
+        ullint previous;
+    };
+
+    std::vector<Job> jobs;
+    jobs.reserve(files.size());
+    for (auto const &source : files) {
+        std::string name = source.directory +
+                           (!source.directory.empty() && source.directory.back() != '/' ? "/" : "") +
+                           fs::path(source.filename).filename().string();
+        boost::system::error_code ec;
+        auto size = (ullint) fs::file_size(source.filename, ec);
+        auto existed = locations.find(name);
+        ullint previous = existed != locations.end() ? itemSize(existed->second, name) : 0;
+        jobs.push_back(Job{&source, name, ec ? 0 : size, previous});
+    }
+
+    // biggest first gives the size placement a fair greedy balance
+    if (placement == Placement::SIZE) {
+        std::stable_sort(jobs.begin(), jobs.end(), [](Job const &a, Job const &b) {
+            return a.size > b.size;
+        });
+    }
+
+    // placement balances on the planned bytes, volumeBytes only takes what was actually packed
+    std::vector<ullint> planned = volumeBytes;
+    std::vector<std::vector<Job const *>> perVolume(volumes.size());
+    for (auto const &job : jobs) {
+        uint index = placeItem(job.name, planned);
+        planned[index] += job.size;
+        perVolume[index].push_back(&job);
+    }
+
+    std::vector<uint> indexes;
+    for (uint i = 0; i < perVolume.size(); i++) {
+        if (!perVolume[i].empty()) indexes.push_back(i);
+    }
+
+    std::vector<std::vector<bool>> packed(volumes.size());
+    eachVolume(indexes, [&](uint i) {
+        for (auto job : perVolume[i]) {
+            packed[i].push_back(volumes[i]->packFile(job->source->filename, job->source->directory));
+        }
+    });
+
+    size_t count = 0;
+    for (uint i : indexes) {
+        for (size_t j = 0; j < perVolume[i].size(); j++) {
+            if (packed[i][j]) {
+                bookItem(perVolume[i][j]->name, i, perVolume[i][j]->previous, perVolume[i][j]->size);
+                count++;
+            } else {
+                error_code = volumes[i]->error_code;
+            }
+        }
+    }
+
+    return count;
+}
+
+bool ZPackVolumes::remove(std::string const &name) {
+    auto item = locations.find(name);
+    if (item == locations.end()) return false;
+
+    uint index = item->second;
+    ullint size = itemSize(index, name);
+
+    bool res = volumes[index]->remove(name);
+    if (res) {
+        volumeBytes[index] -= std::min(size, volumeBytes[index]);
+    }
+    locations.erase(item);
+    return res;
+}
+
+bool ZPackVolumes::contains(std::string const &name) const {
+    return locations.find(name) != locations.end();
+}
+
+std::string ZPackVolumes::extractStr(std::string const &name) {
+    auto item = locations.find(name);
+    if (item == locations.end()) return "";
+
+    return volumes[item->second]->extractStr(name);
+}
+
+bool ZPackVolumes::extractFile(std::string const &name, std::string const &dest) {
+    auto item = locations.find(name);
+    if (item == locations.end()) return false;
+
+    return volumes[item->second]->extractFile(name, dest);
+}
+
+size_t ZPackVolumes::extractFiles(std::vector<std::string> const &names, std::string const &dest) {
+    std::vector<std::vector<std::string const *>> perVolume(volumes.size());
+    for (auto const &name : names) {
+        auto item = locations.find(name);
+        if (item != locations.end()) {
+            perVolume[item->second].push_back(&name);
+        }
+    }
+
+    std::vector<uint> indexes;
+    for (uint i = 0; i < perVolume.size(); i++) {
+        if (!perVolume[i].empty()) indexes.push_back(i);
+    }
+
+    std::vector<size_t> extracted(volumes.size(), 0);
+    eachVolume(indexes, [&](uint i) {
+        for (auto name : perVolume[i]) {
+            if (volumes[i]->extractFile(*name, dest)) extracted[i]++;
+        }
+    });
+
+    size_t count = 0;
+    for (auto n : extracted) count += n;
+    return count;
+}
+
+void ZPackVolumes::repack() {
+    std::vector<uint> indexes;
+    for (uint i = 0; i < volumes.size(); i++) {
+        indexes.push_back(i);
+    }
+
+    eachVolume(indexes, [this](uint i) {
+        volumes[i]->repack();
+    });
+}
+
+bool ZPackVolumes::repackVolume(uint index) {
+    if (index >= volumes.size()) return false;
+
+    volumes[index]->repack();
+    if (volumes[index]->error_code != ZPack::Errors::OK) {
+        error_code = volumes[index]->error_code;
+        return false;
+    }
+
+    return true;
+}
+
+uint ZPackVolumes::volumesCount() const {
+    return (uint) volumes.size();
+}
+
+uint ZPackVolumes::volumeOf(std::string const &name) const {
+    auto item = locations.find(name);
+    return item == locations.end() ? (uint) volumes.size() : item->second;
+}
+
+ZPack &ZPackVolumes::volume(uint index) {
+    return *volumes.at(index);
+}
+
+ZPackStats ZPackVolumes::getStats() {
+    // volume stats are only filled by write(), so the totals come from the directories
+    ZPackStats res{0, 0, 0, 0, 0, 0};
+    for (uint i = 0; i < volumes.size(); i++) {
+        ZPackSubtreeStats subtree = volumes[i]->subtreeStats("");
+        res.filesSizeUncompressed += subtree.uncompressedSize;
+        res.filesSizeCompressed += subtree.compressedSize;
+        res.records += (uint) subtree.items;
+
+        boost::system::error_code ec;
+        auto size = (ullint) fs::file_size(volumePath(i), ec);
+        if (!ec) res.archiveSize += size;
+    }
+
+    return res;
+}
@@ -0,0 +1,113 @@
+#ifndef ZPACK_VOLUMES_H
+#define ZPACK_VOLUMES_H
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "zpack.h"
+
+/*
+ * Archive striped over several volume files, each of them a regular ZPack archive, usually placed on
+ * different disks. A small text manifest lists the volumes, the combined directory is rebuilt from
+ * the volume directories on open and tells which volume holds every item.
+ */
+class ZPackVolumes {
+public:
+    enum class Placement {
+        // stable name hash, an item always lands on the same volume
+        HASH,
+        // the volume holding the fewest bytes, keeps volumes evenly filled
+        SIZE
+    };
+
+    struct FileSource {
+        std::string filename;
+        std::string directory;
+    };
+
+private:
+    std::string manifest_name;
+    std::vector<std::string> volumePaths;
+    std::vector<std::unique_ptr<ZPack>> volumes;
+    std::vector<ullint> volumeBytes;
+    std::unordered_map<std::string, uint> locations;
+    Placement placement = Placement::HASH;
+
+    // volume for the item, SIZE placement picks the lightest of bytes
+    uint placeItem(std::string const &itemname, std::vector<ullint> const &bytes) const;
+
+    ullint itemSize(uint index, std::string const &name);
+
+    // records a packed item, previous is the size of the copy it replaced
+    void bookItem(std::string const &name, uint index, ullint previous, ullint size);
+
+    fs::path volumePath(uint index) const;
+
+    bool writeManifest();
+
+    bool openVolumes(bool trunicate);
+
+    void indexVolume(uint index);
+
+    template<typename F>
+    void eachVolume(std::vector<uint> const &indexes, F fn);
+
+public:
+    ZPack::Errors error_code = ZPack::Errors::OK;
+
+    ZPackVolumes() = default;
+
+    ~ZPackVolumes();
+
+    /*
+     * New striped archive, relative volume paths are resolved against the manifest directory.
+     */
+    bool create(std::string const &manifest, std::vector<std::string> const &volumeFiles,
+                Placement placement = Placement::HASH);
+
+    bool open(std::string const &manifest);
+
+    void close();
+
+    void write();
+
+    bool packFile(std::string const &filename, std::string const &directory = "", std::string const &comment = "");
+
+    bool packItem(std::string const &itemname, std::string const &data, std::string const &directory = "",
+                  std::string const &comment = "");
+
+    /*
+     * Packs files into their volumes with one thread per volume, returns the number packed.
+     */
+    size_t packFiles(std::vector<FileSource> const &files);
+
+    bool remove(std::string const &name);
+
+    bool contains(std::string const &name) const;
+
+    std::string extractStr(std::string const &name);
+
+    bool extractFile(std::string const &name, std::string const &dest);
+
+    /*
+     * Extracts items with one thread per volume, returns the number extracted.
+     */
+    size_t extractFiles(std::vector<std::string> const &names, std::string const &dest);
+
+    // repacks every volume in parallel
+    void repack();
+
+    bool repackVolume(uint index);
+
+    uint volumesCount() const;
+
+    // volume holding the item, volumesCount() when there is no such item
+    uint volumeOf(std::string const &name) const;
+
+    ZPack &volume(uint index);
+
+    ZPackStats getStats();
+};
+
+#endif //ZPACK_VOLUMES_H
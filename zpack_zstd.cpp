@@ -1,20 +1,79 @@
 #include "zpack_zstd.h"
-#include "_cfg.h"
+#include <algorithm>
+// only for the level presets, window bounds and context estimates of windowParams and getContextSize,
+// all of them exported by the shared library as well
+#define ZSTD_STATIC_LINKING_ONLY
+#include <zstd.h>
+
+// ZSTD_compress2 and the context reset are stable from 1.4.0, the experimental parts used here are
+// unchanged since then
+#if ZSTD_VERSION_NUMBER < 10400
+#error "zpack_zstd needs zstd 1.4.0 or newer"
+#endif
+
+// preset of the level with the window lowered to windowLog, match tables follow the window down
+static ZSTD_compressionParameters windowParams(int level, int windowLog) {
+    ZSTD_compressionParameters params = ZSTD_getCParams(level, 0, 0);
+    if (windowLog <= 0 || (int) params.windowLog <= windowLog) return params;
+
+    unsigned int shift = params.windowLog - (unsigned int) windowLog;
+    params.windowLog = (unsigned int) windowLog;
+    params.hashLog = params.hashLog > ZSTD_HASHLOG_MIN + shift ? params.hashLog - shift : ZSTD_HASHLOG_MIN;
+    params.chainLog = params.chainLog > ZSTD_CHAINLOG_MIN + shift ? params.chainLog - shift : ZSTD_CHAINLOG_MIN;
+    return params;
+}
+
+void zpack_zstd::limitWindow(ZSTD_CCtx *ctx) const {
+    if (windowLog <= 0 || (int) ZSTD_getCParams(compressionLevel, 0, 0).windowLog <= windowLog) return;
+
+    ZSTD_compressionParameters params = windowParams(compressionLevel, windowLog);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_windowLog, (int) params.windowLog);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_hashLog, (int) params.hashLog);
+    ZSTD_CCtx_setParameter(ctx, ZSTD_c_chainLog, (int) params.chainLog);
+}
+
+zpack_zstd::~zpack_zstd() {
+    ZSTD_freeCCtx(blockCCtx);
+    ZSTD_freeDCtx(blockDCtx);
+}
+
+unsigned long long zpack_zstd::blockContextBytes() const {
+    return ZSTD_sizeof_CCtx(blockCCtx) + ZSTD_sizeof_DCtx(blockDCtx);
+}
+
+unsigned long long zpack_zstd::getContextSize() {
+    ZSTD_compressionParameters params = windowParams(compressionLevel, windowLog);
+    unsigned long long context = ZSTD_estimateCStreamSize_usingCParams(params);
+    if (workers == 0) return context;
+
+    // every worker has its own context and holds about a job of input and of output
+    unsigned long long job = jobSize > 0 ? jobSize : std::max(1ULL << (params.windowLog + 2), 1ULL << 20);
+    return context + workers * (context + 2 * job);
+}
 
 unsigned long long zpack_zstd::getCompressedSize(size_t size) {
     return ZSTD_compressBound(size);
 }
 
 unsigned long long zpack_zstd::compressBlock(const char *ibuf, size_t isize, char *obuf, size_t osize) {
-    size_t compressed_len = ZSTD_compress(
+    if (blockCCtx == NULL) {
+        blockCCtx = ZSTD_createCCtx();
+        if (blockCCtx == NULL) {
+            throw std::runtime_error("ZSTD_createCCtx() error");
+        }
+    } else {
+        // parameters go too, level and window may have changed since the last block
+        ZSTD_CCtx_reset(blockCCtx, ZSTD_reset_session_and_parameters);
+    }
+    ZSTD_CCtx_setParameter(blockCCtx, ZSTD_c_compressionLevel, compressionLevel);
+    limitWindow(blockCCtx);
+
+    size_t compressed_len = ZSTD_compress2(
+        blockCCtx,
         obuf, osize,
-        ibuf, isize,
-        compressionLevel
+        ibuf, isize
     );
-
-    #if ZPACK_DEBUG
-    std::cout << std::endl << "ZSTD in: " << isize << " out: " << compressed_len << std::endl << std::endl;
-    #endif
+    holdContext(blockContextBytes());
 
     std::string errorDesc;
     if (ZSTD_isError(compressed_len)) {
@@ -36,10 +95,21 @@ unsigned long long zpack_zstd::getDecompressedSize(const char *ibuf, size_t isiz
 }
 
 unsigned long long zpack_zstd::decompressBlock(const char *ibuf, size_t isize, char *obuf, size_t osize) {
-    size_t decompressed_len = ZSTD_decompress(
+    if (blockDCtx == NULL) {
+        blockDCtx = ZSTD_createDCtx();
+        if (blockDCtx == NULL) {
+            throw std::runtime_error("ZSTD_createDCtx() error");
+        }
+    } else {
+        ZSTD_DCtx_reset(blockDCtx, ZSTD_reset_session_only);
+    }
+
+    size_t decompressed_len = ZSTD_decompressDCtx(
+        blockDCtx,
         obuf, osize,
         ibuf, isize
     );
+    holdContext(blockContextBytes());
 
     std::string errorDesc;
     switch (decompressed_len) {
@@ -69,21 +139,29 @@ bool zpack_zstd::streamCompressSetup() {
 
     streamType = 'C';
 
-    streamBufSize = ZSTD_CStreamOutSize();
-    streamBuf = std::malloc(streamBufSize);
-    if (!streamBuf) {
-        std::perror("zpack_zstd streamSetup buffer Out malloc failed");
-        return false;
-    }
+    streamBuffer = zpack_buffer_pool::acquire(bufferPool, ZSTD_CStreamOutSize());
+    streamBuf = streamBuffer.data();
+    streamBufSize = streamBuffer.size();
 
     zstd_cStream = ZSTD_createCStream();
     if (zstd_cStream == NULL) {
         throw std::runtime_error("ZSTD_createCStream() error");
     }
 
-    size_t init_result = ZSTD_initCStream(zstd_cStream, compressionLevel);
+    size_t init_result = ZSTD_CCtx_setParameter(zstd_cStream, ZSTD_c_compressionLevel, compressionLevel);
     if (ZSTD_isError(init_result)) {
-        throw std::runtime_error(std::string("ZSTD_initCStream error: ") + ZSTD_getErrorName(init_result));
+        throw std::runtime_error(std::string("ZSTD_CCtx_setParameter error: ") + ZSTD_getErrorName(init_result));
+    }
+    limitWindow(zstd_cStream);
+
+    // a library built without multithreading rejects the worker parameters, the stream stays single threaded
+    if (workers > 0 && !ZSTD_isError(ZSTD_CCtx_setParameter(zstd_cStream, ZSTD_c_nbWorkers, (int) workers))) {
+        if (jobSize > 0) {
+            ZSTD_CCtx_setParameter(zstd_cStream, ZSTD_c_jobSize, (int) jobSize);
+        }
+        if (overlapLog > 0) {
+            ZSTD_CCtx_setParameter(zstd_cStream, ZSTD_c_overlapLog, overlapLog);
+        }
     }
 
     return true;
@@ -95,7 +173,7 @@ void zpack_zstd::streamCompressConsume(std::ostream &write, const char *buf, siz
     while (input.pos < input.size) {
         ZSTD_outBuffer output{streamBuf, streamBufSize, 0};
 
-        auto readed = ZSTD_compressStream(zstd_cStream, &output, &input);
+        auto readed = ZSTD_compressStream2(zstd_cStream, &output, &input, ZSTD_e_continue);
         if (ZSTD_isError(readed)) {
             throw std::runtime_error(
                 std::string("zpack_zstd::streamCompressConsume error: ") + ZSTD_getErrorName(readed));
@@ -104,25 +182,30 @@ void zpack_zstd::streamCompressConsume(std::ostream &write, const char *buf, siz
         write.write((char *) streamBuf, output.pos);
         streamCompressed += output.pos;
     }
+    holdContext(ZSTD_sizeof_CStream(zstd_cStream) + blockContextBytes());
 }
 
 void zpack_zstd::streamCompressEnd(std::ostream &write) {
-    ZSTD_outBuffer output{streamBuf, streamBufSize, 0};
-    size_t const left = ZSTD_endStream(zstd_cStream, &output);
-    if (left > 0) {
+    // with workers the frame epilogue can take several calls, each one flushes what jobs finished
+    ZSTD_inBuffer input{nullptr, 0, 0};
+    size_t left = 0;
+    do {
+        ZSTD_outBuffer output{streamBuf, streamBufSize, 0};
+        left = ZSTD_compressStream2(zstd_cStream, &output, &input, ZSTD_e_end);
         if (ZSTD_isError(left)) {
             throw std::runtime_error(
                 std::string("zpack_zstd::streamCompressEnd error: ") + ZSTD_getErrorName(left));
-        } else {
-            throw std::runtime_error("zpack_zstd::streamCompressEnd error: stream flush is not complete");
         }
-    }
 
-    write.write((char *) streamBuf, output.pos);
-    streamCompressed += output.pos;
+        write.write((char *) streamBuf, output.pos);
+        streamCompressed += output.pos;
+    } while (left > 0);
+    holdContext(ZSTD_sizeof_CStream(zstd_cStream) + blockContextBytes());
 
-    std::free(streamBuf);
+    streamBuffer.release();
+    streamBuf = nullptr;
     ZSTD_freeCStream(zstd_cStream);
+    holdContext(blockContextBytes());
 }
 
 bool zpack_zstd::streamDecompressSetup() {
@@ -131,12 +214,9 @@ bool zpack_zstd::streamDecompressSetup() {
 
     streamType = 'D';
 
-    streamBufSize = ZSTD_DStreamOutSize();
-    streamBuf = std::malloc(streamBufSize);
-    if (!streamBuf) {
-        std::perror("zpack_zstd streamSetup buffer Out malloc failed");
-        return false;
-    }
+    streamBuffer = zpack_buffer_pool::acquire(bufferPool, ZSTD_DStreamOutSize());
+    streamBuf = streamBuffer.data();
+    streamBufSize = streamBuffer.size();
 
     zstd_dStream = ZSTD_createDStream();
     if (zstd_dStream == NULL) {
@@ -180,21 +260,15 @@ void zpack_zstd::streamDecompressConsume(std::ostream &write, const char *buf, s
 
         streamDecompressed += output.pos;
         streamDecompressLastConsume = session_size;
-        #if ZPACK_DEBUG
-        std::cout << "===== streamDecompressConsume "
-                  << " out pos: " << output.pos << " out size: " << output.size
-                  << " inp pos: " << input.pos << " inp size: " << input.size
-                  << " ret: "
-                  << readed// << " CTX: " << ZSTD_sizeof_DStream(zstd_dStream)
-                  << " sess: " << session_size
-                  << std::endl;
-        #endif
     }
+    holdContext(ZSTD_sizeof_DStream(zstd_dStream) + blockContextBytes());
 }
 
 bool zpack_zstd::streamDecompressEnd() {
-    std::free(streamBuf);
+    streamBuffer.release();
+    streamBuf = nullptr;
     ZSTD_freeDStream(zstd_dStream);
+    holdContext(blockContextBytes());
 
     return true;
 }
\ No newline at end of file
@@ -13,7 +13,17 @@
 #include "zpack_compression.h"
 
 class zpack_zstd : public zpack_compression {
+    // block contexts live as long as the codec and are reset between blocks
+    ZSTD_CCtx *blockCCtx = nullptr;
+    ZSTD_DCtx *blockDCtx = nullptr;
+
+    void limitWindow(ZSTD_CCtx *ctx) const;
+
+    unsigned long long blockContextBytes() const;
+
 public:
+    ~zpack_zstd() override;
+
     unsigned long long
     getCompressedSize(size_t size) override;
 
@@ -26,6 +36,8 @@ public:
     unsigned long long
     decompressBlock(const char *ibuf, size_t isize, char *obuf, size_t osize) override;
 
+    unsigned long long getContextSize() override;
+
     bool streamCompressSetup() override;
 
     void streamCompressConsume(std::ostream &write, const char *buf, size_t size) override;